@@ -0,0 +1,40 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+class OutputFile;
+
+/*
+ * 
+ * Struct: AnalysisConfig
+ * 
+ * One analysis configuration: histogram binning, telescopes to be
+ * analyzed and where their histograms are written. All configurations
+ * are filled from the same pass over the bunches.
+ * 
+ */
+struct AnalysisConfig
+{
+  std::string name;
+  int         binsX, binsY;
+  float       xMin, xMax, yMin, yMax;
+  std::string onlyTelescopes;  // Telescopes to analyze (empty: as in the command line)
+  std::string outputFileName;  // Own output file (empty: directory in the output file)
+  std::string directory;       // Directory where histograms are written
+  std::vector<int> telIDs;     // Telescope IDs for this configuration (-1: not analyzed)
+  OutputFile *file;            // Own output file, if any
+};
+
+namespace global
+{
+  extern std::vector<AnalysisConfig> configs;
+};
+
+bool ReadConfigFile(std::string);
+void SetDefaultConfig();
+bool ConfigsHaveOwnFiles();
+void SetConfigTelescopes();
+bool TelescopeWanted(int);
+bool OpenConfigOutputs(OutputFile *, bool);
+void CloseConfigOutputs();
@@ -1 +1,14 @@
-void   AnalyzePhotonBunches(eventio::EventIO::Item *, TFile *);
+#include <cstdint>
+
+class RawBlockReader;
+class OutputFile;
+
+void   AnalyzePhotonBunches(eventio::EventIO::Item *, OutputFile *);
+void   AnalyzeTelescopeArray(eventio::EventIO::Item *, OutputFile *);
+bool   StreamTelescopeArray(RawBlockReader &, OutputFile *);
+void   BeginBunchStream(OutputFile *);
+bool   BeginStreamTelescope(int);
+int16_t *GetStreamSpace(long &);
+void   AddStreamBunches(long);
+void   EndBunchStream();
+bool   ReportKernelCheck();
@@ -1,2 +1,5 @@
 double AtmosphericTransmission(double, double, double);
 bool   ReadAtmosphericTransmission(std::string);
+void   SetAtmosphericParameter(double);
+bool   SetExpectedTransmission(double, double);
+double ExpectedTransmission(double, double);
@@ -0,0 +1 @@
+bool RunBatch();
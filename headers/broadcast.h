@@ -0,0 +1,4 @@
+#pragma once
+
+bool BroadcastInput();
+bool AttachBroadcast();
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <memory>
+
+class OutputFile;
+class CorsikaBlock;
+class TelescopeDefinition;
+
+bool OpenBunchCache(std::string);
+void CacheCorsikaBlock(int, CorsikaBlock &);
+void CacheTelescopeDefinition(TelescopeDefinition &);
+void CacheTelescope(int16_t, int16_t, float, int32_t);
+void CacheBunches(const int16_t *, long);
+bool CloseBunchCache();
+bool IsBunchCache(std::string);
+int  ReadBunchCache(std::string, std::unique_ptr<OutputFile> &);
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <string>
+
+class OutputFile;
+
+/*
+ * 
+ * Struct: Checkpoint
+ * 
+ * State needed to resume a conversion: position in the input right
+ * after the last fully processed event, the event counter, and the
+ * snapshot of the output file at that point with its size.
+ * 
+ */
+struct Checkpoint
+{
+  std::string inputFileName;
+  long long   inputOffset;
+  int         iEvt;
+  long long   outputEnd;
+  std::string snapshot;
+};
+
+long long CommitOutput(OutputFile *);
+bool      WriteCheckpoint(std::string, const Checkpoint &);
+bool      ReadCheckpoint(std::string, Checkpoint &);
+bool      SaveCheckpoint(std::string, OutputFile *, std::string, Checkpoint &);
+bool      RestoreCheckpoint(std::string, const Checkpoint &);
+void      RemoveCheckpoint(std::string, const Checkpoint &);
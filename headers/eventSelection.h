@@ -0,0 +1,14 @@
+#pragma once
+
+#include <string>
+
+class OutputFile;
+
+bool        ParseSelection(std::string);
+bool        AddEventRange(std::string);
+bool        SelectEvent();
+std::string SelectionCuts();
+bool        SelectionWithin(std::string);
+void        InitEventTable(OutputFile *);
+void        FillEventTable(bool);
+void        WriteEventTable();
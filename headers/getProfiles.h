@@ -1 +1,3 @@
-void   GetProfiles(eventio::EventIO::Item *, TFile* rootFile = nullptr);
+class OutputFile;
+
+void   GetProfiles(eventio::EventIO::Item *, OutputFile *outputFile = nullptr);
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <vector>
+
+class TH2F;
+
+/*
+ * 
+ * Class: HistogramAccumulator
+ * 
+ * A plain 2D histogram with fixed binning, filled like a TH2F (same
+ * bin lookup, underflow/overflow bins, sum of squared weights and
+ * statistics) but without any ROOT object behind it. Contents and sums
+ * of squared weights are summed in double precision and only rounded
+ * to float on export, so they may differ in the last bit from those of
+ * a TH2F filled directly. Several of them can be filled independently
+ * (e.g. in different threads) and then be added up and exported into
+ * a TH2F.
+ * 
+ */
+class HistogramAccumulator
+{
+  private:
+  
+    int    nx, ny;
+    double xmin, xmax, ymin, ymax;
+    double entries;
+    double stats[7]; // sumw, sumw2, sumwx, sumwx2, sumwy, sumwy2, sumwxy
+    std::vector<double> content;
+    std::vector<double> sumw2;
+  
+  public:
+  
+    HistogramAccumulator(int nbinsx, double xlow, double xup, int nbinsy, double ylow, double yup) :
+      nx(nbinsx), ny(nbinsy), xmin(xlow), xmax(xup), ymin(ylow), ymax(yup), entries(0),
+      content((nbinsx+2)*(nbinsy+2),0.), sumw2((nbinsx+2)*(nbinsy+2),0.)
+    {
+      for (int i=0; i<7; i++) stats[i] = 0;
+    }
+    
+    void Fill(double x, double y, double w)
+    {
+      int binx, biny;
+      if      (x < xmin)    binx = 0;
+      else if (!(x < xmax)) binx = nx+1;
+      else                  binx = 1 + int(nx*(x-xmin)/(xmax-xmin));
+      if      (y < ymin)    biny = 0;
+      else if (!(y < ymax)) biny = ny+1;
+      else                  biny = 1 + int(ny*(y-ymin)/(ymax-ymin));
+      
+      int bin = biny*(nx+2) + binx;
+      entries++;
+      content[bin] += w;
+      sumw2[bin]   += w*w;
+      
+      // Statistics only include entries within the histogram range
+      if (binx == 0 || binx > nx || biny == 0 || biny > ny) return;
+      stats[0] += w;
+      stats[1] += w*w;
+      stats[2] += w*x;
+      stats[3] += w*x*x;
+      stats[4] += w*y;
+      stats[5] += w*y*y;
+      stats[6] += w*x*y;
+    }
+    
+    int    GetNbinsX() const { return nx; }
+    int    GetNbinsY() const { return ny; }
+    double GetXmin()   const { return xmin; }
+    double GetXmax()   const { return xmax; }
+    double GetYmin()   const { return ymin; }
+    double GetYmax()   const { return ymax; }
+    const std::vector<double> &GetContents() const { return content; }
+    
+    void Add(const HistogramAccumulator &other);
+    bool Identical(const HistogramAccumulator &other) const;
+#ifndef IACT_NO_ROOT
+    void Export(TH2F &histo) const;
+#endif
+};
@@ -1,11 +1,19 @@
 #pragma once 
 
+#include <iostream>
 #include <iomanip>
+#include <string>
 #include <sstream>
+#include <vector>
+#include <algorithm>
+#include <cmath>
 
+#ifndef IACT_NO_ROOT
 #include <TRandom1.h>
+#endif
 
 void ShowProgress(int);
+int  ProcessInput(eventio::EventIO &);
 
 class CorsikaBlock
 {
@@ -27,6 +35,13 @@ class CorsikaBlock
     }
     bool Status()       { return status; }
     float GetField(int i) { return fields[i]; }
+    int   GetNFields()    { return nFields; }
+    const float *GetFields() { return fields; }
+    void SetFields(const float *values)
+    {
+      for (int i=0; i<nFields; i++) fields[i] = values[i];
+      status = true;
+    }
     void Dump()   
     {
       std::cout << 1 << " " << (char*)&fields[1] << std::endl;
@@ -85,6 +100,17 @@ class TelescopeDefinition
       for (int i=1; i<=ntel; i++) id.push_back(i);
     }
     
+    void SetPositions(int n, const float *px, const float *py, const float *pz, const float *pr)
+    {
+      ntel = n;
+      x.assign(px,px+n);
+      y.assign(py,py+n);
+      z.assign(pz,pz+n);
+      r.assign(pr,pr+n);
+      id.clear();
+      for (int i=1; i<=ntel; i++) id.push_back(i);
+    }
+    
     void SetUserIDs(std::string str)
     {
       std::vector<int> intSeq;
@@ -169,16 +195,52 @@ namespace global
   extern TelescopeDefinition telDef;
   extern TelescopeOffsets    telOffsets;
   
+#ifndef IACT_NO_ROOT
   extern TRandom1 ranlux;
+#endif
 
   extern std::string onlyTelescopes;
   extern std::string inputFileName;
+  extern std::vector<std::string> inputFiles;
   extern std::string outputFileName;
+  extern std::string outputFormat;
   extern std::string atmTransFile;
+  extern bool  useAtmTrans;
+  extern bool  expectedTrans;
+  extern bool  verifyKernel;
+  extern float atmParam;
   extern long  iniBufSize;
   extern long  maxBufSize;
+  extern long long memoryLimit;
   extern int   nMaxEvents;
+  extern int   nJobs;
+  extern int   nThreads;
+  extern long  chunkSize;
+  extern long  streamWindow;
+  extern bool  telSummary;
+  extern bool  selectEvents;
+  extern std::string cacheFileName;
+  extern std::string configFileName;
+  extern int   metricsPort;
+  extern std::string metricsSocket;
+  extern std::string traceFileName;
+  extern std::string fitModel;
+  extern std::string peMode;
+  extern long long maxOutputSize;
+  extern int   eventsPerFile;
+  extern std::string sliceFileName;
+  extern std::string broadcastName;
+  extern std::string attachName;
+  extern int   nConsumers;
+  extern long long ringSize;
+  extern std::string eventRange;
+  extern bool  splitOutput;
+  extern int   checkpointEvery;
+  extern bool  resume;
+  extern bool  streamMode;
+  extern float streamWarnLatency;
   extern bool  dumpInputs;
+  extern bool  infoMode;
   extern bool  dumpTelPos;
   extern bool  saveLongi;
   extern int   binsX;
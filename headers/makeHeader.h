@@ -1 +1,3 @@
-void makeHeader(TFile *);
+class OutputFile;
+
+void makeHeader(OutputFile *);
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+
+/*
+ * 
+ * The namespace memory holds the budget (--memory-limit) of each of the
+ * consumers of memory that grow with the input and the options, their
+ * present use and their high-water marks. A budget of 0 means that the
+ * consumer is not limited.
+ * 
+ */
+namespace memory
+{
+  enum Consumer
+  {
+    kBuffer,     // IO buffer (largest block loaded)
+    kWindow,     // Bunch window (bunches read ahead of the analysis)
+    kTasks,      // Partial histograms of the chunks in flight
+    kHistograms, // Histograms of the telescopes being analyzed
+    kNConsumers
+  };
+  
+  extern long long              budget[kNConsumers];
+  extern std::atomic<long long> used[kNConsumers];
+  extern std::atomic<long long> highWater[kNConsumers];
+};
+
+inline long long MemoryBudget(memory::Consumer c)
+{
+  return memory::budget[c];
+}
+
+inline void MemorySet(memory::Consumer c, long long bytes)
+{
+  memory::used[c].store(bytes,std::memory_order_relaxed);
+  long long high = memory::highWater[c].load(std::memory_order_relaxed);
+  while (bytes>high && !memory::highWater[c].compare_exchange_weak(high,bytes,std::memory_order_relaxed));
+}
+
+inline void MemoryAdd(memory::Consumer c, long long bytes)
+{
+  long long now  = memory::used[c].fetch_add(bytes,std::memory_order_relaxed) + bytes;
+  long long high = memory::highWater[c].load(std::memory_order_relaxed);
+  while (now>high && !memory::highWater[c].compare_exchange_weak(high,now,std::memory_order_relaxed));
+}
+
+bool SetMemoryBudget();
+void WriteMemoryReport(std::string);
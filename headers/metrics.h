@@ -0,0 +1,54 @@
+#pragma once
+
+#include <atomic>
+
+#include <sys/types.h>
+
+/*
+ * 
+ * The namespace metrics holds the counters and gauges exposed by the
+ * metrics endpoint. They live in memory shared with the batch workers,
+ * so that the endpoint of the main process reports the whole job: each
+ * process has a row of values of its own, which the pointer refers to.
+ * Counters are summed over the rows and gauges are reported per process.
+ * The pointer is null (and updates cost a single check) when the
+ * endpoint is not enabled.
+ * 
+ */
+namespace metrics
+{
+  enum Metric
+  {
+    kEvents,        // Events analyzed
+    kBunches,       // Bunches analyzed
+    kInputBytes,    // Bytes of input blocks found
+    kBlocks,        // Input blocks found
+    kFiles,         // Input files finished
+    kCurrentEvent,  // Number of the event being analyzed
+    kBufferBytes,   // Size of the last block read into the IO buffer
+    kWindowBunches, // Bunches waiting in the bunch window
+    kQueuedTasks,   // Analysis tasks not finished yet
+    kCommits,       // Events committed in streaming mode
+    kLatencySum,    // Sum of their commit latencies (us)
+    kLastLatency,   // Commit latency of the last event (us)
+    kNMetrics
+  };
+  
+  extern std::atomic<long long> *values;
+};
+
+inline void MetricsAdd(metrics::Metric m, long long n)
+{
+  if (metrics::values) metrics::values[m].fetch_add(n,std::memory_order_relaxed);
+}
+
+inline void MetricsSet(metrics::Metric m, long long v)
+{
+  if (metrics::values) metrics::values[m].store(v,std::memory_order_relaxed);
+}
+
+bool StartMetricsServer();
+void StopMetricsServer();
+void MetricsAddWorker(pid_t, int);
+void MetricsRemoveWorker(pid_t);
+void MetricsEnterWorker(int);
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <utility>
+
+class HistogramAccumulator;
+
+/*
+ * 
+ * Class: OutputTable
+ * 
+ * A table of float columns (as a TNtuple) in an output file, filled one
+ * row at a time. It belongs to its file and is deleted when the file is
+ * closed.
+ * 
+ */
+class OutputTable
+{
+  public:
+  
+    virtual ~OutputTable() {}
+    
+    virtual void Fill(const float *values) = 0;
+    virtual void Write() = 0; // Stores the rows filled so far
+};
+
+
+
+/*
+ * 
+ * Class: OutputFile
+ * 
+ * Output of the analysis, whatever its format: tables, histograms and
+ * graphs, organized in directories ("" is the top level). The analysis
+ * only writes through this interface, so that the ROOT backend can be
+ * left out of the build (-DIACT_NO_ROOT).
+ * 
+ */
+class OutputFile
+{
+  public:
+  
+    virtual ~OutputFile() {}
+    
+    virtual bool         HasDirectory(std::string dir) = 0;
+    virtual void         MakeDirectory(std::string dir) = 0;
+    virtual OutputTable *GetTable(std::string name, std::string columns) = 0;
+    virtual void         WriteHistogram(std::string dir, std::string name, const HistogramAccumulator &histo) = 0;
+    virtual void         WriteHistogram(std::string dir, std::string name, int nBins, double xMin, double xMax, const std::vector<double> &contents, double entries) = 0;
+    virtual void         WriteGraph(std::string dir, std::string name, int n, const float *x, const float *y) = 0;
+    virtual long long    Commit() = 0; // Makes everything written so far readable, returns the size
+    virtual long long    Size() = 0;
+    virtual void         Close() = 0;
+    
+    // Ranges of the file (start, end) written since the last call, if
+    // known: "false" means that any part of it may have been written
+    virtual bool         TakeChanges(std::vector<std::pair<long long,long long>> &ranges) { ranges.clear(); return false; }
+};
+
+#ifndef IACT_NO_ROOT
+OutputFile *OpenRootOutput(std::string, bool);
+#endif
+OutputFile *OpenNpyOutput(std::string, bool);
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+class OutputFile;
+
+OutputFile *OpenOutputFile(std::string, bool);
+OutputFile *OpenOutput(bool);
+bool        RollOutputIfFull(std::unique_ptr<OutputFile> &, bool &);
+void        AddOutputEvent(int);
+bool        CloseOutput(OutputFile *);
+bool        RolloverEnabled();
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include <telescopeSummary.h>
+
+class OutputFile;
+class RawBlockReader;
+struct RawItemHeader;
+
+/*
+ * 
+ * Struct: PhotoElectrons
+ * 
+ * Photo-electrons of one telescope in one event (IACT block 1208), as a
+ * structure of arrays with one entry per photo-electron. Amplitudes are
+ * only filled if present in the input. The accumulated results of the
+ * telescope are kept along.
+ * 
+ */
+struct PhotoElectrons
+{
+  int   arrayNumber;
+  int   telNumber;
+  int   nPixels;
+  int   nPixelsHit;
+  std::vector<int32_t> pixel;
+  std::vector<float>   time;      // ns
+  std::vector<float>   amplitude; // mean p.e. units (empty if not available)
+  
+  // Accumulated over the telescope
+  std::vector<int32_t> pixelCounts;
+  std::vector<double>  pixelTimes;  // Mean arrival time per pixel
+  MomentAccumulator    timeMoments;
+  double               amplitudeSum;
+  
+  size_t Size() const { return pixel.size(); }
+  void   Accumulate(bool perPixel);
+};
+
+bool DecodePhotoElectrons(eventio::EventIO::Item *, PhotoElectrons &);
+bool DecodePhotoElectrons(const char *, size_t, int, long, PhotoElectrons &);
+void InitPhotoElectrons(OutputFile *);
+void AddPhotoElectrons(eventio::EventIO::Item *);
+bool AddPhotoElectrons(RawBlockReader &, const RawItemHeader &);
+void FlushPhotoElectrons();
+void WritePhotoElectrons();
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <string>
+
+class OutputFile;
+
+/*
+ * 
+ * Struct: ProfileFit
+ * 
+ * Result of a Gaisser-Hillas fit to one longitudinal profile:
+ * 
+ *   N(X) = nMax * ((X-x0)/(xMax-x0))^((xMax-x0)/lambda) * exp((xMax-X)/lambda)
+ * 
+ * Depths in g/cm2. Status is 0 if the fit converged, 1 if it did not,
+ * 2 if the profile has too few points to be fitted and 3 if no step
+ * improved the start values.
+ * 
+ */
+struct ProfileFit
+{
+  double nMax, x0, xMax, lambda;
+  double chi2ndf;
+  int    nPoints;
+  int    status;
+};
+
+bool ProfileModelKnown(std::string);
+void FitProfile(const float *, int, float, bool, ProfileFit &);
+void InitProfileFits(OutputFile *);
+void AddProfileFits(int, int, const float *, const float *, int, float);
+void FlushProfileFits();
+void WriteProfileFits();
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdint>
+#include <cstddef>
+
+const uint32_t kSyncMarker = 0xd41f8a37; // Start of every top-level item
+
+/*
+ * 
+ * Struct: RawItemHeader
+ * 
+ * Header of an EventIO item as found in the byte stream: type word,
+ * identifier, length and optional length extension.
+ * 
+ */
+struct RawItemHeader
+{
+  int       type;
+  int       version;
+  bool      userFlag;
+  bool      onlySubItems;
+  long      ident;
+  long long length;     // Length of the data following the header
+  int       headerSize; // 12 or 16 bytes (with extension)
+};
+
+
+
+/*
+ * 
+ * Class: RawBlockReader
+ * 
+ * Sequential reader of the data of the top-level EventIO block whose
+ * header was just found in an input file, without going through the
+ * EventIO buffer. The block still has to be skipped in the buffer
+ * afterwards. Regular files are read with pread(), leaving the file
+ * position untouched; pipes are read through the stream given to the
+ * buffer by OpenPipeInput(), which then passes over the bytes already
+ * taken when the buffer skips them.
+ * 
+ */
+class RawBlockReader
+{
+  private:
+  
+    FILE     *file;
+    bool      sequential; // Reading a pipe
+    long long offset;
+    long long remaining;
+  
+  public:
+  
+    RawBlockReader(FILE *input, long long length);
+    
+    bool      Read(void *buffer, size_t size);
+    bool      Skip(long long size);
+    bool      ReadSubItemHeader(RawItemHeader &header);
+    long long Remaining() { return remaining; }
+};
+
+bool   SeekableInput(FILE *);
+FILE  *OpenPipeInput(FILE *);
+bool   ParseItemHeader(const void *, size_t, bool, RawItemHeader &);
+bool   ReadItemHeader(int, long long, bool, RawItemHeader &);
+size_t EncodeItemHeader(const RawItemHeader &, long long, char *);
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <chrono>
+
+class OutputFile;
+
+void InitStreaming(OutputFile *);
+void CommitEvent(OutputFile *, int, std::chrono::steady_clock::time_point);
+void StreamingSummary();
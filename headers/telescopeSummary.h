@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cmath>
+
+class OutputFile;
+
+/*
+ * 
+ * Class: MomentAccumulator
+ * 
+ * Weighted mean and variance of a variable computed in a single pass
+ * with Welford's update, which does not lose precision as the sum of
+ * squares does for large means (e.g. emission heights in cm). Partial
+ * accumulators are merged with Chan's formula.
+ * 
+ */
+class MomentAccumulator
+{
+  private:
+    
+    double sumw;
+    double mean;
+    double m2;   // Sum of weighted squared deviations from the mean
+  
+  public:
+    
+    MomentAccumulator() : sumw(0), mean(0), m2(0) {}
+    
+    void Fill(double x, double w)
+    {
+      if (!(w > 0)) return;
+      sumw += w;
+      double delta = x - mean;
+      mean += delta*w/sumw;
+      m2   += w*delta*(x-mean);
+    }
+    
+    void Add(const MomentAccumulator &other)
+    {
+      if (other.sumw <= 0) return;
+      double total = sumw + other.sumw;
+      double delta = other.mean - mean;
+      mean += delta*other.sumw/total;
+      m2   += other.m2 + delta*delta*sumw*other.sumw/total;
+      sumw  = total;
+    }
+    
+    double GetSumW() const { return sumw; }
+    double GetMean() const { return mean; }
+    double GetRMS()  const { return sumw>0 ? std::sqrt(m2/sumw) : 0; }
+};
+
+
+
+/*
+ * 
+ * Struct: TelescopeSummary
+ * 
+ * Scalar summary of the photons reaching one telescope in one event:
+ * all photons in the block, photons within the field of view and the
+ * moments of the variables of the photons that were histogrammed.
+ * 
+ */
+struct TelescopeSummary
+{
+  double            nPhot;
+  double            nPhotFOV;
+  MomentAccumulator lateral;   // m
+  MomentAccumulator slant;     // g/cm2
+  MomentAccumulator time;      // ns
+  MomentAccumulator zEmission; // cm
+  
+  TelescopeSummary() : nPhot(0), nPhotFOV(0) {}
+  
+  void Add(const TelescopeSummary &other)
+  {
+    nPhot    += other.nPhot;
+    nPhotFOV += other.nPhotFOV;
+    lateral.Add(other.lateral);
+    slant.Add(other.slant);
+    time.Add(other.time);
+    zEmission.Add(other.zEmission);
+  }
+};
+
+void InitTelescopeSummary(OutputFile *);
+void FillTelescopeSummary(int, int, int, const TelescopeSummary &);
+void WriteTelescopeSummary();
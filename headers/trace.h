@@ -0,0 +1,58 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+
+/*
+ * 
+ * The namespace trace tells whether spans are being recorded (--trace)
+ * and keeps the time origin of the trace.
+ * 
+ */
+namespace trace
+{
+  extern bool enabled;
+  extern std::chrono::steady_clock::time_point origin;
+};
+
+void RecordSpan(const char *, const char *, long, long long, long long);
+void StartTrace();
+bool WriteTrace(std::string);
+bool WriteTraceEvents(std::string);
+void AppendTraceEvents(std::string);
+void ResetTrace();
+
+/*
+ * 
+ * Class: TraceSpan
+ * 
+ * Scoped span: records the time between its construction and its
+ * destruction, in the ring buffer of the calling thread. Costs a single
+ * check when tracing is disabled. Name and argument name must be string
+ * literals.
+ * 
+ */
+class TraceSpan
+{
+  private:
+    
+    const char *name;
+    const char *argName;
+    long        arg;
+    long long   begin;
+  
+  public:
+    
+    TraceSpan(const char *spanName, const char *spanArgName = nullptr, long spanArg = 0) :
+      name(spanName), argName(spanArgName), arg(spanArg), begin(-1)
+    {
+      if (trace::enabled) begin = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now()-trace::origin).count();
+    }
+    
+    ~TraceSpan()
+    {
+      if (begin < 0) return;
+      long long end = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now()-trace::origin).count();
+      RecordSpan(name,argName,arg,begin,end-begin);
+    }
+};
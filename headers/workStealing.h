@@ -0,0 +1,55 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+/*
+ * 
+ * Class: WorkStealingPool
+ * 
+ * A pool of threads executing batches of independent tasks. Tasks are
+ * spread over one queue per thread; each thread takes tasks from the
+ * front of its own queue and, when it runs out of work, steals from
+ * the back of the other queues. The thread calling Run() works as one
+ * of the threads of the pool.
+ * 
+ */
+class WorkStealingPool
+{
+  private:
+  
+    struct Queue
+    {
+      std::mutex mutex;
+      std::deque<std::function<void()>*> tasks;
+    };
+    
+    std::vector<std::thread> threads;
+    std::vector<Queue*>      queues;
+    
+    std::mutex              mutex;
+    std::condition_variable wake;
+    std::condition_variable finished;
+    unsigned long           generation;
+    bool                    stop;
+    std::atomic<long>       remaining;
+    
+    bool TakeTask(int, std::function<void()> *&);
+    void Work(int);
+    void WorkerLoop(int);
+  
+  public:
+  
+    WorkStealingPool(int nThreads);
+    ~WorkStealingPool();
+    
+    int  GetNThreads() { return queues.size(); }
+    void Run(std::vector<std::function<void()>> &tasks);
+};
+
+WorkStealingPool &SharedPool(int nThreads);
@@ -0,0 +1,284 @@
+#include <iostream>
+#include <sstream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <EventIO.hh>
+
+#include <iact-reader.h>
+#include <analysisConfig.h>
+#include <outputBackend.h>
+#include <outputFiles.h>
+
+/*
+ * 
+ * Function: Trim
+ * 
+ * Removes leading and trailing white space from a string.
+ * 
+ * @param  str  String to be trimmed
+ * @return Trimmed string
+ * 
+ */
+static std::string Trim(std::string str)
+{
+  size_t first = str.find_first_not_of(" \t\r");
+  if (first == std::string::npos) return "";
+  size_t last = str.find_last_not_of(" \t\r");
+  return str.substr(first,last-first+1);
+}
+
+
+
+/*
+ * 
+ * Function: ReadConfigFile
+ * 
+ * Reads the analysis configurations from a file with one section per
+ * configuration, e.g.:
+ * 
+ *   [coarse]
+ *   bins = 50:-500:500:50:0:1100
+ * 
+ *   [core]
+ *   bins = 200:-100:100:100:0:1100
+ *   only-telescopes = 1-4
+ *   output = core.root
+ * 
+ * The section name is the directory where histograms are written in
+ * the output file, unless an output file of its own is given. Keys not
+ * given take the value from the command line. Lines starting with '#'
+ * are comments.
+ * 
+ * @param  fileName  Configuration file name
+ * @return "true" in case of success, "false" otherwise.
+ * 
+ */
+bool ReadConfigFile(std::string fileName)
+{
+  using namespace std;
+  
+  ifstream file(fileName);
+  if (!file.is_open())
+  {
+    cerr << "Unable to open configuration file " << fileName << endl;
+    return false;
+  }
+  
+  global::configs.clear();
+  
+  string line;
+  int    lineNumber = 0;
+  while (getline(file,line))
+  {
+    lineNumber++;
+    line = Trim(line.substr(0,line.find('#')));
+    if (line == "") continue;
+    
+    // New configuration, with the defaults from the command line
+    if (line[0] == '[')
+    {
+      if (line.back() != ']') { cerr << fileName << ":" << lineNumber << ": invalid section" << endl; return false; }
+      SetDefaultConfig();
+      AnalysisConfig &config = global::configs.back();
+      config.name = config.directory = Trim(line.substr(1,line.size()-2));
+      if (config.name == "" || config.name.find_first_of("/: ") != string::npos)
+      {
+        cerr << fileName << ":" << lineNumber << ": invalid configuration name \"" << config.name << "\"" << endl;
+        return false;
+      }
+      for (size_t i=0; i+1<global::configs.size(); i++)
+        if (global::configs[i].name == config.name)
+        {
+          cerr << fileName << ":" << lineNumber << ": configuration \"" << config.name << "\" is repeated" << endl;
+          return false;
+        }
+      continue;
+    }
+    
+    size_t equal = line.find('=');
+    if (equal == string::npos || global::configs.empty())
+    {
+      cerr << fileName << ":" << lineNumber << ": expected \"key = value\" within a [section]" << endl;
+      return false;
+    }
+    
+    AnalysisConfig &config = global::configs.back();
+    string key   = Trim(line.substr(0,equal));
+    string value = Trim(line.substr(equal+1));
+    
+    if (key == "bins")
+    {
+      istringstream iss(value);
+      float x;
+      if(iss >> x) { config.binsX = x; iss.ignore(1); }
+      if(iss >> x) { config.xMin  = x; iss.ignore(1); }
+      if(iss >> x) { config.xMax  = x; iss.ignore(1); }
+      if(iss >> x) { config.binsY = x; iss.ignore(1); }
+      if(iss >> x) { config.yMin  = x; iss.ignore(1); }
+      if(iss >> x) { config.yMax  = x; }
+    }
+    else if (key == "only-telescopes") config.onlyTelescopes = value;
+    else if (key == "output")
+    {
+      config.outputFileName = value;
+      config.directory      = "allPhotons";
+    }
+    else
+    {
+      cerr << fileName << ":" << lineNumber << ": unknown key \"" << key << "\"" << endl;
+      return false;
+    }
+  }
+  
+  if (global::configs.empty())
+  {
+    cerr << "No configurations found in " << fileName << endl;
+    return false;
+  }
+  
+  return true;
+}
+
+
+
+/*
+ * 
+ * Function: SetDefaultConfig
+ * 
+ * Adds the configuration given by the command line options, which
+ * writes its histograms to the allPhotons directory of the output file.
+ * 
+ * @return (none)
+ * 
+ */
+void SetDefaultConfig()
+{
+  AnalysisConfig config;
+  config.name      = "allPhotons";
+  config.directory = "allPhotons";
+  config.binsX     = global::binsX;
+  config.binsY     = global::binsY;
+  config.xMin      = global::xMin;
+  config.xMax      = global::xMax;
+  config.yMin      = global::yMin;
+  config.yMax      = global::yMax;
+  config.file      = nullptr;
+  global::configs.push_back(config);
+}
+
+
+
+/*
+ * 
+ * Function: ConfigsHaveOwnFiles
+ * 
+ * Tells whether any configuration writes to an output file of its own.
+ * 
+ * @return "true" if so, "false" otherwise.
+ * 
+ */
+bool ConfigsHaveOwnFiles()
+{
+  for (const AnalysisConfig &config : global::configs)
+    if (config.outputFileName != "") return true;
+  return false;
+}
+
+
+
+/*
+ * 
+ * Function: SetConfigTelescopes
+ * 
+ * Sets the telescope IDs of each configuration from the telescope
+ * definitions just read (block 1201).
+ * 
+ * @return (none)
+ * 
+ */
+void SetConfigTelescopes()
+{
+  for (AnalysisConfig &config : global::configs)
+  {
+    TelescopeDefinition telDef = global::telDef;
+    if (config.onlyTelescopes != "") telDef.SetUserIDs(config.onlyTelescopes);
+    config.telIDs.resize(telDef.GetN());
+    for (int i=0; i<telDef.GetN(); i++) config.telIDs[i] = telDef.GetID(i);
+  }
+}
+
+
+
+/*
+ * 
+ * Function: TelescopeWanted
+ * 
+ * Tells whether a telescope is analyzed by any configuration.
+ * 
+ * @param  telNumber  Telescope number (as in the 1205 block)
+ * @return "true" if it is analyzed, "false" otherwise.
+ * 
+ */
+bool TelescopeWanted(int telNumber)
+{
+  for (const AnalysisConfig &config : global::configs)
+    if (telNumber>=0 && telNumber<(int)config.telIDs.size() && config.telIDs[telNumber]>=0) return true;
+  return false;
+}
+
+
+
+/*
+ * 
+ * Function: OpenConfigOutputs
+ * 
+ * Creates the directories (and files) where the histograms of each
+ * configuration are written.
+ * 
+ * @param  outputFile  Output file
+ * @param  resume      Whether the output file is being resumed
+ * @return "true" in case of success, "false" otherwise.
+ * 
+ */
+bool OpenConfigOutputs(OutputFile *outputFile, bool resume)
+{
+  for (AnalysisConfig &config : global::configs)
+  {
+    config.file = nullptr;
+    if (config.outputFileName == "")
+    {
+      if (!resume) outputFile->MakeDirectory(config.directory);
+      continue;
+    }
+    
+    config.file = OpenOutputFile(config.outputFileName,false);
+    if (config.file == nullptr) return false;
+    config.file->MakeDirectory(config.directory);
+  }
+  return true;
+}
+
+
+
+/*
+ * 
+ * Function: CloseConfigOutputs
+ * 
+ * Closes the output files of the configurations that have their own.
+ * 
+ * @return (none)
+ * 
+ */
+void CloseConfigOutputs()
+{
+  for (AnalysisConfig &config : global::configs)
+  {
+    if (config.file == nullptr) continue;
+    config.file->Close();
+    delete config.file;
+    config.file = nullptr;
+  }
+}
@@ -1,59 +1,68 @@
 #include <iostream>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <functional>
+#include <map>
+#include <atomic>
+#include <cmath>
+#include <cstring>
 
 #include <EventIO.hh>
 
-/// Include ROOT headers as needed
-
-#include <TRandom1.h>
-#include <TFile.h>
-#include <TH2.h>
-
 #include <atmosphericTransmission.h>
 #include <iact-reader.h>
-#include <TVector3.h>
+#include <histogramAccumulator.h>
+#include <telescopeSummary.h>
+#include <workStealing.h>
+#include <rawEventIO.h>
+#include <bunchCache.h>
+#include <analysisConfig.h>
+#include <metrics.h>
+#include <photoElectrons.h>
+#include <memoryBudget.h>
+#include <trace.h>
+#include <outputBackend.h>
 
 
 
 /*
  * 
- * Function: AnalyzePhotonBunches
+ * Struct: TelescopeGeometry
  * 
- * Receives an IACT data block of type 1205 with photon bunches from
- * CORSIKA simulation and loops over data. Each call to this function
- * corresponds to a block of data from one single telescope in one
- * event.
+ * Telescope position and shower face plane for one telescope in the
+ * current event, computed once before looping over its bunches.
  * 
- * @param  item Eventio::Item object of type 1205
- * @return (none)
+ */
+struct TelescopeGeometry
+{
+  float thetaPrim;
+  float telX, telY, telZ;
+  float vertX, vertY, vertZ;
+  float horiX, horiY, horiZ;
+  float normX, normY, normZ;
+  int       coneX[2], coneY[2]; // Axis (downwards and upwards) in quantized direction cosines
+  long long coneR2;             // Squared radius of the cones around the axis, quantized
+};
+
+
+
+/*
+ * 
+ * Function: GetTelescopeGeometry
+ * 
+ * Determines the shower face plane for a given telescope in the
+ * current event.
+ * 
+ * @param  telNumber  Telescope number (as in the 1205 block)
+ * @return Telescope geometry
  * 
  */
-void AnalyzePhotonBunches(eventio::EventIO::Item * item, TFile *rootFile)
+static TelescopeGeometry GetTelescopeGeometry(int telNumber)
 {
-  using namespace std;
-  
-  int16_t arrayNumber;
-  int16_t telNumber;
-  int32_t nBunches;
-  float photonSum;
-  int16_t data[8];
+  TelescopeGeometry g;
   
-  int   evtNumber = global::thisEvent.GetEventNumber();
-  int   runNumber = global::corHeader.GetRunNumber();
-  float wlMin = global::thisEvent.GetMinWaveLength();
-  float wlMax = global::thisEvent.GetMaxWaveLength();
-  
-  item->GetInt16(arrayNumber);
-  item->GetInt16(telNumber);
-  item->GetReal(photonSum);
-  item->GetInt32(nBunches);
-  
-  /// Skip telescopes with ID -1
-  if (global::telDef.GetID((int)telNumber)<0) return;
-  
-
   /// General variables
-  // Observation level altitude
-  float obsLev     = global::thisEvent.GetObsLevel(0);
   // Primary particle properties
   float thetaPrim  = global::thisEvent.GetZenithAngle();
   float phiPrim    = global::thisEvent.GetAzimuthAngle();
@@ -61,14 +70,6 @@ void AnalyzePhotonBunches(eventio::EventIO::Item * item, TFile *rootFile)
   float telX       = global::telDef.GetX(telNumber);
   float telY       = global::telDef.GetY(telNumber);
   float telZ       = global::telDef.GetZ(telNumber);
-
-  /// ------------------------------------------------------------------
-  /// Declare histograms here and fill them inside photon loop (rather than in bunch loop)
-  string histoNameAll = "run" + to_string(runNumber) + "_event" + to_string(evtNumber) + "_tel" + to_string(global::telDef.GetID(telNumber)) + "_all";
-  //~ string histoNameDet = "run" + to_string(runNumber) + "_event" + to_string(evtNumber) + "_tel" + to_string(global::telDef.GetID(telNumber)) + "_detected";
-  TH2F  histoAll(histoNameAll.c_str(),"",global::binsX,global::xMin,global::xMax,global::binsY,global::yMin,global::yMax);
-  //~ TH2F  histoDet(histoNameDet.c_str(),"",global::binsX,global::xMin,global::xMax,global::binsY,global::yMin,global::yMax);
-  /// ------------------------------------------------------------------
   
   // Before entering the per-bunch loop, determine the shower face plane
   float vertX, vertY, vertZ;
@@ -84,7 +85,7 @@ void AnalyzePhotonBunches(eventio::EventIO::Item * item, TFile *rootFile)
   horiY = -telZ*vertX+telX*vertZ;
   horiZ = -telX*vertY+telY*vertX;
   
-  aux = TMath::Sqrt(horiX*horiX+horiY*horiY+horiZ*horiZ);
+  aux = sqrt(horiX*horiX+horiY*horiY+horiZ*horiZ);
   
   horiX /= aux;
   horiY /= aux;
@@ -94,130 +95,1018 @@ void AnalyzePhotonBunches(eventio::EventIO::Item * item, TFile *rootFile)
   normY = -vertZ*horiX+vertX*horiZ;
   normZ = -vertX*horiY+vertY*horiX;
   
-  // Loop over bunches
-  for (int i=0; i<nBunches; i++)
+  g.thetaPrim = thetaPrim;
+  g.telX  = telX;  g.telY  = telY;  g.telZ  = telZ;
+  g.vertX = vertX; g.vertY = vertY; g.vertZ = vertZ;
+  g.horiX = horiX; g.horiY = horiY; g.horiZ = horiZ;
+  g.normX = normX; g.normY = normY; g.normZ = normZ;
+  
+  // Cones around the axis for the quick rejection of CompactBunchRange(),
+  // in the units of the direction cosines of compact bunches (1/30000):
+  // a bunch within 5 deg of the axis is within a chord of 2*sin(2.5 deg)
+  // of it, and so is its projection on the XY plane. The cones are a bit
+  // wider (5.05 deg, plus the rounding of the axis) so that no bunch
+  // passing the cut is ever rejected.
+  long long radius = (long long)ceil(3.e4*2*sin(0.5*5.05*M_PI/180.)) + 2;
+  g.coneX[0] = lrint(-3.e4*vertX); g.coneY[0] = lrint(-3.e4*vertY);
+  g.coneX[1] = lrint( 3.e4*vertX); g.coneY[1] = lrint( 3.e4*vertY);
+  g.coneR2   = radius*radius;
+  
+  return g;
+}
+
+
+
+/*
+ * 
+ * Function: EmissionHeights
+ * 
+ * Table of the emission heights of compact bunches over the whole int16
+ * domain of their quantized logarithm (data[5]), computed once with the
+ * same expression as the reference path.
+ * 
+ * @return Table, to be indexed with data[5] (from -32768 to 32767)
+ * 
+ */
+static const float *EmissionHeights()
+{
+  static const std::vector<float> table = []()
   {
-    item->GetInt16(data,8);
-    
-    /// Bunch specific variables
-    // Number of photons in bunch
-    float nPhotons = 0.01*data[6];
-    // Arrival time (in ns)
-    float time       = 0.1*data[4];
-    // Emission altitude (in cm)
-    float zEmission  = pow(10,0.001*data[5]);
-    // sin(theta)cos(phi) and sin(theta)sin(phi)
-    float cx         = (1./3.e4)*data[2];
-    float cy         = (1./3.e4)*data[3];
-    // Check sines and cosines, just in case...
-    if      (cx>1.) cx=1.; else if (cx<-1.) cx=-1.;
-    if      (cy>1.) cx=1.; else if (cy<-1.) cx=-1.;
-    // cos(theta) (downards!)
-    float cz         = -sqrt(1.-cx*cx-cy*cy);
-    // Bunch arrival position in the CORSIKA frame (in cm)
-    float photX      = 0.1*data[0] + telX;
-    float photY      = 0.1*data[1] + telY;
-    float photZ      = telZ;
+    std::vector<float> t(65536);
+    for (int q=-32768; q<32768; q++) t[q+32768] = pow(10,0.001*q);
+    return t;
+  }();
+  return table.data() + 32768;
+}
+
+
+
+/*
+ * 
+ * Function: AnalyzeBunch
+ * 
+ * Analyzes one photon bunch of one telescope: fills the histograms of
+ * photons arriving at the observation level, one for each analysis
+ * configuration (the projection of each bunch is done once, whatever
+ * the number of configurations). With --expected-transmission, the
+ * histograms of detected photons are filled too, weighting each bunch
+ * by its expected survival probability instead of following every
+ * photon. It does not touch any global or ROOT object, so that
+ * different bunches can be analyzed in parallel.
+ * 
+ * @param  g         Telescope geometry
+ * @param  data      Bunch data (8 int16)
+ * @param  histos    Histograms to be filled
+ * @param  detected  Histograms of detected photons to be filled (or nullptr)
+ * @param  nHistos   Number of histograms
+ * @param  summary   Telescope summary to be filled (or nullptr)
+ * @param  heights   Table of emission heights (see EmissionHeights()), or nullptr to compute them
+ * @return (none)
+ * 
+ */
+static inline void AnalyzeBunch(const TelescopeGeometry &g, const int16_t *data, HistogramAccumulator *histos, HistogramAccumulator *detected, int nHistos, TelescopeSummary *summary, const float *heights)
+{
+  const float thetaPrim = g.thetaPrim;
+  const float telX  = g.telX,  telY  = g.telY,  telZ  = g.telZ;
+  const float vertX = g.vertX, vertY = g.vertY, vertZ = g.vertZ;
+  const float horiX = g.horiX, horiY = g.horiY, horiZ = g.horiZ;
+  const float normX = g.normX, normY = g.normY, normZ = g.normZ;
+  
+  
+  /// Bunch specific variables
+  // Number of photons in bunch
+  float nPhotons = 0.01*data[6];
+  if (summary) summary->nPhot += nPhotons;
+  // Arrival time (in ns)
+  float time       = 0.1*data[4];
+  // Emission altitude (in cm)
+  float zEmission  = heights ? heights[data[5]] : pow(10,0.001*data[5]);
+  // sin(theta)cos(phi) and sin(theta)sin(phi)
+  float cx         = (1./3.e4)*data[2];
+  float cy         = (1./3.e4)*data[3];
+  // Check sines and cosines, just in case...
+  if      (cx>1.) cx=1.; else if (cx<-1.) cx=-1.;
+  if      (cy>1.) cx=1.; else if (cy<-1.) cx=-1.;
+  // cos(theta) (downards!)
+  float cz         = -sqrt(1.-cx*cx-cy*cy);
+  // Bunch arrival position in the CORSIKA frame (in cm)
+  float photX      = 0.1*data[0] + telX;
+  float photY      = 0.1*data[1] + telY;
+  float photZ      = telZ;
+  
+  // Check if photon bunch direction lies within telescope f.o.v.
+  // Assuming f.o.v. diameter is 10 deg.
+  // cos(5º) = 0.99619469809
+  float thetaToAxis = vertX*cx + vertY*cy +vertZ*cz;
+  if (fabs(thetaToAxis) < 0.99619469809) return; // Skip this bunch
+  if (summary) summary->nPhotFOV += nPhotons;
+  
+  
+  /// --------------------------------------------------------------
+  /// Analyze photons here
+  /// ~~~~~~~ ~~~~~~~ ~~~~
+  ///
+  ///   Each bunch is weighted by its number of photons (and by
+  /// their expected survival probability, for the histograms of
+  /// detected photons), so there is no loop over single photons.
+  /// Here, we determine the position of the bunch relative to the
+  /// shower plane.
+  ///
+  /// Available variables are:
+  ///
+  /// obsLev      Observation level as defined in CORSIKA inputs
+  /// thetaPrim   Primary particle zenithal angle
+  /// phiPrim     Primaty particle azimuthal angle
+  /// telX        Telescope position X in CORSIKA frame
+  /// telY        Telescope position Y in CORSIKA frame
+  /// telZ        Telescope position Z in CORSIKA frame
+  /// nPhotons    Number of photons in current bunch
+  /// time        Arrival time (see sim_telarray user guide)
+  /// zEmission   Height of bunch emission in CORSIKA frame
+  /// cx          sin(theta)cos(phi) of bunch direction in CORSIKA frame
+  /// cy          sin(theta)sin(phi) of bunch direction in CORSIKA frame
+  /// cz          -sqrt(1.-cx*cx-cy*cy) of bunch direction in CORSIKA frame
+  /// photX       Bunch arrival position X in CORSIKA XY plane
+  /// photY       Bunch arrival position Y in CORSIKA XY plane
+  /// photZ       Bunch arrival position Z in CORSIKA XY plane (always 0)
+  /// data[7]     Wavelength of the bunch (0: Cherenkov spectrum)
+  /// survProb    Expected survival probability due to atmospheric absortion of the bunch
+  ///
+  
+  //definition of depth parameters
+  float a0,b0,c0,a1,b1,c1,a2,b2,c2,a3,b3,c3,a4, b4, c4;
+  a0 =     -138.717; b0 = 1165.33; c0 =      994186;
+  a1 =     -28.0547; b1 = 1204.64; c1 =      746232;
+  a2 =     0.466743; b2 = 1345.62; c2 =      636143;
+  a3 = -0.000530414; b3 = 557.063; c3 =      772170;
+  a4 =   0.00157474; b4 =       1; c4 = 7.43224e+09;
+  
+  float lateral, depth, slant;
+  float intX, intY, intZ;
+  
+  float parD = -(normX*photX+normY*photY+normZ*photZ)/(normX*cx+normY*cy+normZ*cz);
+  
+  // Intersecion point in corsika frame
+  intX = parD*cx+photX;
+  intY = parD*cy+photY;
+  intZ = parD*cz+photZ;
+  
+  if (intZ<0) return;
+  
+  // Lateral distance of intersection point within shower plane
+  lateral = intX*horiX + intY*horiY + intZ*horiZ;
+  
+  // Calculate vertical depth of intersection point
+  if      (intZ <=   900000.) depth = a0 + b0*exp(-(intZ)/c0);
+  else if (intZ <=  1800000.) depth = a1 + b1*exp(-(intZ)/c1);
+  else if (intZ <=  4600000.) depth = a2 + b2*exp(-(intZ)/c2);
+  else if (intZ <= 10500000.) depth = a3 + b3*exp(-(intZ)/c3);
+  else if (intZ <= 11704000.) depth = a4 - ((b4*(intZ))/c4);
+  else                        depth = 0.; // Above the top of the atmosphere
+  
+  // Calculate slant depth
+  slant = depth/cos(thetaPrim);
+  
+  // Histograms with every photon arriving observation level
+  for (int h=0; h<nHistos; h++) histos[h].Fill(lateral/100.,slant, nPhotons);
+  
+  // Moments of the photons in the histogram
+  if (summary)
+  {
+    summary->lateral.Fill(lateral/100.,nPhotons);
+    summary->slant.Fill(slant,nPhotons);
+    summary->time.Fill(time,nPhotons);
+    summary->zEmission.Fill(zEmission,nPhotons);
+  }
+  
+  // Histograms of photons surviving the atmosphere, weighted by their
+  // survival probability: averaged over the Cherenkov spectrum, or for
+  // the wavelength of the bunch if it has one (bunches flagged with
+  // negative or above 9900 nm wavelengths are left out)
+  if (detected && data[7] >= 0 && data[7] <= 9900)
+  {
+    float survProb = data[7]==0 ? ExpectedTransmission(zEmission,-1./cz) : AtmosphericTransmission(data[7],zEmission,-1./cz);
+    for (int h=0; h<nHistos; h++) detected[h].Fill(lateral/100.,slant, nPhotons*survProb);
+  }
+}
+
+
+
+/*
+ * 
+ * Function: ReferenceBunchRange
+ * 
+ * Loops over a range of photon bunches of one telescope and analyzes
+ * each one in floating point (see AnalyzeBunch()). Reference for
+ * CompactBunchRange() with --verify-kernel.
+ * 
+ * @param  g         Telescope geometry
+ * @param  bunches   Bunch data (8 int16 per bunch)
+ * @param  nBunches  Number of bunches in the range
+ * @param  histos    Histograms to be filled
+ * @param  detected  Histograms of detected photons to be filled (or nullptr)
+ * @param  nHistos   Number of histograms
+ * @param  summary   Telescope summary to be filled (or nullptr)
+ * @return (none)
+ * 
+ */
+static void ReferenceBunchRange(const TelescopeGeometry &g, const int16_t *bunches, long nBunches, HistogramAccumulator *histos, HistogramAccumulator *detected, int nHistos, TelescopeSummary *summary)
+{
+  for (long i=0; i<nBunches; i++) AnalyzeBunch(g,bunches+8*i,histos,detected,nHistos,summary,nullptr);
+}
+
+
+
+/*
+ * 
+ * Function: CompactBunchRange
+ * 
+ * Loops over a range of compact photon bunches of one telescope, as
+ * ReferenceBunchRange() but rejecting the bunches out of the field of
+ * view on their quantized direction cosines (data[2], data[3]), with
+ * integer arithmetic only: bunches outside both cones of the telescope
+ * geometry around the axis are out of it. The others (and the few with
+ * invalid direction cosines) are analyzed as in the reference path,
+ * with the emission heights looked up in a table, so the histograms
+ * are the same bit by bit.
+ * 
+ * @param  g         Telescope geometry
+ * @param  bunches   Bunch data (8 int16 per bunch)
+ * @param  nBunches  Number of bunches in the range
+ * @param  histos    Histograms to be filled
+ * @param  detected  Histograms of detected photons to be filled (or nullptr)
+ * @param  nHistos   Number of histograms
+ * @param  summary   Telescope summary to be filled (or nullptr)
+ * @return (none)
+ * 
+ */
+static void CompactBunchRange(const TelescopeGeometry &g, const int16_t *bunches, long nBunches, HistogramAccumulator *histos, HistogramAccumulator *detected, int nHistos, TelescopeSummary *summary)
+{
+  const float    *heights = EmissionHeights();
+  const int       downX = g.coneX[0], downY = g.coneY[0];
+  const int       upX   = g.coneX[1], upY   = g.coneY[1];
+  const long long r2    = g.coneR2;
+  
+  for (long i=0; i<nBunches; i++)
+  {
+    const int16_t *data = bunches + 8*i;
     
-    // Check if photon bunch direction lies within telescope f.o.v.
-    // Assuming f.o.v. diameter is 10 deg.
-    // cos(5º) = 0.99619469809
-    float thetaToAxis = vertX*cx + vertY*cy +vertZ*cz;
-    if (fabs(thetaToAxis) < 0.99619469809) continue; // Skip this bunch
+    // Only bunches whose cz is well defined (cx^2+cy^2 < 0.999) are
+    // rejected here, the others are left to the reference path
+    long long cx = data[2], cy = data[3];
+    if (cx*cx + cy*cy < 899100000LL &&
+        (cx-downX)*(cx-downX) + (cy-downY)*(cy-downY) > r2 &&
+        (cx-upX)*(cx-upX)     + (cy-upY)*(cy-upY)     > r2)
+    {
+      float nPhotons = 0.01*data[6];
+      if (summary) summary->nPhot += nPhotons;
+      continue;
+    }
     
+    AnalyzeBunch(g,data,histos,detected,nHistos,summary,heights);
+  }
+}
+
+
+
+/*
+ * 
+ * The namespace kernelCheck counts the ranges of bunches checked with
+ * --verify-kernel and those whose results differ between the compact
+ * kernel and the reference path. Only visible within the present
+ * translation unit.
+ * 
+ */
+namespace kernelCheck
+{
+  std::atomic<long> nRanges(0);
+  std::atomic<long> nMismatches(0);
+};
+
+
+
+/*
+ * 
+ * Function: SameSummary
+ * 
+ * Tells whether two telescope summaries are the same bit by bit.
+ * 
+ * @param  a  Telescope summary
+ * @param  b  Telescope summary
+ * @return "true" if they are the same, otherwise return "false".
+ * 
+ */
+static bool SameSummary(const TelescopeSummary &a, const TelescopeSummary &b)
+{
+  // Bits are compared, so that NaNs (from invalid bunches) are the same too
+  auto same = [](double x, double y) { return memcmp(&x,&y,sizeof(double)) == 0; };
+  
+  const MomentAccumulator *ma[4] = {&a.lateral,&a.slant,&a.time,&a.zEmission};
+  const MomentAccumulator *mb[4] = {&b.lateral,&b.slant,&b.time,&b.zEmission};
+  bool result = same(a.nPhot,b.nPhot) && same(a.nPhotFOV,b.nPhotFOV);
+  for (int i=0; i<4; i++)
+    result = result && same(ma[i]->GetSumW(),mb[i]->GetSumW()) && same(ma[i]->GetMean(),mb[i]->GetMean()) && same(ma[i]->GetRMS(),mb[i]->GetRMS());
+  return result;
+}
+
+
+
+/*
+ * 
+ * Function: AnalyzeBunchRange
+ * 
+ * Analyzes a range of photon bunches of one telescope with the compact
+ * kernel (see CompactBunchRange()). With --verify-kernel, the range is
+ * analyzed by the reference path too, into histograms of its own, and
+ * any difference is reported (see ReportKernelCheck()).
+ * 
+ * @param  g         Telescope geometry
+ * @param  bunches   Bunch data (8 int16 per bunch)
+ * @param  nBunches  Number of bunches in the range
+ * @param  histos    Histograms to be filled
+ * @param  detected  Histograms of detected photons to be filled (or nullptr)
+ * @param  nHistos   Number of histograms
+ * @param  summary   Telescope summary to be filled (or nullptr)
+ * @return (none)
+ * 
+ */
+static void AnalyzeBunchRange(const TelescopeGeometry &g, const int16_t *bunches, long nBunches, HistogramAccumulator *histos, HistogramAccumulator *detected, int nHistos, TelescopeSummary *summary)
+{
+  if (!global::verifyKernel)
+  {
+    CompactBunchRange(g,bunches,nBunches,histos,detected,nHistos,summary);
+    return;
+  }
+  
+  std::vector<HistogramAccumulator> fused, reference;
+  for (int h=0; h<(detected ? 2 : 1)*nHistos; h++)
+  {
+    const HistogramAccumulator &t = h<nHistos ? histos[h] : detected[h-nHistos];
+    fused.push_back(HistogramAccumulator(t.GetNbinsX(),t.GetXmin(),t.GetXmax(),t.GetNbinsY(),t.GetYmin(),t.GetYmax()));
+  }
+  reference = fused;
+  TelescopeSummary fusedSummary, referenceSummary;
+  
+  CompactBunchRange(g,bunches,nBunches,fused.data(),detected ? fused.data()+nHistos : nullptr,nHistos,summary ? &fusedSummary : nullptr);
+  ReferenceBunchRange(g,bunches,nBunches,reference.data(),detected ? reference.data()+nHistos : nullptr,nHistos,summary ? &referenceSummary : nullptr);
+  
+  bool same = SameSummary(fusedSummary,referenceSummary);
+  for (size_t h=0; h<fused.size(); h++) same = same && fused[h].Identical(reference[h]);
+  kernelCheck::nRanges++;
+  if (!same && kernelCheck::nMismatches++ < 10)
+    std::cerr << "Compact kernel differs from the reference for " << nBunches << " bunches at (" << g.telX << "," << g.telY << ")" << std::endl;
+  
+  for (int h=0; h<nHistos; h++) histos[h].Add(fused[h]);
+  for (int h=0; detected && h<nHistos; h++) detected[h].Add(fused[nHistos+h]);
+  if (summary) summary->Add(fusedSummary);
+}
+
+
+
+/*
+ * 
+ * Function: ReportKernelCheck
+ * 
+ * Reports the comparison of the compact kernel with the reference path
+ * (--verify-kernel) since the last report.
+ * 
+ * @return "true" if the results were the same, otherwise return "false".
+ * 
+ */
+bool ReportKernelCheck()
+{
+  long nRanges     = kernelCheck::nRanges.exchange(0);
+  long nMismatches = kernelCheck::nMismatches.exchange(0);
+  if (nMismatches > 0) std::cerr << "Compact kernel check: " << nMismatches << " of " << nRanges << " bunch ranges differ from the reference" << std::endl;
+  else                 std::cout << "Compact kernel check: " << nRanges << " bunch ranges identical to the reference" << std::endl;
+  return nMismatches == 0;
+}
+
+
+
+/*
+ * 
+ * Function: TelescopeConfigs
+ * 
+ * Analysis configurations that include a given telescope.
+ * 
+ * @param  telNumber  Telescope number (as in the 1205 block)
+ * @return Indices of the configurations in global::configs
+ * 
+ */
+static std::vector<int> TelescopeConfigs(int telNumber)
+{
+  std::vector<int> configs;
+  for (size_t i=0; i<global::configs.size(); i++)
+    if (telNumber<(int)global::configs[i].telIDs.size() && global::configs[i].telIDs[telNumber]>=0) configs.push_back(i);
+  return configs;
+}
+
+
+
+/*
+ * 
+ * Function: HistogramBytes
+ * 
+ * Memory taken by the histograms of one telescope (contents and sums of
+ * squared weights of one histogram per configuration, two with
+ * --expected-transmission).
+ * 
+ * @param  configs  Configurations analyzing the telescope
+ * @return Size in bytes
+ * 
+ */
+static long long HistogramBytes(const std::vector<int> &configs)
+{
+  long long bytes = 0;
+  for (size_t i=0; i<configs.size(); i++)
+  {
+    const AnalysisConfig &c = global::configs[configs[i]];
+    bytes += 2*sizeof(double)*(c.binsX+2)*(c.binsY+2);
+  }
+  return global::expectedTrans ? 2*bytes : bytes;
+}
+
+
+
+/*
+ * 
+ * Struct: ChunkResult
+ * 
+ * Histograms (one per analysis configuration of the telescope, and as
+ * many of detected photons with --expected-transmission) and summary
+ * filled from a range of bunches.
+ * 
+ */
+struct ChunkResult
+{
+  std::vector<HistogramAccumulator> histos;
+  std::vector<HistogramAccumulator> detected; // Empty if not requested
+  TelescopeSummary                  summary;
+  
+  ChunkResult(const std::vector<int> &configs)
+  {
+    for (size_t i=0; i<configs.size(); i++)
+    {
+      const AnalysisConfig &c = global::configs[configs[i]];
+      histos.push_back(HistogramAccumulator(c.binsX,c.xMin,c.xMax,c.binsY,c.yMin,c.yMax));
+    }
+    if (global::expectedTrans) detected = histos;
+  }
+  
+  void Add(const ChunkResult &other)
+  {
+    for (size_t i=0; i<histos.size(); i++) histos[i].Add(other.histos[i]);
+    for (size_t i=0; i<detected.size(); i++) detected[i].Add(other.detected[i]);
+    summary.Add(other.summary);
+  }
+  
+  HistogramAccumulator *Detected() { return detected.empty() ? nullptr : detected.data(); }
+};
+
+
+
+/*
+ * 
+ * Struct: TelescopeState
+ * 
+ * Analysis state of the bunch block of one telescope in one event. The
+ * block is analyzed in chunks of bunches, numbered from the beginning
+ * of the block; each chunk fills a partial histogram that is added to
+ * the total as soon as all previous chunks are done, so the result
+ * does not depend on the number of threads or on which thread
+ * executed each chunk.
+ * 
+ */
+struct TelescopeState
+{
+  int                  telNumber;
+  TelescopeGeometry    geom;
+  std::vector<int>     configs;   // Configurations analyzing this telescope
+  long long            histoBytes; // Size of the histograms of one chunk (or the total)
+  ChunkResult          total;
+  long                 nChunks;   // Chunks handed out so far
+  long                 nextChunk; // Next chunk to be added to the total
+  std::map<long,ChunkResult*> done; // Partials waiting for previous chunks
+  std::mutex           lock;
+  
+  TelescopeState(int tel) :
+    telNumber(tel), geom(GetTelescopeGeometry(tel)), configs(TelescopeConfigs(tel)), histoBytes(HistogramBytes(configs)), total(configs), nChunks(0), nextChunk(0)
+  {
+    MemoryAdd(memory::kHistograms,histoBytes);
+  }
+  
+  ~TelescopeState()
+  {
+    MemoryAdd(memory::kHistograms,-histoBytes);
+  }
+  
+  void AddChunk(long chunk, ChunkResult *partial)
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    done[chunk] = partial;
+    while (!done.empty() && done.begin()->first==nextChunk)
+    {
+      total.Add(*done.begin()->second);
+      delete done.begin()->second;
+      MemoryAdd(memory::kTasks,-histoBytes);
+      done.erase(done.begin());
+      nextChunk++;
+    }
+  }
+};
+
+
+
+/*
+ * 
+ * Struct: Segment
+ * 
+ * A contiguous range of bunches of one telescope held in memory, which
+ * may be the whole block or only part of it.
+ * 
+ */
+struct Segment
+{
+  TelescopeState *state;
+  const int16_t  *data;
+  long            nBunches;
+};
 
-    /// --------------------------------------------------------------
-    /// Analyze photons here
-    /// ~~~~~~~ ~~~~~~~ ~~~~
-    ///
-    ///   This is a loop over each photon, therefore the relative
-    /// weight of each photon is 1. Here, we determine the survival
-    /// probability of each incoming photon as well as their position
-    /// relative to the CORSIKA frame.
-    ///
-    /// Available variables are:
-    ///
-    /// obsLev      Observation level as defined in CORSIKA inputs
-    /// thetaPrim   Primary particle zenithal angle
-    /// phiPrim     Primaty particle azimuthal angle
-    /// telX        Telescope position X in CORSIKA frame
-    /// telY        Telescope position Y in CORSIKA frame
-    /// telZ        Telescope position Z in CORSIKA frame
-    /// nPhotons    Number of photons in current bunch
-    /// time        Arrival time (see sim_telarray user guide)
-    /// zEmission   Height of bunch emission in CORSIKA frame
-    /// cx          sin(theta)cos(phi) of bunch direction in CORSIKA frame
-    /// cy          sin(theta)sin(phi) of bunch direction in CORSIKA frame
-    /// cz          -sqrt(1.-cx*cx-cy*cy) of bunch direction in CORSIKA frame
-    /// photX       Bunch arrival position X in CORSIKA XY plane
-    /// photY       Bunch arrival position Y in CORSIKA XY plane
-    /// photZ       Bunch arrival position Z in CORSIKA XY plane (always 0)
-    /// waveLength  Wavelenght of current photon
-    /// survProb    Survival probability due to atmospheric absortion of current photon
-    /// 
-
-    //definition of depth parameters
-    float a0,b0,c0,a1,b1,c1,a2,b2,c2,a3,b3,c3,a4, b4, c4;
-    a0 =     -138.717; b0 = 1165.33; c0 =      994186;
-    a1 =     -28.0547; b1 = 1204.64; c1 =      746232;
-    a2 =     0.466743; b2 = 1345.62; c2 =      636143;
-    a3 = -0.000530414; b3 = 557.063; c3 =      772170;
-    a4 =   0.00157474; b4 =       1; c4 = 7.43224e+09;
-
-    float lateral, depth, slant;
-    float intX, intY, intZ;
-    
-    float parD = -(normX*photX+normY*photY+normZ*photZ)/(normX*cx+normY*cy+normZ*cz);
 
-    // Intersecion point in corsika frame
-    intX = parD*cx+photX;
-    intY = parD*cy+photY;
-    intZ = parD*cz+photZ;
+
+/*
+ * 
+ * Function: AnalyzeSegments
+ * 
+ * Analyzes several segments of bunches, from one or more telescopes.
+ * 
+ * Bunch counts are very different from one telescope to another, so
+ * work is split into tasks of about global::chunkSize bunches: large
+ * segments are cut into chunks, each one filling its own partial
+ * histogram, while small segments are grouped together in a single
+ * task. Tasks are executed by the work-stealing pool, in waves whose
+ * partial histograms fit into the memory budget (if any).
+ * 
+ * @param  segments  Segments, in the order they were read
+ * @return (none)
+ * 
+ */
+static void AnalyzeSegments(std::vector<Segment> &segments)
+{
+  using namespace std;
+  
+  TraceSpan span("AnalyzeSegments","segments",segments.size());
+  
+  WorkStealingPool &pool = SharedPool(global::nThreads);
+  
+  // A piece of work: a chunk of a segment
+  struct Piece
+  {
+    TelescopeState *state;
+    long            chunk;
+    const int16_t  *data;
+    long            n;
+    bool            direct; // Fill the total directly (only chunk of its block in flight)
+  };
+  
+  long chunkSize = global::chunkSize>0 ? global::chunkSize : 1;
+  
+  vector<vector<Piece>> work(1);
+  long                  workSize = 0;
+  long                  nBunches = 0;
+  
+  for (size_t s=0; s<segments.size(); s++)
+  {
+    Segment &seg = segments[s];
+    long n = seg.nBunches;
+    nBunches += n;
+    long nChunks = n>chunkSize ? (n+chunkSize-1)/chunkSize : 1;
+    
+    // A block whose bunches all fit into a single chunk is filled directly
+    bool direct = nChunks==1 && seg.state->nextChunk==seg.state->nChunks;
+    for (size_t o=s+1; o<segments.size() && direct; o++) if (segments[o].state==seg.state) direct = false;
     
-    if (intZ<0) continue;
+    for (long c=0; c<nChunks; c++)
+    {
+      Piece p = {seg.state, seg.state->nChunks++, seg.data+8*c*chunkSize, min(chunkSize,n-c*chunkSize), direct};
+      if (direct) seg.state->nextChunk++;
+      
+      // Start a new task when the current one is full
+      if (workSize>0 && workSize+p.n>chunkSize) { work.push_back(vector<Piece>()); workSize = 0; }
+      work.back().push_back(p);
+      workSize += p.n;
+    }
+  }
+  
+  // Build the tasks, with the memory of their partial histograms
+  vector<function<void()>> tasks;
+  vector<long long>        taskBytes;
+  for (size_t t=0; t<work.size(); t++)
+  {
+    vector<Piece> pieces = work[t];
+    if (pieces.empty()) continue;
+    long long bytes = 0;
+    for (size_t k=0; k<pieces.size(); k++) if (!pieces[k].direct) bytes += pieces[k].state->histoBytes;
+    taskBytes.push_back(bytes);
+    tasks.push_back([pieces]()
+    {
+      for (size_t k=0; k<pieces.size(); k++)
+      {
+        const Piece &p = pieces[k];
+        TraceSpan span("AnalyzeChunk","tel",p.state->telNumber);
+        if (p.direct)
+        {
+          AnalyzeBunchRange(p.state->geom,p.data,p.n,p.state->total.histos.data(),p.state->total.Detected(),p.state->total.histos.size(),global::telSummary ? &p.state->total.summary : nullptr);
+          continue;
+        }
+        MemoryAdd(memory::kTasks,p.state->histoBytes);
+        ChunkResult *partial = new ChunkResult(p.state->configs);
+        AnalyzeBunchRange(p.state->geom,p.data,p.n,partial->histos.data(),partial->Detected(),partial->histos.size(),global::telSummary ? &partial->summary : nullptr);
+        p.state->AddChunk(p.chunk,partial);
+      }
+      MetricsAdd(metrics::kQueuedTasks,-1);
+    });
+  }
+  
+  MetricsSet(metrics::kQueuedTasks,tasks.size());
+  
+  // Without a budget all tasks are run at once; with a budget, a wave
+  // ends before the task that would go over it (and every wave has at
+  // least one task). All partials are added to the totals by the end of
+  // each wave, since chunks are handed out in order
+  long long budget = MemoryBudget(memory::kTasks);
+  if (budget<=0) pool.Run(tasks);
+  for (size_t first=0; budget>0 && first<tasks.size(); )
+  {
+    vector<function<void()>> wave;
+    long long bytes = 0;
+    for (; first<tasks.size() && (wave.empty() || bytes+taskBytes[first]<=budget); first++)
+    {
+      bytes += taskBytes[first];
+      wave.push_back(std::move(tasks[first]));
+    }
+    pool.Run(wave);
+  }
+  
+  MetricsAdd(metrics::kBunches,nBunches);
+}
+
+
+
+/*
+ * 
+ * Function: WriteTelescopeHistograms
+ * 
+ * Writes the histograms of one telescope to the root file, in the
+ * directory (or file) of each analysis configuration.
+ * 
+ * @param  state       Analysis state of the telescope (all chunks done)
+ * @param  outputFile  Output file
+ * @return (none)
+ * 
+ */
+static void WriteTelescopeHistograms(TelescopeState &state, OutputFile *outputFile)
+{
+  using namespace std;
+  
+  int   evtNumber = global::thisEvent.GetEventNumber();
+  int   runNumber = global::corHeader.GetRunNumber();
+  int   telID     = global::telDef.GetID(state.telNumber);
+  
+  TraceSpan span("WriteHistograms","tel",state.telNumber);
+  
+  for (size_t i=0; i<state.configs.size(); i++)
+  {
+    const AnalysisConfig &c = global::configs[state.configs[i]];
+    int cfgTelID = c.telIDs[state.telNumber];
     
-    // Lateral distance of intersection point within shower plane
-    lateral = intX*horiX + intY*horiY + intZ*horiZ;
+    string histoNameAll = "run" + to_string(runNumber) + "_event" + to_string(evtNumber) + "_tel" + to_string(cfgTelID) + "_all";
+    string histoNameDet = "run" + to_string(runNumber) + "_event" + to_string(evtNumber) + "_tel" + to_string(cfgTelID) + "_detected";
     
-    // Calculate vertical depth of intersection point
-    if      (intZ <=   900000.) depth = a0 + b0*TMath::Exp(-(intZ)/c0);
-    else if (intZ <=  1800000.) depth = a1 + b1*TMath::Exp(-(intZ)/c1);
-    else if (intZ <=  4600000.) depth = a2 + b2*TMath::Exp(-(intZ)/c2);
-    else if (intZ <= 10500000.) depth = a3 + b3*TMath::Exp(-(intZ)/c3);
-    else if (intZ <= 11704000.) depth = a4 - ((b4*(intZ))/c4);
-
-    // Calculate slant depth
-    slant = depth/TMath::Cos(thetaPrim);
+    (c.file ? c.file : outputFile)->WriteHistogram(c.directory,histoNameAll,state.total.histos[i]);
+    if (global::expectedTrans) (c.file ? c.file : outputFile)->WriteHistogram(c.directory,histoNameDet,state.total.detected[i]);
+  }
+  
+  if (global::telSummary) FillTelescopeSummary(runNumber,evtNumber,telID,state.total.summary);
+}
+
+
+
+/*
+ * 
+ * Struct: BunchWindow
+ * 
+ * Buffer of a fixed number of bunches where the bunches of consecutive
+ * telescopes are collected as they are read. Each time it is full its
+ * contents are analyzed and it is reused, so memory does not depend on
+ * the number of bunches. Histograms of a telescope are written as soon
+ * as all its bunches are analyzed.
+ * 
+ */
+struct BunchWindow
+{
+  OutputFile           *outputFile;
+  long                  size;
+  long                  used;
+  std::vector<int16_t>  buffer;
+  std::vector<std::unique_ptr<TelescopeState>> states; // Telescopes with bunches in the window
+  std::vector<Segment>  segments;
+  
+  BunchWindow(long nBunches) : outputFile(nullptr), size(nBunches), used(0), buffer(8*nBunches) {}
+  
+  // Analyze the window and write the telescopes already complete (all
+  // but the last one, which may continue, unless the stream is over)
+  void Flush(bool last)
+  {
+    AnalyzeSegments(segments);
+    segments.clear();
+    used = 0;
+    MetricsSet(metrics::kWindowBunches,0);
+    size_t nDone = last || states.empty() ? states.size() : states.size()-1;
+    for (size_t i=0; i<nDone; i++) WriteTelescopeHistograms(*states[i],outputFile);
+    states.erase(states.begin(),states.begin()+nDone);
+  }
+};
+
+static std::unique_ptr<BunchWindow> bunchWindow;
+
+
+
+/*
+ * 
+ * Function: BeginBunchStream
+ * 
+ * Prepares the bunch window to receive the bunches of the telescopes of
+ * one array (or event) piece by piece, through BeginStreamTelescope(),
+ * GetStreamSpace() and AddStreamBunches(), until EndBunchStream().
+ * 
+ * @param  outputFile  Output file
+ * @return (none)
+ * 
+ */
+void BeginBunchStream(OutputFile *outputFile)
+{
+  long size = global::streamWindow>0 ? global::streamWindow : 4194304;
+  if (!bunchWindow || bunchWindow->size!=size) bunchWindow.reset(new BunchWindow(size));
+  bunchWindow->outputFile = outputFile;
+  MemorySet(memory::kWindow,16*size);
+}
+
+
+
+/*
+ * 
+ * Function: BeginStreamTelescope
+ * 
+ * Starts the bunches of a new telescope in the bunch window. If the
+ * histograms of the telescopes already in the window leave no room in
+ * the memory budget for a new one, the window is analyzed first (all
+ * those telescopes are complete).
+ * 
+ * @param  telNumber  Telescope number (as in the 1205 block)
+ * @return "false" if the telescope is not to be analyzed, "true" otherwise.
+ * 
+ */
+bool BeginStreamTelescope(int telNumber)
+{
+  /// Skip telescopes not analyzed by any configuration
+  if (!TelescopeWanted(telNumber)) return false;
+  
+  BunchWindow &w = *bunchWindow;
+  long long budget = MemoryBudget(memory::kHistograms);
+  if (budget>0 && !w.states.empty() && memory::used[memory::kHistograms]+HistogramBytes(TelescopeConfigs(telNumber))>budget) w.Flush(true);
+  
+  w.states.push_back(std::unique_ptr<TelescopeState>(new TelescopeState(telNumber)));
+  return true;
+}
+
+
+
+/*
+ * 
+ * Function: GetStreamSpace
+ * 
+ * Gives the free space in the bunch window, where the next bunches of
+ * the current telescope are to be copied (8 int16 per bunch).
+ * 
+ * @param  n  Set to the number of bunches that fit in the window
+ * @return Pointer to the free space
+ * 
+ */
+int16_t *GetStreamSpace(long &n)
+{
+  n = bunchWindow->size - bunchWindow->used;
+  return bunchWindow->buffer.data() + 8*bunchWindow->used;
+}
+
+
+
+/*
+ * 
+ * Function: AddStreamBunches
+ * 
+ * Adds the bunches just copied to the free space of the bunch window to
+ * the current telescope, analyzing the window if it is full.
+ * 
+ * @param  n  Number of bunches copied
+ * @return (none)
+ * 
+ */
+void AddStreamBunches(long n)
+{
+  BunchWindow &w = *bunchWindow;
+  Segment seg = {w.states.back().get(), w.buffer.data()+8*w.used, n};
+  w.segments.push_back(seg);
+  w.used += n;
+  MetricsSet(metrics::kWindowBunches,w.used);
+  if (w.used == w.size) w.Flush(false);
+}
+
+
+
+/*
+ * 
+ * Function: EndBunchStream
+ * 
+ * Analyzes the bunches left in the bunch window and writes the
+ * histograms of all telescopes.
+ * 
+ * @return (none)
+ * 
+ */
+void EndBunchStream()
+{
+  bunchWindow->Flush(true);
+}
+
+
+
+/*
+ * 
+ * Function: StreamTelescopeArray
+ * 
+ * Analyzes an IACT data block of type 1204 while it is being read from
+ * the input, without loading it into the IO buffer. Bunches of its 1205
+ * sub-items are read into the bunch window (of global::streamWindow
+ * bunches), so memory does not depend on the size of the block.
+ * Photo-electrons (1208 sub-items) are queued as in the buffered path.
+ * Bunches are expected in compact format (8 int16 values).
+ * 
+ * @param  reader      Reader positioned at the data of the 1204 block
+ * @param  outputFile  Output file
+ * @return "true" in case of success, "false" if the block is truncated.
+ * 
+ */
+bool StreamTelescopeArray(RawBlockReader &reader, OutputFile *outputFile)
+{
+  using namespace std;
+  
+  BeginBunchStream(outputFile);
+  
+  RawItemHeader header;
+  while (reader.Remaining()>0)
+  {
+    if (!reader.ReadSubItemHeader(header)) return false;
+    long long left = header.length;
     
-    // Histograms with every photon arriving observation level
-    histoAll.Fill(lateral/100.,slant, nPhotons);
+    if (header.type == 1205)
+    {
+      int16_t arrayNumber;
+      int16_t telNumber;
+      float   photonSum;
+      int32_t nBunches;
       
-    // Loop over each photon
-    //~ while(nPhotons>0)
-    //~ {
+      if (!reader.Read(&arrayNumber,2) || !reader.Read(&telNumber,2) || !reader.Read(&photonSum,4) || !reader.Read(&nBunches,4)) return false;
+      left -= 12;
       
-      //~ /// Photon specific variables
-      //~ // Wavelength
-      //~ float waveLength;
-      //~ if      (data[7] == 0)   waveLength = 1 / ( (1/wlMin) - global::ranlux.Uniform()*((1/wlMin) - (1/wlMax)) );
-      //~ else if (data[7] > 9900) break;
-      //~ else if (data[7] < 0)    break;
-      //~ else                     waveLength = data[7];
-      //~ // Survival probability according to atmospheric transmission
-      //~ float survProb   = AtmosphericTransmission(waveLength, zEmission, -1./cz);
-
-      //~ // Histograms only with photons that survived atmospheric transmission
-      //~ if (survProb>global::ranlux.Uniform()) histoDet.Fill(lateral/100,slant);
+      if (header.version < 1000 && nBunches > 0)
+        cerr << "Bunches of telescope " << telNumber << " are not in compact format, results will be wrong." << endl;
       
-      //~ nPhotons--;
-    //~ } // Loop over photons in one bunch
-  } // Loop over bunches in the block
+      if (BeginStreamTelescope(telNumber))
+      {
+        CacheTelescope(arrayNumber,telNumber,photonSum,nBunches);
+        
+        long remaining = nBunches;
+        while (remaining > 0)
+        {
+          long n;
+          int16_t *space = GetStreamSpace(n);
+          n = min(remaining,n);
+          if (!reader.Read(space,16*n)) return false;
+          CacheBunches(space,n);
+          AddStreamBunches(n);
+          remaining -= n;
+          left      -= 16*n;
+        }
+      }
+    }
+    else if (header.type == 1208)
+    {
+      if (!AddPhotoElectrons(reader,header)) return false;
+      continue;
+    }
+    
+    if (!reader.Skip(left)) return false;
+  }
+  
+  EndBunchStream();
+  return true;
+}
 
-  /// Write the histograms to the root file
-  rootFile->cd("allPhotons");
-  histoAll.Write();
+
+
+/*
+ * 
+ * Function: StreamBunchBlock
+ * 
+ * Reads the bunches of an IACT data block of type 1205 from the IO
+ * buffer straight into the bunch window, a window at a time, so that
+ * no copy of the whole block is kept besides the IO buffer.
+ * 
+ * @param  item  Eventio::Item object of type 1205
+ * @return (none)
+ * 
+ */
+static void StreamBunchBlock(eventio::EventIO::Item *item)
+{
+  int16_t arrayNumber;
+  int16_t telNumber;
+  float   photonSum;
+  int32_t nBunches;
   
-  //~ rootFile->cd("detectedPhotons");
-  //~ histoDet.Write();
+  item->GetInt16(arrayNumber);
+  item->GetInt16(telNumber);
+  item->GetReal(photonSum);
+  item->GetInt32(nBunches);
+  
+  /// Skip telescopes not analyzed by any configuration
+  if (!BeginStreamTelescope(telNumber)) return;
+  
+  CacheTelescope(arrayNumber,telNumber,photonSum,nBunches);
+  
+  long remaining = nBunches;
+  while (remaining > 0)
+  {
+    long n;
+    int16_t *space = GetStreamSpace(n);
+    n = std::min(remaining,n);
+    item->GetInt16(space,8*n);
+    CacheBunches(space,n);
+    AddStreamBunches(n);
+    remaining -= n;
+  }
+}
+
 
+
+/*
+ * 
+ * Function: AnalyzePhotonBunches
+ * 
+ * Receives an IACT data block of type 1205 with photon bunches from
+ * CORSIKA simulation and loops over data. Each call to this function
+ * corresponds to a block of data from one single telescope in one
+ * event.
+ * 
+ * @param  item Eventio::Item object of type 1205
+ * @return (none)
+ * 
+ */
+void AnalyzePhotonBunches(eventio::EventIO::Item * item, OutputFile *outputFile)
+{
+  BeginBunchStream(outputFile);
+  StreamBunchBlock(item);
+  EndBunchStream();
+}
+
+
+
+/*
+ * 
+ * Function: AnalyzeTelescopeArray
+ * 
+ * Receives an IACT data block of type 1204 (data from one array in one
+ * event) and analyzes the photon bunches of all its telescopes (1205
+ * sub-items) together, so that work can be balanced among threads.
+ * Bunches go through the bunch window as they are read from the IO
+ * buffer, so that the telescopes are analyzed in groups of at most
+ * global::streamWindow bunches. Photo-electrons (1208 sub-items) are
+ * queued for the end of the event.
+ * 
+ * @param  item Eventio::Item object of type 1204
+ * @return (none)
+ * 
+ */
+void AnalyzeTelescopeArray(eventio::EventIO::Item * item, OutputFile *outputFile)
+{
+  BeginBunchStream(outputFile);
+  int type;
+  while((type=item->NextSubItemType())==1205 || type==1208)
+  {
+    eventio::EventIO::Item subItem(*item,"get");
+    if (type==1208) AddPhotoElectrons(&subItem);
+    else            StreamBunchBlock(&subItem);
+  }
+  EndBunchStream();
 }
@@ -4,6 +4,16 @@
 #include <vector>
 #include <string>
 #include <iterator>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <EventIO.hh>
 
@@ -18,6 +28,11 @@
  * ReadAtmosphericTransmission(). As it does not appear in any header
  * file, it is only visible within the present translation unit.
  * 
+ * When several tables are loaded, the values below hold the table
+ * interpolated to the current table parameter (see the function
+ * SetAtmosphericParameter()), so that AtmosphericTransmission() only
+ * does lookups into a single table.
+ * 
  */
 namespace atmTrans
 {
@@ -29,23 +44,99 @@ namespace atmTrans
   std::vector<double> logh1cm;  // Vector with tabulated logarithms of atmospheric heights
   
   std::vector<std::vector<double>> trans; // Table of optical depths as a function of wavelength and atmospheric height
+  
+  // One tabulated atmosphere, as read from file
+  struct Table
+  {
+    std::string fileName;
+    double      param;  // Table parameter used for interpolation (given with the file name)
+    double      h2;
+    std::vector<int>    wl;
+    std::vector<double> h1;
+    std::vector<std::vector<double>> trans;
+  };
+  
+  std::vector<Table> tables;      // All tables loaded, sorted by parameter
+  double activeParam = NAN;       // Parameter of the current (interpolated) table
 };
 
 
 
 /*
  * 
- * Function: ReadAtmosphericTransmission
+ * The namespace atmExpected keeps the survival probability averaged
+ * over the Cherenkov spectrum, tabulated over emission height and air
+ * mass (see SetExpectedTransmission()), with the wavelengths and table
+ * parameter it was computed for. Only visible within the present
+ * translation unit.
+ * 
+ */
+namespace atmExpected
+{
+  const int    nHeights   = 200;
+  const int    nAirmasses = 100;
+  const double maxAirmass = 20.;  // Larger air masses take the last column
+  
+  double wlMin = NAN, wlMax = NAN, param = NAN;
+  double logzMin, logzStep, airmassStep;
+  
+  std::vector<float> table; // [height][airmass]
+};
+
+
+
+/*
+ * 
+ * Layout of the binary cache of a text table, stored as "<file>.bin":
+ * this header followed by h1[nh1], wl[nwl] and trans[nwl][nh1-1], all
+ * as doubles. The checksum covers everything after the header; source
+ * size and modification time tell if the cache is older than the text.
+ * 
+ */
+namespace atmCache
+{
+  const char     magic[8] = {'I','A','C','T','A','T','M','1'};
+  const uint32_t version  = 1;
+  
+  struct Header
+  {
+    char     magic[8];
+    uint32_t version;
+    uint32_t nh1;
+    uint32_t nwl;
+    uint32_t reserved;
+    int64_t  srcSize;
+    int64_t  srcMtime;
+    double   param;
+    double   h2;
+    uint64_t checksum;
+  };
+  
+  // FNV-1a hash of a block of memory
+  uint64_t Checksum(const void *data, size_t size)
+  {
+    const unsigned char *p = (const unsigned char *)data;
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i=0; i<size; i++) { hash ^= p[i]; hash *= 1099511628211ULL; }
+    return hash;
+  }
+};
+
+
+
+/*
  * 
- * Read data from an atmospheric transmission data file and store
- * into the vectors of the atmTrans namespace, later to be used to
- * calculate the survival probability of individual photons.
+ * Function: ParseAtmosphericTable
+ * 
+ * Read data from an atmospheric transmission text file (as produced
+ * by MODTRAN) into a table.
  * 
  * @param  filename  Name of file containing atmospheric transmission data
+ * @param  table     Table to be filled
  * @return "true" in case of success, otherwise return "false".
  * 
  */
-bool ReadAtmosphericTransmission(std::string filename)
+static bool ParseAtmosphericTable(std::string filename, atmTrans::Table &table)
 {
   std::string line;
   std::istringstream iss;
@@ -60,7 +151,11 @@ bool ReadAtmosphericTransmission(std::string filename)
   }
   
   // Seek for the first line of data in the input file
-  while(getline(file,line)) if (line.substr(0,5)=="# H2=") break;
+  table.param = 0;
+  while(getline(file,line))
+  {
+    if (line.substr(0,5)=="# H2=") break;
+  }
   if (file.eof())
   {
     std::cerr << "Invalid atmospheric transmission file " << filename << ". Quit.\n";
@@ -71,21 +166,16 @@ bool ReadAtmosphericTransmission(std::string filename)
   // Ignore first five characters
   iss.str(line.substr(5));
   // Get h2 value (which is ground altitude)
-  iss >> atmTrans::h2;
+  iss >> table.h2;
   // First element of h1 is h2
-  atmTrans::h1.push_back(atmTrans::h2);
+  table.h1.push_back(table.h2);
   // Ignore nex six characters
   iss.ignore(6);
   // Get all h1 elements by using an iterator<double> over the istringstream
-  atmTrans::h1.insert(atmTrans::h1.end(),std::istream_iterator<double>(iss),std::istream_iterator<double>());
-  // Resize logh1cm to the same size of h1
-  atmTrans::logh1cm.resize(atmTrans::h1.size());
-  // Copy all elements of h1 transformed as log10(100.*h1[i]) using a lambda expression
-  std::transform(atmTrans::h1.begin(),atmTrans::h1.end(),atmTrans::logh1cm.begin(),[](double arg)->double{return log10(arg*1.e5);});
-
+  table.h1.insert(table.h1.end(),std::istream_iterator<double>(iss),std::istream_iterator<double>());
+  
   /// Count number of atmospheric heights and check for errors
-  atmTrans::nh1 = atmTrans::h1.size();
-  if (atmTrans::nh1==0 || atmTrans::nh1 != atmTrans::logh1cm.size())
+  if (table.h1.size()<2)
   {
     std::cerr << "Unable to read first line of atmospheric transmission data from " << filename << ". Quit.\n";
     return false;
@@ -98,18 +188,18 @@ bool ReadAtmosphericTransmission(std::string filename)
     iss.str(line);
     // An interator over iss<double> and an eof iterator
     std::istream_iterator<double> it(iss), eof;
+    if (it == eof) continue;
     // Get atmospheric transmission and increment the iterator
-    atmTrans::wl.push_back((int)*it);
+    table.wl.push_back((int)*it);
     it++;
     // Use the iterators to explicitly construct a vector an push it back to trans vector
-    atmTrans::trans.push_back(std::vector<double>(it,eof));
+    table.trans.push_back(std::vector<double>(it,eof));
   }
-
+  
   /// Count number of wavelenghts and check for errors
-  atmTrans::nwl = atmTrans::wl.size();
-  for (int i=0; i<atmTrans::nwl; i++)
+  for (size_t i=0; i<table.wl.size(); i++)
   {
-    if (atmTrans::trans[i].size() != atmTrans::nh1-1 || atmTrans::trans.size() != atmTrans::nwl)
+    if (table.trans[i].size() != table.h1.size()-1 || table.trans.size() != table.wl.size())
     {
       std::cerr << "Error reading atmospheric transmission data from " << filename << ". Quit.\n";
       return false;
@@ -124,32 +214,273 @@ bool ReadAtmosphericTransmission(std::string filename)
 
 /*
  * 
- * Function: AtmosphericTransmission
+ * Function: ReadAtmosphericCache
  * 
- * Calculates the survival probability (0 < p < 1) of a photon with
- * a given wavelength, emitted at a given atmospheric height with a
- * specific direction.
+ * Memory-maps the binary cache of an atmospheric transmission table and
+ * copies it into a table, after checking that it is valid (magic
+ * number, version, sizes and checksum) and not older than the text file.
  * 
- * @param  waveLength Photon's wavelength
- * @param  zEmission  Atmospheric height of photon's emission
- * @param  relAirmass Relative air mass for calculating the optical depth (actually, 1/cos(theta))
- * @return Survival probability
+ * @param  cacheName  Name of the binary cache
+ * @param  source     Status of the text file the cache was made from
+ * @param  table      Table to be filled
+ * @return "true" if the cache could be used, otherwise return "false".
  * 
  */
-double AtmosphericTransmission(double waveLength, double zEmission, double relAirmass)
+static bool ReadAtmosphericCache(std::string cacheName, const struct stat &source, atmTrans::Table &table)
 {
-  /// If photon were emitted below the observation level, it is not transmitted
-  if (zEmission < atmTrans::h2*1.e5) return 0;
+  int fd = open(cacheName.c_str(),O_RDONLY);
+  if (fd<0) return false;
   
-  int iwl = lrint(waveLength) - atmTrans::wl[0];
+  struct stat st;
+  if (fstat(fd,&st)!=0 || (size_t)st.st_size<sizeof(atmCache::Header)) { close(fd); return false; }
   
-  if (iwl < 0    ) iwl = 0;
-  if (iwl > atmTrans::nwl-1) iwl = atmTrans::nwl-1;
+  void *map = mmap(nullptr,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+  close(fd);
+  if (map == MAP_FAILED) return false;
   
-  int iBelow=-1;
-  double logzEm = log10(zEmission);
+  const atmCache::Header *header = (const atmCache::Header *)map;
+  const double *payload = (const double *)(header+1);
+  size_t payloadSize = st.st_size - sizeof(atmCache::Header);
+  
+  bool valid = memcmp(header->magic,atmCache::magic,8)==0 && header->version==atmCache::version
+            && header->nh1>1 && header->nwl>0
+            && payloadSize == sizeof(double)*(header->nh1 + header->nwl + (size_t)header->nwl*(header->nh1-1))
+            && header->srcSize==source.st_size && header->srcMtime==source.st_mtime
+            && header->checksum==atmCache::Checksum(payload,payloadSize);
+  
+  if (valid)
+  {
+    table.param = header->param;
+    table.h2    = header->h2;
+    table.h1.assign(payload,payload+header->nh1);
+    payload += header->nh1;
+    table.wl.assign(payload,payload+header->nwl);
+    payload += header->nwl;
+    table.trans.resize(header->nwl);
+    for (uint32_t i=0; i<header->nwl; i++, payload+=header->nh1-1)
+      table.trans[i].assign(payload,payload+header->nh1-1);
+  }
+  
+  munmap(map,st.st_size);
+  return valid;
+}
+
+
+
+/*
+ * 
+ * Function: WriteAtmosphericCache
+ * 
+ * Writes the binary cache of an atmospheric transmission table. Errors
+ * are not fatal: the text file will simply be parsed again next time.
+ * 
+ * @param  cacheName  Name of the binary cache
+ * @param  source     Status of the text file the table was read from
+ * @param  table      Table to be saved
+ * @return (none)
+ * 
+ */
+static void WriteAtmosphericCache(std::string cacheName, const struct stat &source, const atmTrans::Table &table)
+{
+  std::vector<double> payload(table.h1);
+  payload.insert(payload.end(),table.wl.begin(),table.wl.end());
+  for (size_t i=0; i<table.trans.size(); i++) payload.insert(payload.end(),table.trans[i].begin(),table.trans[i].end());
+  
+  atmCache::Header header;
+  memcpy(header.magic,atmCache::magic,8);
+  header.version  = atmCache::version;
+  header.nh1      = table.h1.size();
+  header.nwl      = table.wl.size();
+  header.reserved = 0;
+  header.srcSize  = source.st_size;
+  header.srcMtime = source.st_mtime;
+  header.param    = table.param;
+  header.h2       = table.h2;
+  header.checksum = atmCache::Checksum(payload.data(),payload.size()*sizeof(double));
+  
+  // Write to a temporary file and rename it, so a cache is never seen half-written
+  std::string tmpName = cacheName + ".tmp" + std::to_string(getpid());
+  FILE *file = fopen(tmpName.c_str(),"wb");
+  if (file == nullptr) return;
+  bool ok = fwrite(&header,sizeof(header),1,file)==1
+         && fwrite(payload.data(),sizeof(double),payload.size(),file)==payload.size();
+  ok = (fclose(file)==0) && ok;
+  if (!ok || rename(tmpName.c_str(),cacheName.c_str())!=0) remove(tmpName.c_str());
+}
+
+
+
+/*
+ * 
+ * Function: ReadAtmosphericTransmission
+ * 
+ * Read data from one or more atmospheric transmission data files and
+ * store into the atmTrans namespace, later to be used to calculate the
+ * survival probability of individual photons.
+ * 
+ * Files are given as a comma-separated list, each one followed by
+ * ":param" to set the table parameter used to interpolate between
+ * tables (it may be left out for a single table). The atmosphere is
+ * then interpolated once to global::atmParam (the first table if not
+ * given).
+ * Each file is read from its binary cache "<file>.bin" if it is valid,
+ * otherwise it is parsed and the cache is (re)written.
+ * 
+ * @param  filenames  Name(s) of file(s) containing atmospheric transmission data
+ * @return "true" in case of success, otherwise return "false".
+ * 
+ */
+bool ReadAtmosphericTransmission(std::string filenames)
+{
+  atmTrans::tables.clear();
+  atmTrans::activeParam = NAN;
+  
+  std::istringstream list(filenames);
+  std::string spec;
+  while (getline(list,spec,','))
+  {
+    atmTrans::Table table;
+    
+    // Split an explicit parameter from the file name
+    bool   hasParam = false;
+    double param    = 0;
+    size_t colon = spec.find_last_of(':');
+    if (colon != std::string::npos)
+    {
+      char *end;
+      param = strtod(spec.c_str()+colon+1,&end);
+      if (*end == '\0' && colon+1 < spec.size()) { hasParam = true; spec.erase(colon); }
+    }
+    table.fileName = spec;
+    
+    struct stat source;
+    if (stat(spec.c_str(),&source)!=0)
+    {
+      std::cerr << "Unable to open atmospheric transmission file " << spec << ". Quit.\n";
+      return false;
+    }
+    
+    std::string cacheName = spec + ".bin";
+    if (!ReadAtmosphericCache(cacheName,source,table))
+    {
+      table = atmTrans::Table();
+      table.fileName = spec;
+      if (!ParseAtmosphericTable(spec,table)) return false;
+      WriteAtmosphericCache(cacheName,source,table);
+    }
+    if (hasParam) table.param = param;
+    
+    // Table numbers in the files (e.g. the haze model) are categories,
+    // so the parameter to interpolate on must be given
+    if (!hasParam && filenames.find(',') != std::string::npos)
+    {
+      std::cerr << "Atmospheric transmission table " << spec << " needs a parameter (file:param) to be interpolated with other tables. Quit.\n";
+      return false;
+    }
+    
+    // Tables can only be interpolated if tabulated at the same points
+    if (!atmTrans::tables.empty())
+    {
+      const atmTrans::Table &first = atmTrans::tables[0];
+      if (table.h2 != first.h2 || table.h1 != first.h1 || table.wl != first.wl)
+      {
+        std::cerr << "Atmospheric transmission tables " << first.fileName << " and " << spec << " have different heights or wavelengths. Quit.\n";
+        return false;
+      }
+    }
+    
+    atmTrans::tables.push_back(table);
+  }
+  
+  if (atmTrans::tables.empty())
+  {
+    std::cerr << "No atmospheric transmission file given. Quit.\n";
+    return false;
+  }
   
+  std::stable_sort(atmTrans::tables.begin(),atmTrans::tables.end(),[](const atmTrans::Table &a, const atmTrans::Table &b){ return a.param<b.param; });
   
+  // Tabulated heights and wavelengths are common to all tables
+  const atmTrans::Table &first = atmTrans::tables[0];
+  atmTrans::h2  = first.h2;
+  atmTrans::h1  = first.h1;
+  atmTrans::wl  = first.wl;
+  atmTrans::nh1 = atmTrans::h1.size();
+  atmTrans::nwl = atmTrans::wl.size();
+  // Resize logh1cm to the same size of h1
+  atmTrans::logh1cm.resize(atmTrans::h1.size());
+  // Copy all elements of h1 transformed as log10(100.*h1[i]) using a lambda expression
+  std::transform(atmTrans::h1.begin(),atmTrans::h1.end(),atmTrans::logh1cm.begin(),[](double arg)->double{return log10(arg*1.e5);});
+  
+  SetAtmosphericParameter(std::isnan(global::atmParam) ? first.param : global::atmParam);
+  
+  return true;
+}
+
+
+
+/*
+ * 
+ * Function: SetAtmosphericParameter
+ * 
+ * Selects the atmosphere used by AtmosphericTransmission() by linearly
+ * interpolating the optical depths of the two loaded tables whose
+ * parameters enclose the given value (values outside the range of the
+ * tables are clamped). The interpolated table is computed only when the
+ * parameter changes. The parameter is the same for the whole run, see
+ * ReadAtmosphericTransmission().
+ * 
+ * @param  param  Table parameter (e.g. haze model)
+ * @return (none)
+ * 
+ */
+void SetAtmosphericParameter(double param)
+{
+  using atmTrans::tables;
+  
+  if (tables.empty() || param == atmTrans::activeParam) return;
+  atmTrans::activeParam = param;
+  
+  // Find the enclosing tables and the interpolation weight
+  size_t iHigh = 0;
+  while (iHigh < tables.size()-1 && tables[iHigh].param < param) iHigh++;
+  size_t iLow = iHigh>0 ? iHigh-1 : 0;
+  
+  double weight = 0;
+  if (tables[iHigh].param != tables[iLow].param)
+    weight = (param - tables[iLow].param)/(tables[iHigh].param - tables[iLow].param);
+  if (weight < 0) weight = 0;
+  if (weight > 1) weight = 1;
+  
+  const std::vector<std::vector<double>> &low  = tables[iLow].trans;
+  const std::vector<std::vector<double>> &high = tables[iHigh].trans;
+  
+  atmTrans::trans.resize(atmTrans::nwl);
+  for (int i=0; i<atmTrans::nwl; i++)
+  {
+    atmTrans::trans[i].resize(atmTrans::nh1-1);
+    for (int j=0; j<atmTrans::nh1-1; j++) atmTrans::trans[i][j] = (1.-weight)*low[i][j] + weight*high[i][j];
+  }
+}
+
+
+
+/*
+ * 
+ * Function: OpticalDepth
+ * 
+ * Optical depth for a given tabulated wavelength from a given emission
+ * height down to the observation level, interpolated linearly in the
+ * logarithm of the height.
+ * 
+ * @param  iwl     Index of the wavelength in the table
+ * @param  logzEm  Logarithm of the emission height (in cm), above the observation level
+ * @return Optical depth
+ * 
+ */
+static double OpticalDepth(int iwl, double logzEm)
+{
+  int iBelow=-1;
   double rFrac;
   double opticalDepth;
   
@@ -158,7 +489,7 @@ double AtmosphericTransmission(double waveLength, double zEmission, double relAi
     rFrac = (logzEm-atmTrans::logh1cm[0])/(atmTrans::logh1cm[1]-atmTrans::logh1cm[0]);
     opticalDepth = rFrac*atmTrans::trans[iwl][0];
   }
-  else if (logzEm>atmTrans::logh1cm[atmTrans::nh1-1])
+  else if (logzEm>=atmTrans::logh1cm[atmTrans::nh1-1])
   {
     opticalDepth = atmTrans::trans[iwl][atmTrans::nh1-2];
   }
@@ -174,5 +505,158 @@ double AtmosphericTransmission(double waveLength, double zEmission, double relAi
     opticalDepth = rFrac*(atmTrans::trans[iwl][iBelow]-atmTrans::trans[iwl][iBelow-1]) + atmTrans::trans[iwl][iBelow-1];
   }
   
-  return exp(-1.*opticalDepth*relAirmass);
+  return opticalDepth;
+}
+
+
+
+/*
+ * 
+ * Function: AtmosphericTransmission
+ * 
+ * Calculates the survival probability (0 < p < 1) of a photon with
+ * a given wavelength, emitted at a given atmospheric height with a
+ * specific direction.
+ * 
+ * @param  waveLength Photon's wavelength
+ * @param  zEmission  Atmospheric height of photon's emission
+ * @param  relAirmass Relative air mass for calculating the optical depth (actually, 1/cos(theta))
+ * @return Survival probability
+ * 
+ */
+double AtmosphericTransmission(double waveLength, double zEmission, double relAirmass)
+{
+  /// If photon were emitted below the observation level, it is not transmitted
+  if (zEmission < atmTrans::h2*1.e5) return 0;
+  
+  int iwl = lrint(waveLength) - atmTrans::wl[0];
+  
+  if (iwl < 0    ) iwl = 0;
+  if (iwl > atmTrans::nwl-1) iwl = atmTrans::nwl-1;
+  
+  return exp(-1.*OpticalDepth(iwl,log10(zEmission))*relAirmass);
+}
+
+
+
+/*
+ * 
+ * Function: SetExpectedTransmission
+ * 
+ * Tabulates the survival probability averaged over the Cherenkov
+ * spectrum (dN/dλ ∝ 1/λ² between the given wavelengths) as a function
+ * of the emission height (uniform in its logarithm, over the tabulated
+ * heights) and of the relative air mass (up to atmExpected::maxAirmass),
+ * for the current atmosphere. The table is only computed again when the
+ * wavelengths or the atmosphere change, so it may be called for every
+ * event. The lowest and highest rows of the table are checked against
+ * the optical depth at the limits of the tabulated heights.
+ * 
+ * @param  wlMin  Minimum wavelength of the spectrum (nm)
+ * @param  wlMax  Maximum wavelength of the spectrum (nm)
+ * @return True if the table matches the optical depth at its limits
+ * 
+ */
+bool SetExpectedTransmission(double wlMin, double wlMax)
+{
+  using namespace atmExpected;
+  
+  if (wlMin == atmExpected::wlMin && wlMax == atmExpected::wlMax && atmTrans::activeParam == param) return true;
+  atmExpected::wlMin = wlMin;
+  atmExpected::wlMax = wlMax;
+  param              = atmTrans::activeParam;
+  
+  // Tabulated wavelengths within the spectrum (1 nm apart), weighted by 1/λ²
+  std::vector<int>    iwl;
+  std::vector<double> weight;
+  double sumWeights = 0;
+  for (int w=lrint(ceil(wlMin)); w<=lrint(floor(wlMax)); w++)
+  {
+    int i = w - atmTrans::wl[0];
+    if (i < 0    ) i = 0;
+    if (i > atmTrans::nwl-1) i = atmTrans::nwl-1;
+    iwl.push_back(i);
+    weight.push_back(1./((double)w*w));
+    sumWeights += weight.back();
+  }
+  // A single wavelength if the range is narrower than the table step
+  if (iwl.empty())
+  {
+    int i = lrint(0.5*(wlMin+wlMax)) - atmTrans::wl[0];
+    iwl.push_back(std::min(std::max(i,0),atmTrans::nwl-1));
+    weight.push_back(1.);
+    sumWeights = 1.;
+  }
+  
+  logzMin     = atmTrans::logh1cm[0];
+  logzStep    = (atmTrans::logh1cm[atmTrans::nh1-1]-logzMin)/(nHeights-1);
+  airmassStep = (maxAirmass-1.)/(nAirmasses-1);
+  table.resize(nHeights*nAirmasses);
+  
+  std::vector<double> depth(iwl.size());
+  for (int h=0; h<nHeights; h++)
+  {
+    for (size_t k=0; k<iwl.size(); k++) depth[k] = OpticalDepth(iwl[k],logzMin+h*logzStep);
+    for (int a=0; a<nAirmasses; a++)
+    {
+      double airmass = 1. + a*airmassStep;
+      double sum     = 0;
+      for (size_t k=0; k<iwl.size(); k++) sum += weight[k]*exp(-depth[k]*airmass);
+      table[h*nAirmasses+a] = sum/sumWeights;
+    }
+  }
+  
+  // No optical depth at the lowest height, the whole tabulated depth at the highest
+  for (int a=0; a<nAirmasses; a++)
+  {
+    double airmass = 1. + a*airmassStep;
+    double top     = 0;
+    for (size_t k=0; k<iwl.size(); k++) top += weight[k]*exp(-atmTrans::trans[iwl[k]][atmTrans::nh1-2]*airmass);
+    top /= sumWeights;
+    if (fabs(table[a]-1.) > 1.e-6 || fabs(table[(nHeights-1)*nAirmasses+a]-top) > 1.e-6*top)
+    {
+      std::cerr << "Expected transmission table does not match the optical depth at the limits of the tabulated heights. Quit.\n";
+      atmExpected::wlMin = NAN;
+      return false;
+    }
+  }
+  
+  return true;
+}
+
+
+
+/*
+ * 
+ * Function: ExpectedTransmission
+ * 
+ * Survival probability averaged over the Cherenkov spectrum of a photon
+ * emitted at a given atmospheric height with a specific direction, by
+ * bilinear interpolation in the table of SetExpectedTransmission().
+ * 
+ * @param  zEmission   Atmospheric height of photon's emission (cm)
+ * @param  relAirmass  Relative air mass (1/cos(theta))
+ * @return Expected survival probability
+ * 
+ */
+double ExpectedTransmission(double zEmission, double relAirmass)
+{
+  using namespace atmExpected;
+  
+  /// If photon were emitted below the observation level, it is not transmitted
+  if (zEmission < atmTrans::h2*1.e5) return 0;
+  
+  double x = (log10(zEmission)-logzMin)/logzStep;
+  double y = (relAirmass-1.)/airmassStep;
+  if (x < 0) x = 0; else if (x > nHeights-1)   x = nHeights-1;
+  if (y < 0) y = 0; else if (y > nAirmasses-1) y = nAirmasses-1;
+  
+  int h = std::min((int)x,nHeights-2);
+  int a = std::min((int)y,nAirmasses-2);
+  x -= h;
+  y -= a;
+  
+  const float *t = &table[h*nAirmasses+a];
+  return (1.-x)*((1.-y)*t[0]          + y*t[1]) +
+             x *((1.-y)*t[nAirmasses] + y*t[nAirmasses+1]);
 }
@@ -0,0 +1,357 @@
+#include <iostream>
+#include <iomanip>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <map>
+#include <set>
+#include <chrono>
+
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <EventIO.hh>
+
+#ifndef IACT_NO_ROOT
+#include <TFile.h>
+#include <TKey.h>
+#include <TList.h>
+#include <TFileMerger.h>
+#endif
+
+#include <iact-reader.h>
+#include <batchMode.h>
+#include <metrics.h>
+#include <trace.h>
+#include <memoryBudget.h>
+
+/*
+ * 
+ * Function: InputBaseName
+ * 
+ * Name of an input file without its directory and last extension.
+ * 
+ * @param  input  Input file name
+ * @return Base name
+ * 
+ */
+static std::string InputBaseName(std::string input)
+{
+  std::string base = input.substr(input.find_last_of('/')+1);
+  size_t dot = base.find_last_of('.');
+  return dot == 0 || dot == std::string::npos ? base : base.substr(0,dot);
+}
+
+
+
+/*
+ * 
+ * Function: SplitOutputName
+ * 
+ * Builds the name of the output file of a given input when there is
+ * one output per input: "<output>_<input>.root", with the position of
+ * the input appended, "<output>_<input>_<index>.root", if several
+ * inputs share the same base name.
+ * 
+ * @param  input  Input file name
+ * @param  index  Position of the input in the input list
+ * @return Output file name
+ * 
+ */
+static std::string SplitOutputName(std::string input, int index)
+{
+  std::string output = global::outputFileName;
+  
+  // Number of inputs with each base name (the list never changes)
+  static const std::map<std::string,int> nSameBase = []()
+  {
+    std::map<std::string,int> n;
+    for (const std::string &file : global::inputFiles) n[InputBaseName(file)]++;
+    return n;
+  }();
+  
+  std::string base = InputBaseName(input);
+  auto same = nSameBase.find(base);
+  if (same != nSameBase.end() && same->second > 1) base += "_" + std::to_string(index);
+  
+  // Insert it before the extension of the output name
+  size_t dot = output.find_last_of('.');
+  if (dot == std::string::npos || dot < output.find_last_of('/')+1) dot = output.size();
+  return output.substr(0,dot) + "_" + base + output.substr(dot);
+}
+
+
+
+/*
+ * 
+ * Function: BatchOutputName
+ * 
+ * Builds the name of the output file for a given input in batch mode:
+ * its own output (see SplitOutputName()) if --split-output was given,
+ * otherwise a temporary part to be merged into the final output.
+ * 
+ * @param  input  Input file name
+ * @param  index  Position of the input in the input list
+ * @return Output file name
+ * 
+ */
+static std::string BatchOutputName(std::string input, int index)
+{
+  if (global::splitOutput) return SplitOutputName(input,index);
+  return global::outputFileName + ".part" + std::to_string(index);
+}
+
+
+
+#ifndef IACT_NO_ROOT
+/*
+ * 
+ * Function: ListObjects
+ * 
+ * Collects the paths of the objects in a directory of a ROOT file and
+ * its subdirectories, but for tables, whose rows are appended when
+ * files are merged.
+ * 
+ * @param  dir    Directory
+ * @param  path   Path of the directory ("" or ending with "/")
+ * @param  names  Output: paths of the objects
+ * 
+ */
+static void ListObjects(TDirectory *dir, std::string path, std::set<std::string> &names)
+{
+  TIter next(dir->GetListOfKeys());
+  while (TKey *key = (TKey*)next())
+  {
+    std::string name      = path + key->GetName();
+    std::string className = key->GetClassName();
+    if (className == "TDirectoryFile")
+    {
+      TDirectory *sub = dir->GetDirectory(key->GetName());
+      if (sub != nullptr) ListObjects(sub,name+"/",names);
+    }
+    else if (className != "TNtuple" && className != "TTree") names.insert(name);
+  }
+}
+
+
+
+/*
+ * 
+ * Function: FindSharedObject
+ * 
+ * Looks for histograms or graphs with the same path in the parts to be
+ * merged. Their names come from run and event numbers, so inputs with
+ * the same numbers would be silently added up by the merger.
+ * 
+ * @param  results  Number of events of each input (negative if failed)
+ * @param  message  Output: the shared path and the inputs it is found in
+ * @return "true" if an object is found in two parts, otherwise "false".
+ * 
+ */
+static bool FindSharedObject(const std::vector<int> &results, std::string &message)
+{
+  std::map<std::string,int> owner; // Path of each object -> input
+  for (size_t i=0; i<results.size(); i++)
+  {
+    if (results[i]<0) continue;
+    
+    std::unique_ptr<TFile> part(TFile::Open(BatchOutputName(global::inputFiles[i],i).c_str()));
+    if (!part || part->IsZombie()) continue;
+    std::set<std::string> names;
+    ListObjects(part.get(),"",names);
+    
+    for (const std::string &name : names)
+    {
+      auto found = owner.insert(std::make_pair(name,(int)i));
+      if (found.second) continue;
+      message = name + " is found in " + global::inputFiles[found.first->second] + " and " + global::inputFiles[i];
+      return true;
+    }
+  }
+  return false;
+}
+#endif
+
+
+
+/*
+ * 
+ * Function: TraceWorkerName
+ * 
+ * Name of the file where a batch worker leaves its trace events, to be
+ * merged into the trace of the main process.
+ * 
+ * @param  worker  Worker index
+ * @return File name
+ * 
+ */
+static std::string TraceWorkerName(int worker)
+{
+  return global::traceFileName + ".worker" + std::to_string(worker);
+}
+
+
+
+/*
+ * 
+ * Function: RunBatch
+ * 
+ * Processes all files in global::inputFiles with a pool of worker
+ * processes. Files are assigned to workers balancing the total input
+ * size (largest files first, each one to the least loaded worker).
+ * Each worker allocates a single IO buffer and processes its files
+ * sequentially through ProcessInput(). At the end, outputs are merged
+ * into global::outputFileName unless --split-output was given (or they
+ * share histograms, see FindSharedObject()), and the aggregate
+ * throughput is reported.
+ * 
+ * @return "true" if all files were processed, otherwise "false".
+ * 
+ */
+bool RunBatch()
+{
+  using std::cerr;
+  using std::cout;
+  using std::endl;
+  
+  auto start = std::chrono::steady_clock::now();
+  
+  int nFiles   = global::inputFiles.size();
+  int nWorkers = std::min(global::nJobs,nFiles);
+  
+  // Size of each input file
+  std::vector<long long> sizes(nFiles,0);
+  long long totalBytes = 0;
+  for (int i=0; i<nFiles; i++)
+  {
+    struct stat st;
+    if (stat(global::inputFiles[i].c_str(),&st)==0) sizes[i] = st.st_size;
+    totalBytes += sizes[i];
+  }
+  
+  // Longest processing time first: sort by size and give each file to
+  // the worker with the smallest load so far
+  std::vector<int> order(nFiles);
+  for (int i=0; i<nFiles; i++) order[i] = i;
+  std::stable_sort(order.begin(),order.end(),[&](int a, int b){ return sizes[a]>sizes[b]; });
+  
+  std::vector<std::vector<int>> assigned(nWorkers);
+  std::vector<long long> load(nWorkers,0);
+  for (int i : order)
+  {
+    int w = std::min_element(load.begin(),load.end()) - load.begin();
+    assigned[w].push_back(i);
+    load[w] += sizes[i];
+  }
+  
+  cout << "Processing " << nFiles << " files (" << totalBytes << " bytes) with " << nWorkers << " workers" << endl;
+  
+  // Start the workers. Each one writes, for each file, its index and
+  // number of events (or -1 on failure) into a pipe to the parent
+  std::vector<int>   results(nFiles,-1);
+  std::vector<pid_t> pids;
+  std::vector<int>   pipes;
+  for (int w=0; w<nWorkers; w++)
+  {
+    int fd[2];
+    if (pipe(fd)!=0) { cerr << "Unable to create pipe for batch worker" << endl; return false; }
+    
+    pid_t pid = fork();
+    if (pid<0) { cerr << "Unable to start batch worker" << endl; return false; }
+    
+    if (pid==0)
+    {
+      close(fd[0]);
+      MetricsEnterWorker(w);
+      ResetTrace();
+      eventio::EventIO iobuf(global::iniBufSize,global::maxBufSize);
+      for (int i : assigned[w])
+      {
+        global::inputFileName  = global::inputFiles[i];
+        global::outputFileName = BatchOutputName(global::inputFiles[i],i);
+        TraceSpan span("ProcessInput","file",i);
+        int res[2] = {i, ProcessInput(iobuf)};
+        if (res[1]<0) cerr << "Error processing input file " << global::inputFileName << endl;
+        if (write(fd[1],res,sizeof(res))!=sizeof(res)) _exit(1);
+      }
+      close(fd[1]);
+      if (global::traceFileName != "") WriteTraceEvents(TraceWorkerName(w));
+      if (global::memoryLimit>0) WriteMemoryReport("Memory high-water marks of worker " + std::to_string(w));
+      _exit(0);
+    }
+    
+    close(fd[1]);
+    MetricsAddWorker(pid,w);
+    pids.push_back(pid);
+    pipes.push_back(fd[0]);
+  }
+  
+  // Collect results and wait for the workers
+  for (int w=0; w<nWorkers; w++)
+  {
+    int res[2];
+    while (read(pipes[w],res,sizeof(res))==sizeof(res)) results[res[0]] = res[1];
+    close(pipes[w]);
+    waitpid(pids[w],nullptr,0);
+    MetricsRemoveWorker(pids[w]);
+    if (global::traceFileName != "") AppendTraceEvents(TraceWorkerName(w));
+  }
+  
+  long long nEvents = 0;
+  int nFailed = 0;
+  for (int i=0; i<nFiles; i++)
+  {
+    if (results[i]<0) nFailed++;
+    else nEvents += results[i];
+  }
+  
+  // Merge the parts into a single output file, in input order (only
+  // ROOT outputs, NumPy outputs are always split). Parts of failed
+  // inputs are dropped. Parts sharing histograms or graphs are not
+  // merged, but kept as with --split-output
+#ifndef IACT_NO_ROOT
+  std::string shared;
+  if (!global::splitOutput)
+    for (int i=0; i<nFiles; i++)
+      if (results[i]<0) std::remove(BatchOutputName(global::inputFiles[i],i).c_str());
+  
+  if (!global::splitOutput && FindSharedObject(results,shared))
+  {
+    cerr << "Batch outputs cannot be merged without adding up objects of different inputs: " << shared << endl;
+    cerr << "Keeping one output per input instead" << endl;
+    for (int i=0; i<nFiles; i++)
+      if (results[i]>=0) std::rename(BatchOutputName(global::inputFiles[i],i).c_str(),SplitOutputName(global::inputFiles[i],i).c_str());
+    nFailed++;
+  }
+  else if (!global::splitOutput)
+  {
+    TraceSpan span("Merge","files",nFiles);
+    TFileMerger merger(false);
+    merger.OutputFile(global::outputFileName.c_str(),"RECREATE");
+    for (int i=0; i<nFiles; i++)
+      if (results[i]>=0) merger.AddFile(BatchOutputName(global::inputFiles[i],i).c_str(),false);
+    if (!merger.Merge())
+    {
+      cerr << "Error merging batch outputs into " << global::outputFileName << endl;
+      nFailed++;
+    }
+    else
+      for (int i=0; i<nFiles; i++) std::remove(BatchOutputName(global::inputFiles[i],i).c_str());
+  }
+#endif
+  
+  // Report aggregate throughput
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+  cout << endl;
+  cout << "Batch summary:" << endl;
+  cout << "  files      " << nFiles-nFailed << " / " << nFiles << endl;
+  cout << "  events     " << nEvents << endl;
+  cout << "  input      " << std::fixed << std::setprecision(1) << totalBytes*1.e-6 << " MB" << endl;
+  cout << "  wall time  " << seconds << " s" << endl;
+  cout << "  throughput " << totalBytes*1.e-6/seconds << " MB/s, " << nEvents/seconds << " events/s" << endl;
+  
+  return nFailed==0;
+}
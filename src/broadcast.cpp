@@ -0,0 +1,460 @@
+#include <iostream>
+#include <string>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <new>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <EventIO.hh>
+
+#include <iact-reader.h>
+#include <rawEventIO.h>
+#include <metrics.h>
+#include <trace.h>
+#include <broadcast.h>
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "The broadcast ring needs lock-free 64-bit atomics");
+
+/*
+ * 
+ * The namespace broadcast describes the shared-memory ring used to hand
+ * one input stream over to several local consumer processes (see
+ * BroadcastInput() and AttachBroadcast()). Only visible within the
+ * present translation unit.
+ * 
+ * The ring is written by a single producer and read by every consumer
+ * with a cursor of its own. Cursors are byte counts that only grow (the
+ * position in the ring is the count modulo its capacity), so no locks
+ * are needed: the producer publishes a new write cursor once the bytes
+ * are in place, and consumers publish their read cursors once they are
+ * done with the bytes. The producer never goes further than a whole
+ * ring ahead of the slowest consumer, which bounds memory use.
+ * 
+ */
+namespace broadcast
+{
+  const uint64_t kMagic        = 0x49414354524e4731; // "IACTRNG1"
+  const int      kMaxConsumers = 64;
+  const int      kAttachWait   = 60; // Seconds each side waits for the other to start
+  
+  enum SlotState { kFree, kAttached, kGone };
+  
+  struct alignas(64) Slot
+  {
+    std::atomic<int>                state;
+    pid_t                           pid;
+    std::atomic<unsigned long long> read;  // Bytes consumed
+  };
+  
+  struct Ring
+  {
+    std::atomic<unsigned long long> magic; // Set once the ring is ready
+    unsigned long long              capacity;
+    pid_t                           producer;
+    int                             nConsumers;
+    std::atomic<int>                nAttached;
+    std::atomic<bool>               finished;
+    alignas(64) std::atomic<unsigned long long> written; // Bytes published
+    Slot                            slots[kMaxConsumers];
+    
+    char *Data() { return (char *)this + sizeof(Ring); }
+  };
+  
+  
+  
+  // Name of the shared-memory object, which must start with a slash
+  std::string ObjectName(std::string name) { return name[0]=='/' ? name : "/" + name; }
+  
+  // Short pause while waiting for the other side of the ring
+  void Pause(int &nWaits)
+  {
+    if (++nWaits < 64) sched_yield();
+    else std::this_thread::sleep_for(std::chrono::microseconds(100));
+  }
+  
+  // Whether a process is still there (checked now and then while waiting)
+  bool Alive(pid_t pid) { return kill(pid,0)==0 || errno!=ESRCH; }
+};
+
+
+
+/*
+ * 
+ * Function: SlowestConsumer
+ * 
+ * Finds the read cursor of the slowest consumer still attached to the
+ * ring. Consumers that died are detached, so that they do not stop the
+ * producer forever.
+ * 
+ * @param  ring       The ring
+ * @param  checkDead  Whether to look for consumers that died
+ * @param  slowest    Output: read cursor of the slowest consumer
+ * @return "false" if there are no consumers left, "true" otherwise.
+ * 
+ */
+static bool SlowestConsumer(broadcast::Ring *ring, bool checkDead, unsigned long long &slowest)
+{
+  using namespace broadcast;
+  
+  bool attached = false;
+  for (int i=0; i<ring->nConsumers; i++)
+  {
+    Slot &slot = ring->slots[i];
+    if (slot.state.load(std::memory_order_acquire) != kAttached) continue;
+    if (checkDead && !Alive(slot.pid))
+    {
+      std::cerr << "Broadcast consumer " << slot.pid << " is gone, detaching it" << std::endl;
+      slot.state.store(kGone,std::memory_order_release);
+      continue;
+    }
+    unsigned long long read = slot.read.load(std::memory_order_acquire);
+    if (!attached || read < slowest) slowest = read;
+    attached = true;
+  }
+  return attached;
+}
+
+
+
+/*
+ * 
+ * Function: CopyToRing
+ * 
+ * Copies bytes (from memory, or read straight from the input) into the
+ * ring, waiting for the consumers whenever it is full. Bytes are only
+ * published when the producer has to wait, and at the end of every
+ * block (see BroadcastInput()), so that consumers mostly see whole
+ * blocks.
+ * 
+ * @param  ring    The ring
+ * @param  input   Input file (used if data is null)
+ * @param  data    Bytes to copy, or nullptr to read them from the input
+ * @param  size    Number of bytes to copy
+ * @param  cursor  Write cursor (published or not), updated
+ * @return "true" in case of success, "false" if the input ended or no consumers are left.
+ * 
+ */
+static bool CopyToRing(broadcast::Ring *ring, FILE *input, const char *data, long long size, unsigned long long &cursor)
+{
+  using namespace broadcast;
+  
+  unsigned long long capacity = ring->capacity;
+  while (size > 0)
+  {
+    int nWaits = 0;
+    unsigned long long slowest;
+    while (true)
+    {
+      if (!SlowestConsumer(ring,nWaits>0 && nWaits%1000==0,slowest)) return false;
+      if (cursor-slowest < capacity) break;
+      ring->written.store(cursor,std::memory_order_release);
+      Pause(nWaits);
+    }
+    
+    unsigned long long position = cursor % capacity;
+    unsigned long long n = capacity - (cursor-slowest);
+    if (n > capacity-position) n = capacity-position;
+    if ((long long)n > size) n = size;
+    
+    if (data != nullptr)
+    {
+      memcpy(ring->Data()+position,data,n);
+      data += n;
+    }
+    else if (fread(ring->Data()+position,1,n,input) != n) return false;
+    cursor += n;
+    size   -= n;
+  }
+  return true;
+}
+
+
+
+/*
+ * 
+ * Function: BroadcastInput
+ * 
+ * Reads the input (global::inputFileName, or stdin) once and hands its
+ * blocks over to global::nConsumers processes attached to a shared-memory
+ * ring (global::broadcastName) with --attach, each one running its own
+ * analysis. The producer waits (up to a minute) for all the consumers
+ * to attach before reading, and for all of them to finish before
+ * returning. The name of the ring is removed as soon as everybody is
+ * attached, or the wait is over, so that nothing is left behind if any
+ * process dies or never starts.
+ * 
+ * @return "true" in case of success, otherwise return "false".
+ * 
+ */
+bool BroadcastInput()
+{
+  using namespace broadcast;
+  using std::cerr;
+  using std::cout;
+  using std::endl;
+  
+  TraceSpan span("Broadcast");
+  
+  FILE *input = stdin;
+  if (global::inputFileName != "") input = fopen(global::inputFileName.c_str(),"rb");
+  if (input == nullptr)
+  {
+    cerr << "Error opening input file " << global::inputFileName << "!" << endl;
+    return false;
+  }
+  
+  std::string name = ObjectName(global::broadcastName);
+  size_t      size = sizeof(Ring) + global::ringSize;
+  int fd = shm_open(name.c_str(),O_RDWR|O_CREAT|O_EXCL,0600);
+  if (fd < 0)
+  {
+    cerr << "Unable to create broadcast ring " << name << ": " << strerror(errno);
+    if (errno == EEXIST) cerr << " (remove /dev/shm" << name << " if no producer is using it)";
+    cerr << endl;
+    return false;
+  }
+  void *shared = ftruncate(fd,size)==0 ? mmap(nullptr,size,PROT_READ|PROT_WRITE,MAP_SHARED,fd,0) : MAP_FAILED;
+  close(fd);
+  if (shared == MAP_FAILED)
+  {
+    cerr << "Unable to allocate broadcast ring " << name << " of " << size << " bytes" << endl;
+    shm_unlink(name.c_str());
+    return false;
+  }
+  
+  Ring *ring = new (shared) Ring;
+  ring->capacity   = global::ringSize;
+  ring->producer   = getpid();
+  ring->nConsumers = global::nConsumers;
+  ring->nAttached.store(0);
+  ring->finished.store(false);
+  ring->written.store(0);
+  for (int i=0; i<kMaxConsumers; i++)
+  {
+    ring->slots[i].state.store(kFree);
+    ring->slots[i].read.store(0);
+  }
+  ring->magic.store(kMagic,std::memory_order_release);
+  
+  cout << "Waiting for " << global::nConsumers << " consumer(s) to attach to " << name << endl;
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(kAttachWait);
+  while (ring->nAttached.load(std::memory_order_acquire) < global::nConsumers && std::chrono::steady_clock::now() < deadline)
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  shm_unlink(name.c_str());
+  
+  // Consumers already attached see the producer gone and stop
+  int nAttached = ring->nAttached.load(std::memory_order_acquire);
+  if (nAttached < global::nConsumers)
+  {
+    cerr << "Only " << nAttached << " of " << global::nConsumers << " consumer(s) attached to " << name << " within " << kAttachWait << " s" << endl;
+    if (input != stdin) fclose(input);
+    munmap(shared,size);
+    return false;
+  }
+  
+  // Blocks are copied as they are, after checking their headers so that
+  // consumers are not handed anything but EventIO blocks
+  unsigned long long cursor  = 0;
+  unsigned long long slowest = 0;
+  long long          nBlocks = 0;
+  bool               error   = false;
+  char               words[20];
+  while (true)
+  {
+    size_t n = fread(words,1,16,input);
+    if (n == 0 && feof(input)) break;
+    
+    RawItemHeader header;
+    bool ok = n==16 && ParseItemHeader(words,n,true,header);
+    if (ok && header.headerSize == 16) ok = fread(words+16,1,4,input) == 4 && ParseItemHeader(words,20,true,header);
+    if (!ok)
+    {
+      cerr << "Broken block after " << cursor << " bytes of the input" << endl;
+      error = true;
+      break;
+    }
+    
+    unsigned long long start = cursor;
+    if (!CopyToRing(ring,input,words,4+header.headerSize,cursor) || !CopyToRing(ring,input,nullptr,header.length,cursor))
+    {
+      if (!SlowestConsumer(ring,true,slowest)) cerr << "No broadcast consumers left" << endl;
+      else cerr << "Truncated block " << header.type << " after " << start << " bytes of the input" << endl;
+      error = true;
+      break;
+    }
+    ring->written.store(cursor,std::memory_order_release);
+    
+    nBlocks++;
+    MetricsAdd(metrics::kBlocks,1);
+    MetricsAdd(metrics::kInputBytes,cursor-start);
+  }
+  
+  if (input != stdin) fclose(input);
+  ring->written.store(cursor,std::memory_order_release);
+  ring->finished.store(true,std::memory_order_release);
+  
+  // Wait for the consumers, so that the producer ends with them
+  int nWaits = 0;
+  while (SlowestConsumer(ring,nWaits>0 && nWaits%1000==0,slowest) && slowest < cursor) Pause(nWaits);
+  
+  cout << "Broadcast " << nBlocks << " blocks (" << cursor << " bytes) to " << global::nConsumers << " consumer(s)" << endl;
+  munmap(shared,size);
+  return !error;
+}
+
+
+
+/*
+ * 
+ * Function: FeedConsumer
+ * 
+ * Copies the bytes of the ring into a pipe, as they are published, for
+ * a consumer attached with AttachBroadcast(). Runs in a thread of its
+ * own until the producer is done (or dies) or the pipe is closed.
+ * 
+ * @param  ring  The ring
+ * @param  slot  Slot of the consumer
+ * @param  out   Write end of the pipe
+ * @return (none)
+ * 
+ */
+static void FeedConsumer(broadcast::Ring *ring, broadcast::Slot *slot, int out)
+{
+  using namespace broadcast;
+  
+  unsigned long long capacity = ring->capacity;
+  unsigned long long read     = slot->read.load();
+  int nWaits = 0;
+  while (true)
+  {
+    bool finished = ring->finished.load(std::memory_order_acquire);
+    unsigned long long written = ring->written.load(std::memory_order_acquire);
+    
+    if (read == written)
+    {
+      if (finished) break;
+      if (nWaits%1000==999 && !Alive(ring->producer))
+      {
+        std::cerr << "Broadcast producer is gone, the input is truncated" << std::endl;
+        break;
+      }
+      Pause(nWaits);
+      continue;
+    }
+    nWaits = 0;
+    
+    unsigned long long position = read % capacity;
+    unsigned long long n = written - read;
+    if (n > capacity-position) n = capacity-position;
+    ssize_t done = write(out,ring->Data()+position,n);
+    if (done < 0 && errno == EINTR) continue;
+    if (done <= 0) break;
+    
+    read += done;
+    slot->read.store(read,std::memory_order_release);
+  }
+  
+  slot->state.store(kGone,std::memory_order_release);
+  close(out);
+}
+
+
+
+/*
+ * 
+ * Function: AttachBroadcast
+ * 
+ * Attaches the present process as a consumer of a shared-memory ring
+ * (global::attachName) written by another process with --broadcast.
+ * The bytes of the ring are fed into a pipe that replaces stdin, so
+ * that the input is then read as usual (see ProcessInput()). Waits up
+ * to a minute for the producer to create the ring and give it its size.
+ * 
+ * @return "true" in case of success, otherwise return "false".
+ * 
+ */
+bool AttachBroadcast()
+{
+  using namespace broadcast;
+  using std::cerr;
+  using std::endl;
+  
+  std::string name = ObjectName(global::attachName);
+  
+  // The producer creates the ring empty and then sizes it
+  int fd = -1;
+  struct stat st;
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(kAttachWait);
+  while (true)
+  {
+    fd = shm_open(name.c_str(),O_RDWR,0);
+    if (fd >= 0 && fstat(fd,&st) == 0 && st.st_size >= (off_t)sizeof(Ring)) break;
+    if (fd >= 0) close(fd);
+    fd = -1;
+    if (std::chrono::steady_clock::now() >= deadline) break;
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+  if (fd < 0)
+  {
+    cerr << "Unable to attach to broadcast ring " << name << "!" << endl;
+    return false;
+  }
+  void *shared = mmap(nullptr,st.st_size,PROT_READ|PROT_WRITE,MAP_SHARED,fd,0);
+  close(fd);
+  if (shared == MAP_FAILED)
+  {
+    cerr << "Unable to map broadcast ring " << name << "!" << endl;
+    return false;
+  }
+  
+  // The producer may still be setting the ring up
+  Ring *ring = (Ring *)shared;
+  for (int i=0; i<100 && ring->magic.load(std::memory_order_acquire)!=kMagic; i++)
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  if (ring->magic.load(std::memory_order_acquire) != kMagic || sizeof(Ring)+ring->capacity > (unsigned long long)st.st_size)
+  {
+    cerr << "Broadcast ring " << name << " is not valid!" << endl;
+    return false;
+  }
+  
+  Slot *slot = nullptr;
+  for (int i=0; i<ring->nConsumers && slot==nullptr; i++)
+  {
+    int state = kFree;
+    if (ring->slots[i].state.compare_exchange_strong(state,kAttached)) slot = &ring->slots[i];
+  }
+  if (slot == nullptr)
+  {
+    cerr << "Broadcast ring " << name << " already has its " << ring->nConsumers << " consumer(s)!" << endl;
+    return false;
+  }
+  slot->pid = getpid();
+  slot->read.store(0);
+  
+  int pipeFds[2];
+  if (pipe(pipeFds) != 0 || dup2(pipeFds[0],STDIN_FILENO) < 0)
+  {
+    cerr << "Unable to read from broadcast ring " << name << "!" << endl;
+    slot->state.store(kGone);
+    return false;
+  }
+  close(pipeFds[0]);
+  fcntl(pipeFds[1],F_SETPIPE_SZ,1<<20); // Fewer wake-ups, if allowed
+  
+  // Counted last, once the slot is ready
+  ring->nAttached.fetch_add(1,std::memory_order_release);
+  
+  std::thread(FeedConsumer,ring,slot,pipeFds[1]).detach();
+  return true;
+}
@@ -0,0 +1,650 @@
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <string>
+#include <set>
+#include <sstream>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <zlib.h>
+
+#include <EventIO.hh>
+
+#include <iact-reader.h>
+#include <analyzeBunches.h>
+#include <atmosphericTransmission.h>
+#include <eventSelection.h>
+#include <streaming.h>
+#include <makeHeader.h>
+#include <analysisConfig.h>
+#include <metrics.h>
+#include <bunchCache.h>
+#include <outputFiles.h>
+#include <outputBackend.h>
+
+/*
+ * 
+ * The namespace bunchCache keeps the state of the bunch cache being
+ * written and describes its format. Only visible within the present
+ * translation unit.
+ * 
+ * A bunch cache starts with a file header, with the selection of events
+ * and telescopes it was written with, followed by a sequence of records,
+ * each made of a record header and its payload:
+ * 
+ *   1200, 1202, 1209, 1210  CORSIKA run/event header/end (274 floats)
+ *   1201                    Telescope positions (count = number of
+ *                           telescopes, then x, y, z and r arrays)
+ *   1205                    Start of the bunches of one telescope
+ *                           (array, telescope, photon sum, bunches)
+ *   1                       Chunk of bunches of the last telescope
+ *                           (count = bunches), zlib compressed, with
+ *                           the 8 bunch values stored column by column
+ * 
+ * Values are stored in native byte order.
+ * 
+ */
+namespace bunchCache
+{
+  const char     magic[8]     = {'I','A','C','T','B','C','0','1'};
+  const uint32_t version      = 2;
+  const int      kChunk       = 1;    // Record type of bunch chunks
+  const long     chunkBunches = 65536;
+  
+  struct FileHeader
+  {
+    char     magic[8];
+    uint32_t version;
+    uint32_t chunkBunches;
+    int32_t  maxEvents;       // Events written at most (0: all)
+    char     selection[512];  // Cuts of the events written (see SelectionCuts())
+    char     telescopes[512]; // Telescopes written ("": all)
+  };
+  
+  struct RecordHeader
+  {
+    uint32_t type;
+    uint32_t count;
+    uint64_t size;   // Size of the payload (bytes)
+  };
+  
+  struct Telescope
+  {
+    int16_t  arrayNumber;
+    int16_t  telNumber;
+    float    photonSum;
+    int32_t  nBunches;
+  };
+  
+  FILE                 *file = nullptr;
+  std::string           fileName;
+  bool                  ok = true;
+  std::vector<int16_t>  pending;      // Bunches of the current chunk (8 int16 per bunch)
+  std::vector<int16_t>  columns;      // Same bunches, column by column
+  std::vector<Bytef>    compressed;
+};
+
+
+
+/*
+ * 
+ * Function: WriteRecord
+ * 
+ * Writes a record (header and payload) to the bunch cache.
+ * 
+ * @param  type     Record type
+ * @param  count    Number of elements in the record
+ * @param  payload  Record data
+ * @param  size     Size of the record data (bytes)
+ * @return (none)
+ * 
+ */
+static void WriteRecord(int type, uint32_t count, const void *payload, uint64_t size)
+{
+  bunchCache::RecordHeader header = {(uint32_t)type, count, size};
+  if (fwrite(&header,sizeof(header),1,bunchCache::file)!=1) bunchCache::ok = false;
+  if (size>0 && fwrite(payload,size,1,bunchCache::file)!=1) bunchCache::ok = false;
+}
+
+
+
+/*
+ * 
+ * Function: FlushChunk
+ * 
+ * Compresses the pending bunches, column by column, and writes them to
+ * the bunch cache as one chunk.
+ * 
+ * @return (none)
+ * 
+ */
+static void FlushChunk()
+{
+  long n = bunchCache::pending.size()/8;
+  if (n == 0) return;
+  
+  // Bunch values of the same kind compress better together
+  bunchCache::columns.resize(8*n);
+  for (int c=0; c<8; c++)
+    for (long i=0; i<n; i++) bunchCache::columns[c*n+i] = bunchCache::pending[8*i+c];
+  
+  uLongf size = compressBound(16*n);
+  bunchCache::compressed.resize(size);
+  if (compress2(bunchCache::compressed.data(),&size,(const Bytef*)bunchCache::columns.data(),16*n,1) != Z_OK)
+  {
+    std::cerr << "Unable to compress bunches for cache " << bunchCache::fileName << std::endl;
+    bunchCache::ok = false;
+  }
+  else WriteRecord(bunchCache::kChunk,n,bunchCache::compressed.data(),size);
+  
+  bunchCache::pending.clear();
+}
+
+
+
+/*
+ * 
+ * Function: WantedTelescopes
+ * 
+ * Telescopes analyzed by any configuration, as a list of telescope
+ * numbers and ranges (see TelescopeDefinition::SetUserIDs()).
+ * 
+ * @return List of telescopes ("" if all of them are analyzed)
+ * 
+ */
+static std::string WantedTelescopes()
+{
+  std::string list;
+  for (const AnalysisConfig &config : global::configs)
+  {
+    std::string own = config.onlyTelescopes!="" ? config.onlyTelescopes : global::onlyTelescopes;
+    if (own == "") return "";
+    list += (list=="" ? "" : ",") + own;
+  }
+  return list;
+}
+
+
+
+/*
+ * 
+ * Function: TelescopeSet
+ * 
+ * Telescope numbers of a list of telescopes and ranges, e.g. "1,3-5".
+ * 
+ * @param  list  List of telescopes
+ * @return Telescope numbers
+ * 
+ */
+static std::set<int> TelescopeSet(std::string list)
+{
+  std::set<int> numbers;
+  std::istringstream stream(list);
+  std::string part;
+  while (std::getline(stream,part,','))
+  {
+    size_t dash  = part.find('-');
+    int    first = atoi(part.c_str());
+    int    last  = dash==std::string::npos ? first : atoi(part.c_str()+dash+1);
+    for (int i=first; i<=last; i++) numbers.insert(i);
+  }
+  return numbers;
+}
+
+
+
+/*
+ * 
+ * Function: CheckCacheSelection
+ * 
+ * Warns if the events or telescopes asked for are not all in a bunch
+ * cache, because it was written with a narrower selection: they would
+ * be missing from the analysis.
+ * 
+ * @param  header  File header of the cache
+ * @param  name    Cache file name
+ * @return (none)
+ * 
+ */
+static void CheckCacheSelection(const bunchCache::FileHeader &header, std::string name)
+{
+  using std::cerr;
+  using std::endl;
+  
+  std::string selection(header.selection,strnlen(header.selection,sizeof(header.selection)));
+  std::string telescopes(header.telescopes,strnlen(header.telescopes,sizeof(header.telescopes)));
+  
+  if (header.maxEvents>0 && (global::nMaxEvents<=0 || global::nMaxEvents>header.maxEvents))
+    cerr << "Warning: bunch cache " << name << " only has the first " << header.maxEvents << " events" << endl;
+  
+  if (!SelectionWithin(selection))
+    cerr << "Warning: bunch cache " << name << " only has the bunches of events passing \"" << selection << "\", others are analyzed as empty" << endl;
+  
+  if (telescopes != "")
+  {
+    std::set<int> written = TelescopeSet(telescopes);
+    std::set<int> wanted  = TelescopeSet(WantedTelescopes());
+    bool missing = wanted.empty();
+    for (int tel : wanted) if (written.count(tel) == 0) missing = true;
+    if (missing)
+      cerr << "Warning: bunch cache " << name << " only has the bunches of telescopes " << telescopes << ", others are analyzed as empty" << endl;
+  }
+}
+
+
+
+/*
+ * 
+ * Function: OpenBunchCache
+ * 
+ * Creates the bunch cache where all data needed to analyze the input
+ * again (headers, telescope positions and bunches of the analyzed
+ * telescopes) are written while it is converted. The selection of
+ * events (-m, --select, --events) and telescopes is stored in its
+ * header (see CheckCacheSelection()).
+ * 
+ * @param  name  Cache file name
+ * @return "true" in case of success, "false" otherwise.
+ * 
+ */
+bool OpenBunchCache(std::string name)
+{
+  // The selection is kept, to tell which events and telescopes are missing
+  std::string selection  = global::selectEvents ? SelectionCuts() : "";
+  std::string telescopes = WantedTelescopes();
+  
+  bunchCache::FileHeader header = bunchCache::FileHeader();
+  if (selection.size() >= sizeof(header.selection) || telescopes.size() >= sizeof(header.telescopes))
+  {
+    std::cerr << "Event or telescope selection too long to be stored in bunch cache " << name << std::endl;
+    return false;
+  }
+  
+  bunchCache::fileName = name;
+  bunchCache::file = fopen(name.c_str(),"wb");
+  if (bunchCache::file == nullptr)
+  {
+    std::cerr << "Unable to create bunch cache " << name << std::endl;
+    return false;
+  }
+  
+  bunchCache::ok = true;
+  bunchCache::pending.clear();
+  bunchCache::pending.reserve(8*bunchCache::chunkBunches);
+  
+  memcpy(header.magic,bunchCache::magic,8);
+  header.version      = bunchCache::version;
+  header.chunkBunches = bunchCache::chunkBunches;
+  header.maxEvents    = global::nMaxEvents>0 ? global::nMaxEvents : 0;
+  strcpy(header.selection,selection.c_str());
+  strcpy(header.telescopes,telescopes.c_str());
+  if (fwrite(&header,sizeof(header),1,bunchCache::file)!=1) bunchCache::ok = false;
+  
+  return bunchCache::ok;
+}
+
+
+
+/*
+ * 
+ * Function: CacheCorsikaBlock
+ * 
+ * Writes a CORSIKA header or end block to the bunch cache.
+ * 
+ * @param  type   Block type (1200, 1202, 1209 or 1210)
+ * @param  block  Block contents
+ * @return (none)
+ * 
+ */
+void CacheCorsikaBlock(int type, CorsikaBlock &block)
+{
+  if (bunchCache::file == nullptr) return;
+  FlushChunk();
+  WriteRecord(type,block.GetNFields(),block.GetFields(),block.GetNFields()*sizeof(float));
+}
+
+
+
+/*
+ * 
+ * Function: CacheTelescopeDefinition
+ * 
+ * Writes the telescope positions to the bunch cache.
+ * 
+ * @param  telDef  Telescope definitions
+ * @return (none)
+ * 
+ */
+void CacheTelescopeDefinition(TelescopeDefinition &telDef)
+{
+  if (bunchCache::file == nullptr) return;
+  FlushChunk();
+  
+  int n = telDef.GetN();
+  std::vector<float> values(4*n);
+  for (int i=0; i<n; i++)
+  {
+    values[i]     = telDef.GetX(i);
+    values[n+i]   = telDef.GetY(i);
+    values[2*n+i] = telDef.GetZ(i);
+    values[3*n+i] = telDef.GetR(i);
+  }
+  WriteRecord(1201,n,values.data(),values.size()*sizeof(float));
+}
+
+
+
+/*
+ * 
+ * Function: CacheTelescope
+ * 
+ * Writes the header of the bunches of one telescope to the bunch cache.
+ * Its bunches are to be given next with CacheBunches().
+ * 
+ * @param  arrayNumber  Array number
+ * @param  telNumber    Telescope number
+ * @param  photonSum    Sum of photons in the block
+ * @param  nBunches     Number of bunches of the telescope
+ * @return (none)
+ * 
+ */
+void CacheTelescope(int16_t arrayNumber, int16_t telNumber, float photonSum, int32_t nBunches)
+{
+  if (bunchCache::file == nullptr) return;
+  FlushChunk();
+  
+  bunchCache::Telescope tel = {arrayNumber, telNumber, photonSum, nBunches};
+  WriteRecord(1205,1,&tel,sizeof(tel));
+}
+
+
+
+/*
+ * 
+ * Function: CacheBunches
+ * 
+ * Adds bunches of the current telescope to the bunch cache, which are
+ * written in chunks of a fixed number of bunches.
+ * 
+ * @param  bunches   Bunch data (8 int16 per bunch)
+ * @param  nBunches  Number of bunches
+ * @return (none)
+ * 
+ */
+void CacheBunches(const int16_t *bunches, long nBunches)
+{
+  if (bunchCache::file == nullptr) return;
+  
+  while (nBunches > 0)
+  {
+    long n = std::min(nBunches,bunchCache::chunkBunches-(long)bunchCache::pending.size()/8);
+    bunchCache::pending.insert(bunchCache::pending.end(),bunches,bunches+8*n);
+    bunches  += 8*n;
+    nBunches -= n;
+    if ((long)bunchCache::pending.size() == 8*bunchCache::chunkBunches) FlushChunk();
+  }
+}
+
+
+
+/*
+ * 
+ * Function: CloseBunchCache
+ * 
+ * Writes the pending bunches and closes the bunch cache.
+ * 
+ * @return "true" if the whole cache was written, "false" otherwise.
+ * 
+ */
+bool CloseBunchCache()
+{
+  if (bunchCache::file == nullptr) return true;
+  FlushChunk();
+  if (fclose(bunchCache::file) != 0) bunchCache::ok = false;
+  bunchCache::file = nullptr;
+  
+  if (!bunchCache::ok) std::cerr << "Error writing bunch cache " << bunchCache::fileName << std::endl;
+  return bunchCache::ok;
+}
+
+
+
+/*
+ * 
+ * Function: IsBunchCache
+ * 
+ * Tells whether a file is a bunch cache (by its magic number).
+ * 
+ * @param  name  File name
+ * @return "true" if the file is a bunch cache, "false" otherwise.
+ * 
+ */
+bool IsBunchCache(std::string name)
+{
+  char magic[8];
+  FILE *f = fopen(name.c_str(),"rb");
+  if (f == nullptr) return false;
+  bool isCache = fread(magic,8,1,f)==1 && memcmp(magic,bunchCache::magic,8)==0;
+  fclose(f);
+  return isCache;
+}
+
+
+
+/*
+ * 
+ * Function: DecodeColumns
+ * 
+ * Puts the 8 values of each bunch of a chunk, stored column by column,
+ * back together. Each pass of the loop writes one whole bunch from the
+ * 8 columns, without branches, so that the compiler turns it into
+ * vector loads and shuffles.
+ * 
+ * @param  columns  First value of the first column
+ * @param  stride   Distance between columns (bunches in the chunk)
+ * @param  bunches  Output: bunches (8 int16 per bunch)
+ * @param  n        Number of bunches
+ * @return (none)
+ * 
+ */
+static void DecodeColumns(const int16_t *columns, long stride, int16_t *bunches, long n)
+{
+  const int16_t *c0 = columns,     *c1 = c0 + stride, *c2 = c1 + stride, *c3 = c2 + stride;
+  const int16_t *c4 = c3 + stride,  *c5 = c4 + stride, *c6 = c5 + stride, *c7 = c6 + stride;
+  
+  for (long i=0; i<n; i++)
+  {
+    int16_t *b = bunches + 8*i;
+    b[0] = c0[i]; b[1] = c1[i]; b[2] = c2[i]; b[3] = c3[i];
+    b[4] = c4[i]; b[5] = c5[i]; b[6] = c6[i]; b[7] = c7[i];
+  }
+}
+
+
+
+/*
+ * 
+ * Function: ReadBunchCache
+ * 
+ * Analyzes a bunch cache as if it were the original IACT file. The
+ * cache is memory mapped and each chunk of bunches is decompressed and
+ * decoded, column by column, straight into the bunch window used by
+ * the analysis. Longitudinal profiles and CORSIKA inputs are not part
+ * of the cache.
+ * 
+ * @param  name        Cache file name
+ * @param  outputFile  Output file (replaced if the output rolls over)
+ * @return Number of events analyzed, or -1 in case of errors
+ * 
+ */
+int ReadBunchCache(std::string name, std::unique_ptr<OutputFile> &outputFile)
+{
+  using std::cerr;
+  using std::endl;
+  
+  int fd = open(name.c_str(),O_RDONLY);
+  if (fd < 0) { cerr << "Unable to open bunch cache " << name << endl; return -1; }
+  
+  struct stat st;
+  if (fstat(fd,&st)!=0 || (size_t)st.st_size<sizeof(bunchCache::FileHeader)) { close(fd); cerr << "Invalid bunch cache " << name << endl; return -1; }
+  
+  void *map = mmap(nullptr,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+  close(fd);
+  if (map == MAP_FAILED) { cerr << "Unable to map bunch cache " << name << endl; return -1; }
+  madvise(map,st.st_size,MADV_SEQUENTIAL);
+  
+  const char *data = (const char*)map;
+  const char *end  = data + st.st_size;
+  
+  const bunchCache::FileHeader *fileHeader = (const bunchCache::FileHeader*)data;
+  if (fileHeader->version != bunchCache::version)
+  {
+    cerr << "Unsupported bunch cache version " << fileHeader->version << " in " << name << endl;
+    munmap(map,st.st_size);
+    return -1;
+  }
+  CheckCacheSelection(*fileHeader,name);
+  data += sizeof(bunchCache::FileHeader);
+  
+  if (global::saveLongi || global::fitModel!="") cerr << "Longitudinal profiles are not available from bunch cache " << name << endl;
+  if (global::peMode!="") cerr << "Photo-electrons are not available from bunch cache " << name << endl;
+  
+  std::vector<int16_t> columns;
+  std::vector<float>   fields;
+  
+  int  iEvt       = 0;
+  bool firstEvent = true;
+  bool skipEvent  = false;
+  bool inEvent    = false; // Bunch stream of the current event started
+  bool telActive  = false; // Current telescope is analyzed
+  bool error      = false;
+  
+  while (data+sizeof(bunchCache::RecordHeader) <= end && !error)
+  {
+    bunchCache::RecordHeader header;
+    memcpy(&header,data,sizeof(header));
+    data += sizeof(header);
+    if (header.size > (uint64_t)(end-data)) { error = true; break; }
+    const char *payload = data;
+    data += header.size;
+    
+    MetricsAdd(metrics::kBlocks,1);
+    MetricsAdd(metrics::kInputBytes,sizeof(header)+header.size);
+    
+    ShowProgress(header.type);
+    
+    // Copy of the payload as floats (for headers and positions)
+    if (header.type>=1200 && header.type<=1210 && header.type!=1205)
+    {
+      fields.assign(std::max<size_t>(header.size/sizeof(float),global::corHeader.GetNFields()),0.f);
+      memcpy(fields.data(),payload,header.size/sizeof(float)*sizeof(float));
+    }
+    
+    switch (header.type)
+    {
+      case 1200: /// CORSIKA run header
+        global::corHeader.SetFields(fields.data());
+        break;
+      case 1201: /// Position and sizes of telescopes
+      {
+        int n = header.count;
+        if (header.size < 4*n*sizeof(float)) { error = true; break; }
+        global::telDef.SetPositions(n,fields.data(),fields.data()+n,fields.data()+2*n,fields.data()+3*n);
+        if (global::onlyTelescopes!="")
+          global::telDef.SetUserIDs(global::onlyTelescopes);
+        SetConfigTelescopes();
+        if (global::dumpTelPos)
+        {
+          global::telDef.DumpPositions();
+          data = end;
+        }
+        break;
+      }
+      case 1202: /// CORSIKA event header
+        if (iEvt>=global::nMaxEvents && global::nMaxEvents>0) { data = end; break; }
+        global::thisEvent.SetFields(fields.data());
+        if (global::expectedTrans && !SetExpectedTransmission(global::thisEvent.GetMinWaveLength(),global::thisEvent.GetMaxWaveLength())) { munmap(map,st.st_size); return -1; }
+        if (!RollOutputIfFull(outputFile,firstEvent)) { munmap(map,st.st_size); return -1; }
+        if (firstEvent) makeHeader(outputFile.get());
+        firstEvent = false;
+        skipEvent = global::selectEvents && !SelectEvent();
+        FillEventTable(!skipEvent);
+        if (!skipEvent) AddOutputEvent(global::thisEvent.GetEventNumber());
+        if (!skipEvent) iEvt++;
+        if (!skipEvent) MetricsAdd(metrics::kEvents,1);
+        MetricsSet(metrics::kCurrentEvent,global::thisEvent.GetEventNumber());
+        inEvent   = false;
+        telActive = false;
+        break;
+      case 1205: /// Bunches of one telescope
+      {
+        bunchCache::Telescope tel;
+        if (header.size < sizeof(tel)) { error = true; break; }
+        memcpy(&tel,payload,sizeof(tel));
+        if (skipEvent) { telActive = false; break; }
+        if (!inEvent) { ShowProgress(1204); BeginBunchStream(outputFile.get()); inEvent = true; }
+        telActive = BeginStreamTelescope(tel.telNumber);
+        break;
+      }
+      case bunchCache::kChunk: /// Compressed bunches of the current telescope
+      {
+        if (!telActive) break;
+        long  n    = header.count;
+        uLongf size = 16*n;
+        columns.resize(8*n);
+        if (uncompress((Bytef*)columns.data(),&size,(const Bytef*)payload,header.size)!=Z_OK || size!=(uLongf)(16*n))
+        {
+          error = true;
+          break;
+        }
+        
+        // Decode the columns into the bunch window, as much as fits at a time
+        long done = 0;
+        while (done < n)
+        {
+          long space;
+          int16_t *bunches = GetStreamSpace(space);
+          long m = std::min(space,n-done);
+          DecodeColumns(columns.data()+done,n,bunches,m);
+          AddStreamBunches(m);
+          done += m;
+        }
+        break;
+      }
+      case 1209: /// CORSIKA event end
+        if (inEvent) EndBunchStream();
+        inEvent = false;
+        global::thisEventEnd.SetFields(fields.data());
+        if (skipEvent) { skipEvent = false; break; }
+        if (global::streamMode) CommitEvent(outputFile.get(),global::thisEvent.GetEventNumber(),std::chrono::steady_clock::now());
+        break;
+      case 1210: /// CORSIKA run end
+        global::corEnd.SetFields(fields.data());
+        break;
+      default:
+        cerr << "Unknown record type " << header.type << " in bunch cache will be skiped." << endl;
+        break;
+    }
+  }
+  
+  if (inEvent) EndBunchStream();
+  munmap(map,st.st_size);
+  
+  if (error)
+  {
+    cerr << "Corrupted bunch cache " << name << endl;
+    return -1;
+  }
+  
+  return iEvt;
+}
@@ -0,0 +1,401 @@
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <utility>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+
+#include <checkpoint.h>
+#include <outputBackend.h>
+#include <trace.h>
+
+/*
+ * 
+ * Function: CommitOutput
+ * 
+ * Writes the keys list, directories and file header of the output file
+ * to disk and flushes it, so that everything written so far can be read
+ * back even if the program dies afterwards.
+ * 
+ * @param  outputFile  Output file
+ * @return Offset of the end of valid data in the output file
+ * 
+ */
+long long CommitOutput(OutputFile *outputFile)
+{
+  TraceSpan span("CommitOutput");
+  return outputFile->Commit();
+}
+
+
+
+/*
+ * 
+ * Function: WriteCheckpoint
+ * 
+ * Stores a checkpoint into a small text file. The file is first
+ * written with a temporary name and then renamed, so that a crash
+ * while writing never leaves a broken checkpoint behind.
+ * 
+ * @param  fileName  Name of the checkpoint file
+ * @param  ckpt      Checkpoint to be saved
+ * @return "true" in case of success, otherwise return "false".
+ * 
+ */
+bool WriteCheckpoint(std::string fileName, const Checkpoint &ckpt)
+{
+  std::string tmpName = fileName + ".tmp";
+  
+  std::ofstream file(tmpName);
+  if (!file.is_open())
+  {
+    std::cerr << "Unable to write checkpoint file " << tmpName << std::endl;
+    return false;
+  }
+  
+  file << "input "     << ckpt.inputFileName << "\n";
+  file << "offset "    << ckpt.inputOffset   << "\n";
+  file << "event "     << ckpt.iEvt          << "\n";
+  file << "outputEnd " << ckpt.outputEnd     << "\n";
+  file << "snapshot "  << ckpt.snapshot      << "\n";
+  file.close();
+  
+  if (file.fail() || std::rename(tmpName.c_str(),fileName.c_str())!=0)
+  {
+    std::cerr << "Unable to write checkpoint file " << fileName << std::endl;
+    return false;
+  }
+  
+  return true;
+}
+
+
+
+/*
+ * 
+ * Function: ReadCheckpoint
+ * 
+ * Reads a checkpoint written by WriteCheckpoint().
+ * 
+ * @param  fileName  Name of the checkpoint file
+ * @param  ckpt      Checkpoint to be filled
+ * @return "true" in case of success, otherwise return "false".
+ * 
+ */
+bool ReadCheckpoint(std::string fileName, Checkpoint &ckpt)
+{
+  std::ifstream file(fileName);
+  if (!file.is_open())
+  {
+    std::cerr << "Unable to open checkpoint file " << fileName << std::endl;
+    return false;
+  }
+  
+  std::string key;
+  int nKeys = 0;
+  while (file >> key)
+  {
+    if      (key == "input")     { std::getline(file >> std::ws,ckpt.inputFileName); nKeys++; }
+    else if (key == "offset")    { file >> ckpt.inputOffset;   nKeys++; }
+    else if (key == "event")     { file >> ckpt.iEvt;          nKeys++; }
+    else if (key == "outputEnd") { file >> ckpt.outputEnd;     nKeys++; }
+    else if (key == "snapshot")  { std::getline(file >> std::ws,ckpt.snapshot); nKeys++; }
+  }
+  
+  if (nKeys != 5 || ckpt.inputOffset <= 0 || ckpt.outputEnd <= 0)
+  {
+    std::cerr << "Invalid checkpoint file " << fileName << std::endl;
+    return false;
+  }
+  
+  return true;
+}
+
+
+
+/*
+ * 
+ * The namespace checkpoint keeps the state of the two snapshots of the
+ * output file used in turn by SaveCheckpoint(). Only visible within the
+ * present translation unit.
+ * 
+ */
+namespace checkpoint
+{
+  typedef std::vector<std::pair<long long,long long>> Ranges;
+  
+  Ranges changes[2];               // Ranges of the output written since each snapshot was brought up to date
+  bool   known[2] = {false,false}; // Whether those ranges are known (otherwise the whole file is copied)
+  int    next     = 0;             // Snapshot to be brought up to date next
+};
+
+
+
+/*
+ * 
+ * Function: CopyRange
+ * 
+ * Copies a range of a file to the same position of another one, within
+ * the kernel (copy_file_range()) where possible, otherwise through a
+ * buffer.
+ * 
+ * @param  in      File descriptor of the file to be copied
+ * @param  out     File descriptor of the copy
+ * @param  offset  Start of the range
+ * @param  size    Number of bytes to copy
+ * @return "true" in case of success, otherwise return "false".
+ * 
+ */
+static bool CopyRange(int in, int out, long long offset, long long size)
+{
+  while (size > 0)
+  {
+    loff_t  inOffset = offset, outOffset = offset;
+    ssize_t n = copy_file_range(in,&inOffset,out,&outOffset,size,0);
+    if (n <= 0) break;
+    offset += n;
+    size   -= n;
+  }
+  
+  std::vector<char> buffer(size > 0 ? 1<<20 : 0);
+  while (size > 0)
+  {
+    ssize_t n = pread(in,buffer.data(),size < (long long)buffer.size() ? size : buffer.size(),offset);
+    if (n <= 0) return false;
+    for (ssize_t done=0; done<n; )
+    {
+      ssize_t w = pwrite(out,buffer.data()+done,n-done,offset+done);
+      if (w <= 0) return false;
+      done += w;
+    }
+    offset += n;
+    size   -= n;
+  }
+  return true;
+}
+
+
+
+/*
+ * 
+ * Function: CopyFile
+ * 
+ * Copies a file, through a temporary name renamed at the end so that
+ * the copy is either complete or missing. The copy shares the blocks
+ * of the original where the file system allows it (reflink), otherwise
+ * the data is copied (see CopyRange()).
+ * 
+ * @param  from  Name of the file to be copied
+ * @param  to    Name of the copy
+ * @return "true" in case of success, otherwise return "false".
+ * 
+ */
+static bool CopyFile(std::string from, std::string to)
+{
+  std::string tmpName = to + ".tmp";
+  
+  int in  = open(from.c_str(),O_RDONLY);
+  int out = open(tmpName.c_str(),O_WRONLY|O_CREAT|O_TRUNC,0644);
+  struct stat st;
+  bool ok = in >= 0 && out >= 0 && fstat(in,&st) == 0;
+  
+  if (ok && ioctl(out,FICLONE,in) != 0) ok = CopyRange(in,out,0,st.st_size);
+  if (ok) ok = fsync(out) == 0;
+  if (in  >= 0) close(in);
+  if (out >= 0) ok = close(out) == 0 && ok;
+  if (ok) ok = std::rename(tmpName.c_str(),to.c_str()) == 0;
+  if (!ok)
+  {
+    std::remove(tmpName.c_str());
+    std::cerr << "Unable to copy " << from << " to " << to << std::endl;
+  }
+  return ok;
+}
+
+
+
+/*
+ * 
+ * Function: AddRanges
+ * 
+ * Adds ranges to a list of ranges, merging those that overlap or touch,
+ * so that the list stays short when the same parts of a file are written
+ * over and over.
+ * 
+ * @param  ranges  List of ranges (start, end), sorted
+ * @param  added   Ranges to be added
+ * @return (none)
+ * 
+ */
+static void AddRanges(checkpoint::Ranges &ranges, const checkpoint::Ranges &added)
+{
+  ranges.insert(ranges.end(),added.begin(),added.end());
+  std::sort(ranges.begin(),ranges.end());
+  
+  size_t n = 0;
+  for (size_t i=0; i<ranges.size(); i++)
+  {
+    if (n > 0 && ranges[i].first <= ranges[n-1].second)
+      ranges[n-1].second = std::max(ranges[n-1].second,ranges[i].second);
+    else
+      ranges[n++] = ranges[i];
+  }
+  ranges.resize(n);
+}
+
+
+
+/*
+ * 
+ * Function: UpdateSnapshot
+ * 
+ * Brings a snapshot of a file up to date in place, by copying only the
+ * ranges written since it was last updated, or the whole file if they
+ * are not known. The snapshot must not be the one of the checkpoint in
+ * place, since it is broken if the update fails halfway.
+ * 
+ * @param  from    Name of the file
+ * @param  to      Name of the snapshot
+ * @param  ranges  Ranges to be copied, or nullptr for the whole file
+ * @return "true" in case of success, otherwise return "false".
+ * 
+ */
+static bool UpdateSnapshot(std::string from, std::string to, const checkpoint::Ranges *ranges)
+{
+  int in  = open(from.c_str(),O_RDONLY);
+  int out = open(to.c_str(),O_RDWR|O_CREAT,0644);
+  struct stat st;
+  bool ok = in >= 0 && out >= 0 && fstat(in,&st) == 0;
+  
+  if (ok && ranges == nullptr)
+    ok = ioctl(out,FICLONE,in) == 0 || CopyRange(in,out,0,st.st_size);
+  else if (ok)
+  {
+    for (size_t i=0; ok && i<ranges->size(); i++)
+    {
+      long long end = std::min((long long)st.st_size,(*ranges)[i].second);
+      if ((*ranges)[i].first < end) ok = CopyRange(in,out,(*ranges)[i].first,end-(*ranges)[i].first);
+    }
+  }
+  
+  if (ok) ok = ftruncate(out,st.st_size) == 0 && fsync(out) == 0;
+  if (in  >= 0) close(in);
+  if (out >= 0) ok = close(out) == 0 && ok;
+  if (!ok) std::cerr << "Unable to copy " << from << " to " << to << std::endl;
+  return ok;
+}
+
+
+
+/*
+ * 
+ * Function: SaveCheckpoint
+ * 
+ * Commits the output file and saves a checkpoint with a snapshot of
+ * it. The output file cannot be restored by cutting it back, since the
+ * file header, keys lists and free segments below the end of its data
+ * are rewritten by later commits, so the snapshot is a copy of the
+ * whole file. Two snapshots are used in turn, and each is brought up
+ * to date with only the ranges of the output written since its last
+ * update (see UpdateSnapshot()), so that the cost of a checkpoint
+ * follows what was written since the previous ones rather than the size
+ * of the output. The whole file is copied when the ranges are not known
+ * (first checkpoints, or output backends that do not keep them).
+ * 
+ * @param  fileName        Name of the checkpoint file
+ * @param  outputFile      Output file
+ * @param  outputFileName  Name of the output file
+ * @param  ckpt            Checkpoint, with the input position and event counter set
+ * @return "true" in case of success, otherwise return "false".
+ * 
+ */
+bool SaveCheckpoint(std::string fileName, OutputFile *outputFile, std::string outputFileName, Checkpoint &ckpt)
+{
+  TraceSpan span("SaveCheckpoint");
+  using namespace checkpoint;
+  
+  ckpt.outputEnd = CommitOutput(outputFile);
+  
+  Ranges written;
+  bool   isKnown = outputFile->TakeChanges(written);
+  for (int i=0; i<2; i++)
+  {
+    if (isKnown) AddRanges(changes[i],written);
+    else         known[i] = false;
+  }
+  
+  int i = next;
+  std::string snapshot = fileName + ".snapshot" + std::to_string(i);
+  known[i] = UpdateSnapshot(outputFileName,snapshot,known[i] ? &changes[i] : nullptr);
+  if (!known[i]) return false;
+  changes[i].clear();
+  
+  std::string previous = ckpt.snapshot;
+  ckpt.snapshot = snapshot;
+  if (!WriteCheckpoint(fileName,ckpt)) return false;
+  
+  // Snapshot of a checkpoint from an earlier version
+  if (previous != "" && previous != snapshot && previous != fileName + ".snapshot" + std::to_string(1-i))
+    std::remove(previous.c_str());
+  next = 1 - i;
+  return true;
+}
+
+
+
+/*
+ * 
+ * Function: RestoreCheckpoint
+ * 
+ * Puts back the output file as it was at a checkpoint, from its
+ * snapshot.
+ * 
+ * @param  outputFileName  Name of the output file
+ * @param  ckpt            Checkpoint
+ * @return "true" in case of success, otherwise return "false".
+ * 
+ */
+bool RestoreCheckpoint(std::string outputFileName, const Checkpoint &ckpt)
+{
+  struct stat st;
+  if (stat(ckpt.snapshot.c_str(),&st) != 0 || st.st_size != ckpt.outputEnd)
+  {
+    std::cerr << "Missing or broken output snapshot " << ckpt.snapshot << std::endl;
+    return false;
+  }
+  
+  // The snapshot of the checkpoint is kept as it is until the next one
+  // is in place
+  size_t n = ckpt.snapshot.size();
+  checkpoint::next = n > 0 && ckpt.snapshot[n-1] == '0' ? 1 : 0;
+  return CopyFile(ckpt.snapshot,outputFileName);
+}
+
+
+
+/*
+ * 
+ * Function: RemoveCheckpoint
+ * 
+ * Removes a checkpoint file and its output snapshots, once the run is
+ * complete.
+ * 
+ * @param  fileName  Name of the checkpoint file
+ * @param  ckpt      Last checkpoint (its snapshot may be empty)
+ * @return (none)
+ * 
+ */
+void RemoveCheckpoint(std::string fileName, const Checkpoint &ckpt)
+{
+  std::remove(fileName.c_str());
+  std::remove((fileName + ".snapshot0").c_str());
+  std::remove((fileName + ".snapshot1").c_str());
+  if (ckpt.snapshot != "") std::remove(ckpt.snapshot.c_str());
+}
@@ -0,0 +1,353 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <cctype>
+
+#include <EventIO.hh>
+
+#include <iact-reader.h>
+#include <eventSelection.h>
+#include <outputBackend.h>
+
+/*
+ * 
+ * The namespace selection holds the cuts of the --select expression and
+ * the ntuple with one entry per event. Only visible within the present
+ * translation unit.
+ * 
+ */
+namespace selection
+{
+  enum Variable { kID, kEnergy, kZenith, kAzimuth, kEvent };
+  enum Operator { kLess, kLessEqual, kGreater, kGreaterEqual, kEqual, kNotEqual };
+  
+  struct Cut
+  {
+    Variable var;
+    Operator op;
+    double   value;
+  };
+  
+  std::vector<Cut> cuts;
+  
+  OutputTable *eventTuple = nullptr;
+};
+
+
+
+/*
+ * 
+ * Function: EventVariable
+ * 
+ * Value of a selection variable for the current event, in the same
+ * units as the output header: primary ID (CORSIKA code), energy (TeV),
+ * zenith and azimuth angles (deg, azimuth within 0-360) and event
+ * number.
+ * 
+ * @param  var  Selection variable
+ * @return Value of the variable
+ * 
+ */
+static double EventVariable(selection::Variable var)
+{
+  double azimuth;
+  switch (var)
+  {
+    case selection::kID:      return global::thisEvent.GetPrimaryID();
+    case selection::kEnergy:  return global::thisEvent.GetField(4)*0.001;
+    case selection::kZenith:  return global::thisEvent.GetZenithAngle()*180/M_PI;
+    case selection::kAzimuth:
+      azimuth = global::thisEvent.GetAzimuthAngle()*180/M_PI;
+      while (azimuth<0)   azimuth+=360;
+      while (azimuth>360) azimuth-=360;
+      return azimuth;
+    case selection::kEvent:   return global::thisEvent.GetEventNumber();
+  }
+  return 0;
+}
+
+
+
+/*
+ * 
+ * Function: ParseSelection
+ * 
+ * Parses an event selection expression: comparisons joined by "&&",
+ * e.g. "energy>=1 && energy<10 && zenith<30 && id==1". Variables are
+ * id, energy, zenith, azimuth and event; operators are <, <=, >, >=,
+ * == and !=.
+ * 
+ * @param  expression  Selection expression
+ * @return "true" if the expression is valid, "false" otherwise.
+ * 
+ */
+bool ParseSelection(std::string expression)
+{
+  using namespace std;
+  
+  selection::cuts.clear();
+  
+  // Remove spaces
+  string expr;
+  for (char c : expression) if (!isspace(c)) expr += c;
+  
+  size_t begin = 0;
+  while (begin <= expr.size())
+  {
+    size_t end = expr.find("&&",begin);
+    if (end == string::npos) end = expr.size();
+    string term = expr.substr(begin,end-begin);
+    begin = end+2;
+    
+    // Find the operator
+    size_t pos = term.find_first_of("<>=!");
+    if (pos == string::npos || pos == 0)
+    {
+      cerr << "Invalid selection term \"" << term << "\"" << endl;
+      return false;
+    }
+    string name = term.substr(0,pos);
+    string op   = term.substr(pos, term.size()>pos+1 && term[pos+1]=='=' ? 2 : 1);
+    string val  = term.substr(pos+op.size());
+    
+    selection::Cut cut;
+    
+    if      (name == "id")      cut.var = selection::kID;
+    else if (name == "energy")  cut.var = selection::kEnergy;
+    else if (name == "zenith")  cut.var = selection::kZenith;
+    else if (name == "azimuth") cut.var = selection::kAzimuth;
+    else if (name == "event")   cut.var = selection::kEvent;
+    else
+    {
+      cerr << "Unknown selection variable \"" << name << "\" (use id, energy, zenith, azimuth or event)" << endl;
+      return false;
+    }
+    
+    if      (op == "<")  cut.op = selection::kLess;
+    else if (op == "<=") cut.op = selection::kLessEqual;
+    else if (op == ">")  cut.op = selection::kGreater;
+    else if (op == ">=") cut.op = selection::kGreaterEqual;
+    else if (op == "==") cut.op = selection::kEqual;
+    else if (op == "!=") cut.op = selection::kNotEqual;
+    else
+    {
+      cerr << "Invalid selection operator in \"" << term << "\"" << endl;
+      return false;
+    }
+    
+    istringstream stream(val);
+    if (!(stream >> cut.value) || !stream.eof())
+    {
+      cerr << "Invalid selection value in \"" << term << "\"" << endl;
+      return false;
+    }
+    
+    selection::cuts.push_back(cut);
+  }
+  
+  return true;
+}
+
+
+
+/*
+ * 
+ * Function: AddEventRange
+ * 
+ * Adds a range of event numbers to the selection (on top of the cuts
+ * of the selection expression, if any): "first-last", "first-" or a
+ * single event number.
+ * 
+ * @param  range  Range of event numbers
+ * @return "true" if the range is valid, "false" otherwise.
+ * 
+ */
+bool AddEventRange(std::string range)
+{
+  using namespace std;
+  
+  size_t dash  = range.find('-');
+  string first = range.substr(0,dash);
+  string last  = dash == string::npos ? first : range.substr(dash+1);
+  
+  selection::Cut cut;
+  cut.var = selection::kEvent;
+  
+  istringstream stream(first);
+  if (!(stream >> cut.value) || !stream.eof())
+  {
+    cerr << "Invalid event range \"" << range << "\"" << endl;
+    return false;
+  }
+  cut.op = selection::kGreaterEqual;
+  selection::cuts.push_back(cut);
+  
+  if (last == "") return true;
+  stream.clear();
+  stream.str(last);
+  if (!(stream >> cut.value) || !stream.eof())
+  {
+    cerr << "Invalid event range \"" << range << "\"" << endl;
+    return false;
+  }
+  cut.op = selection::kLessEqual;
+  selection::cuts.push_back(cut);
+  
+  return true;
+}
+
+
+
+/*
+ * 
+ * Function: SelectEvent
+ * 
+ * Applies the selection to the current event header.
+ * 
+ * @return "true" if the event passes all cuts (or there are no cuts).
+ * 
+ */
+bool SelectEvent()
+{
+  for (const selection::Cut &cut : selection::cuts)
+  {
+    double x = EventVariable(cut.var);
+    bool pass = false;
+    switch (cut.op)
+    {
+      case selection::kLess:         pass = x <  cut.value; break;
+      case selection::kLessEqual:    pass = x <= cut.value; break;
+      case selection::kGreater:      pass = x >  cut.value; break;
+      case selection::kGreaterEqual: pass = x >= cut.value; break;
+      case selection::kEqual:        pass = x == cut.value; break;
+      case selection::kNotEqual:     pass = x != cut.value; break;
+    }
+    if (!pass) return false;
+  }
+  return true;
+}
+
+
+
+/*
+ * 
+ * Function: SelectionCuts
+ * 
+ * Text of the cuts of the selection (with those of the event range),
+ * each one written as "variable operator value" and joined by "&&",
+ * in the same way for equal cuts.
+ * 
+ * @return Cuts of the selection ("" if there are none)
+ * 
+ */
+std::string SelectionCuts()
+{
+  const char *names[]     = {"id", "energy", "zenith", "azimuth", "event"};
+  const char *operators[] = {"<", "<=", ">", ">=", "==", "!="};
+  
+  std::string text;
+  for (const selection::Cut &cut : selection::cuts)
+  {
+    std::ostringstream term;
+    term.precision(17);
+    term << names[cut.var] << operators[cut.op] << cut.value;
+    text += (text=="" ? "" : "&&") + term.str();
+  }
+  return text;
+}
+
+
+
+/*
+ * 
+ * Function: SelectionWithin
+ * 
+ * Tells whether the events passing the selection all pass some given
+ * cuts too, which is the case if each of them is one of the cuts of the
+ * selection.
+ * 
+ * @param  cuts  Cuts, as given by SelectionCuts()
+ * @return "true" if the selection is within the cuts, "false" otherwise.
+ * 
+ */
+bool SelectionWithin(std::string cuts)
+{
+  std::string own = "&&" + SelectionCuts() + "&&";
+  
+  size_t begin = 0;
+  while (begin < cuts.size())
+  {
+    size_t end = cuts.find("&&",begin);
+    if (end == std::string::npos) end = cuts.size();
+    if (own.find("&&" + cuts.substr(begin,end-begin) + "&&") == std::string::npos) return false;
+    begin = end+2;
+  }
+  return true;
+}
+
+
+
+/*
+ * 
+ * Function: InitEventTable
+ * 
+ * Creates (or retrieves, when resuming) the ntuple with the header of
+ * each event in the output file.
+ * 
+ * @param  outputFile  Output file
+ * @return (none)
+ * 
+ */
+void InitEventTable(OutputFile *outputFile)
+{
+  selection::eventTuple = outputFile->GetTable("Events","runNumber:event:primaryID:primaryEnergyTeV:primaryTheta:primaryPhi:selected");
+}
+
+
+
+/*
+ * 
+ * Function: FillEventTable
+ * 
+ * Adds the header of the current event to the ntuple.
+ * 
+ * @param  selected  Whether the event passed the selection
+ * @return (none)
+ * 
+ */
+void FillEventTable(bool selected)
+{
+  if (selection::eventTuple == nullptr) return;
+  
+  float values[7] = {
+    (float)global::corHeader.GetRunNumber(),
+    (float)EventVariable(selection::kEvent),
+    (float)EventVariable(selection::kID),
+    (float)EventVariable(selection::kEnergy),
+    (float)EventVariable(selection::kZenith),
+    (float)EventVariable(selection::kAzimuth),
+    (float)selected
+  };
+  selection::eventTuple->Fill(values);
+}
+
+
+
+/*
+ * 
+ * Function: WriteEventTable
+ * 
+ * Writes the ntuple to the output file. Must be called before the
+ * output file is closed.
+ * 
+ * @return (none)
+ * 
+ */
+void WriteEventTable()
+{
+  if (selection::eventTuple == nullptr) return;
+  selection::eventTuple->Write();
+  selection::eventTuple = nullptr;
+}
@@ -2,10 +2,36 @@
 #include <sstream>
 #include <string>
 #include <iterator>
+#include <fstream>
+
+#include <glob.h>
 
 #include <EventIO.hh>
 
 #include <iact-reader.h>
+#include <eventSelection.h>
+#include <analysisConfig.h>
+#include <profileFits.h>
+#include <memoryBudget.h>
+
+/*
+ * 
+ * Function: AddInputFiles
+ * 
+ * Expands a (possibly wildcarded) file name pattern and appends the
+ * matching files to the list of input files.
+ * 
+ * @param  pattern  File name or glob pattern
+ * @return (none)
+ * 
+ */
+static void AddInputFiles(std::string pattern)
+{
+  glob_t matches;
+  if (glob(pattern.c_str(),GLOB_NOCHECK,nullptr,&matches)==0)
+    for (size_t i=0; i<matches.gl_pathc; i++) global::inputFiles.push_back(matches.gl_pathv[i]);
+  globfree(&matches);
+}
 
 bool GetOptions(int argc, char** argv)
 {
@@ -57,43 +83,149 @@ bool GetOptions(int argc, char** argv)
         cout << "Command line options are:" << endl;
         cout << endl;
         cout << "\t-i input.iact                \tCORSIKA IACT input file name (leavy empty for stdin) [default: stdin]" << endl;
-        cout << "\t-o output.root               \tROOT output file name [default: output.root]" << endl;
-        //~ cout << "\t-a atmtrans.dat              \tAtmospheric transmission data file name [default: atmtrans/atm_trans_2150_1_10_0_0_2150.dat]" << endl;
+        cout << "\t                             \tMay be repeated or be a quoted glob pattern (\"run*.iact\") to process many files" << endl;
+        cout << "\t--input-list files.txt       \tRead input file names (one per line) from a list file" << endl;
+        cout << "\t-j njobs                     \tNumber of worker processes for many input files [default: 1]" << endl;
+        cout << "\t--split-output               \tWrite one output per input file instead of a merged output" << endl;
+        cout << "\t-t nthreads                  \tNumber of threads analyzing photon bunches [default: 1]" << endl;
+        cout << "\t--verify-kernel              \tAnalyze bunches with the reference path too and check that the results are the same" << endl;
+        cout << "\t--chunk-size nbunches        \tNumber of bunches per analysis task [default: 262144]" << endl;
+        cout << "\t--window nbunches            \tBunches analyzed at a time; larger array blocks are streamed from the input, 0 not to stream them [default: 4194304]" << endl;
+        cout << "\t-o output.root               \tOutput file name (a directory of arrays with --format npy) [default: output.root]" << endl;
+        cout << "\t--format root|npy            \tOutput format: ROOT file or NumPy arrays [default: root]" << endl;
+        cout << "\t-a atmtrans.dat[:p],...      \tAtmospheric transmission data file name(s) [default: atmtrans/atm_trans_2150_1_10_0_0_2150.dat]" << endl;
+        cout << "\t                             \tSeveral tables are interpolated by their parameter p (required with several tables)" << endl;
+        cout << "\t--atm-param p                \tTable parameter of the atmosphere to use for the whole run when several tables are given" << endl;
+        cout << "\t--expected-transmission      \tAlso write histograms of detected photons, weighting bunches by their survival probability" << endl;
+        cout << "\t                             \taveraged over the Cherenkov spectrum (uses the atmospheric transmission data of -a)" << endl;
         cout << "\t-m maxevents                 \tMaximum number of events to analyze [default: unlimited]" << endl;
+        cout << "\t--select \"expr\"              \tAnalyze only events passing cuts joined by &&, e.g. \"energy>=1 && zenith<30 && id==1\"" << endl;
+        cout << "\t                             \tVariables: id, energy (TeV), zenith, azimuth (deg), event" << endl;
+        cout << "\t--events first-last         \tAnalyze only events with numbers in this range (also \"first-\" or a single event)" << endl;
         cout << "\t-b nX:Xmin:Xmax:nY:Ymin:Ymax \t2D histogram binning options (separated by colons) [default: 100:-500:500:100:0:100]" << endl;
         cout << "\t--longi                      \tSave longitudinal profiles to output file" << endl;
+        cout << "\t--write-cache file.bcache    \tAlso write decoded bunches to a cache, which can be given as input (-i) to analyze again faster" << endl;
+        cout << "\t--summary                    \tSave a summary ntuple with photon counts and moments per telescope and event" << endl;
         cout << "\t--dump-telescopes            \tShow telescope positions and exit" << endl;
         cout << "\t--dump-inputs                \tShow CORSIKA inputs and exit" << endl;
+        cout << "\t--info                       \tSummarize the inputs from their headers (events, telescopes, bunches, block sizes," << endl;
+        cout << "\t                             \tprojected processing time) without analyzing them" << endl;
         cout << "\t--only-telescopes 1,5-10,... \tAnalyze only specific telescopes from IACT file" << endl;
+        cout << "\t--config file.cfg            \tAnalysis configurations ([name] sections with bins, only-telescopes, output),"  << endl;
+        cout << "\t                             \tall filled from a single pass over the input" << endl;
+        cout << "\t--metrics-port port          \tServe live metrics (Prometheus text format) on http://127.0.0.1:port/metrics" << endl;
+        cout << "\t--metrics-socket path        \tServe live metrics on a Unix socket instead" << endl;
+        cout << "\t--pe tel|pixel               \tDecode photo-electrons (1208 blocks), summarized per telescope or also per pixel" << endl;
+        cout << "\t--fit-profiles model         \tFit the charged and Cherenkov profiles of every event (gh, gh3: lambda fixed)" << endl;
+        cout << "\t--trace file.json            \tWrite a timeline of reads, analysis and writes (Chrome trace format)" << endl;
+        cout << "\t--slice out.iact             \tCopy the selected events and telescopes to a new IACT file instead of analyzing them" << endl;
+        cout << "\t--broadcast name             \tRead the input once and hand it over to other processes attached with --attach name" << endl;
+        cout << "\t--consumers n                \tNumber of processes attached to --broadcast [default: 1]" << endl;
+        cout << "\t--ring-size size             \tSize of the shared-memory ring of --broadcast (bytes) [default: 64 MB]" << endl;
+        cout << "\t--attach name                \tRead the input from a process running with --broadcast name instead of stdin" << endl;
+        cout << "\t--max-output-size size       \tRoll over to a new numbered output file once this size (bytes) is reached" << endl;
+        cout << "\t--events-per-file nevents    \tRoll over to a new numbered output file every nevents events" << endl;
+        cout << "\t                             \tOutput files are listed with their events in output.root.manifest" << endl;
         cout << "\t--bufsize size               \tInitial size of IO buffer (bytes)" << endl;
         cout << "\t--maxbuf  size               \tMaximum size of IO buffer (bytes)" << endl;
+        cout << "\t--memory-limit size          \tFit the IO buffer, bunch window and histograms into this size (bytes, shared by all jobs)" << endl;
+        cout << "\t--checkpoint nevents         \tSave a checkpoint, with a copy of the output, every nevents events (file input only)" << endl;
+        cout << "\t--resume                     \tResume an interrupted run from its last checkpoint" << endl;
+        cout << "\t--stream                     \tCommit the output to disk at the end of every event" << endl;
+        cout << "\t--stream-warn ms             \tReport event commits taking longer than ms, from the event end to the data on disk (not a bound) [default: 1000]" << endl;
         cout << endl;
 				return false;
 			}
 			else if (opt == "i" || opt == "input")
 			{
 				if (no_arg) missarg = true;
-				global::inputFileName = arg;
+				else AddInputFiles(arg);
 				if (has_space) i++;
 			}
+			else if (opt == "input-list")
+			{
+				if (no_arg) missarg = true;
+				ifstream list(arg);
+				if (!no_arg && !list.is_open()) { cerr << "Unable to open input list " << arg << endl; return false; }
+				string line;
+				while (getline(list,line)) if (line!="" && line[0]!='#') AddInputFiles(line);
+				if (has_space) i++;
+			}
+			else if (opt == "j" || opt == "jobs")
+			{
+				if (no_arg) missarg = true;
+				global::nJobs = stoi(arg);
+				if (has_space) i++;
+			}
+			else if (opt == "t" || opt == "threads")
+			{
+				if (no_arg) missarg = true;
+				global::nThreads = stoi(arg);
+				if (has_space) i++;
+			}
+			else if (opt == "chunk-size")
+			{
+				if (no_arg) missarg = true;
+				global::chunkSize = stol(arg);
+				if (has_space) i++;
+			}
+			else if (opt == "window")
+			{
+				if (no_arg) missarg = true;
+				global::streamWindow = stol(arg);
+				if (has_space) i++;
+			}
+			else if (opt == "split-output")
+			{
+				global::splitOutput = true;
+			}
 			else if (opt == "o" || opt == "output")
 			{
 				if (no_arg) missarg = true;
 				global::outputFileName = arg;
 				if (has_space) i++;
 			}
-			//~ else if (opt == "a" || opt == "atmtrans")
-			//~ {
-				//~ if (no_arg) missarg = true;
-				//~ global::atmTransFile = arg;
-				//~ if (has_space) i++;
-			//~ }
+			else if (opt == "format")
+			{
+				if (no_arg) missarg = true;
+				global::outputFormat = arg;
+				if (has_space) i++;
+			}
+			else if (opt == "a" || opt == "atmtrans")
+			{
+				if (no_arg) missarg = true;
+				global::atmTransFile = arg;
+				global::useAtmTrans = true;
+				if (has_space) i++;
+			}
+			else if (opt == "verify-kernel")
+			{
+				global::verifyKernel = true;
+			}
+			else if (opt == "expected-transmission")
+			{
+				global::expectedTrans = true;
+				global::useAtmTrans = true;
+			}
+			else if (opt == "atm-param")
+			{
+				if (no_arg) missarg = true;
+				global::atmParam = stof(arg);
+				if (has_space) i++;
+			}
 			else if (opt == "m" || opt == "maxevents")
 			{
 				if (no_arg) missarg = true;
 				global::nMaxEvents = stoi(arg);
 				if (has_space) i++;
 			}
+			else if (opt == "select")
+			{
+				if (no_arg) missarg = true;
+				else if (!ParseSelection(arg)) return false;
+				global::selectEvents = true;
+				if (has_space) i++;
+			}
       else if (opt == "bufsize")
 			{
 				if (no_arg) missarg = true;
@@ -106,10 +238,130 @@ bool GetOptions(int argc, char** argv)
 				global::maxBufSize = stol(arg);
 				if (has_space) i++;
 			}
+      else if (opt == "memory-limit")
+			{
+				if (no_arg) missarg = true;
+				global::memoryLimit = stoll(arg);
+				if (has_space) i++;
+			}
+      else if (opt == "checkpoint")
+			{
+				if (no_arg) missarg = true;
+				global::checkpointEvery = stoi(arg);
+				if (has_space) i++;
+			}
+			else if (opt == "resume")
+			{
+				global::resume = true;
+			}
+			else if (opt == "stream")
+			{
+				global::streamMode = true;
+			}
+			else if (opt == "stream-warn")
+			{
+				if (no_arg) missarg = true;
+				global::streamWarnLatency = stof(arg);
+				if (has_space) i++;
+			}
 			else if (opt == "longi")
 			{
 				global::saveLongi = true;
 			}
+			else if (opt == "metrics-port")
+			{
+				if (no_arg) missarg = true;
+				global::metricsPort = stoi(arg);
+				if (has_space) i++;
+			}
+			else if (opt == "metrics-socket")
+			{
+				if (no_arg) missarg = true;
+				global::metricsSocket = arg;
+				if (has_space) i++;
+			}
+			else if (opt == "slice")
+			{
+				if (no_arg) missarg = true;
+				global::sliceFileName = arg;
+				if (has_space) i++;
+			}
+			else if (opt == "broadcast")
+			{
+				if (no_arg) missarg = true;
+				global::broadcastName = arg;
+				if (has_space) i++;
+			}
+			else if (opt == "consumers")
+			{
+				if (no_arg) missarg = true;
+				global::nConsumers = stoi(arg);
+				if (has_space) i++;
+			}
+			else if (opt == "ring-size")
+			{
+				if (no_arg) missarg = true;
+				global::ringSize = stoll(arg);
+				if (has_space) i++;
+			}
+			else if (opt == "attach")
+			{
+				if (no_arg) missarg = true;
+				global::attachName = arg;
+				if (has_space) i++;
+			}
+			else if (opt == "events")
+			{
+				if (no_arg) missarg = true;
+				global::eventRange = arg;
+				if (has_space) i++;
+			}
+			else if (opt == "max-output-size")
+			{
+				if (no_arg) missarg = true;
+				global::maxOutputSize = stoll(arg);
+				if (has_space) i++;
+			}
+			else if (opt == "events-per-file")
+			{
+				if (no_arg) missarg = true;
+				global::eventsPerFile = stoi(arg);
+				if (has_space) i++;
+			}
+			else if (opt == "pe")
+			{
+				if (no_arg) missarg = true;
+				global::peMode = arg;
+				if (has_space) i++;
+			}
+			else if (opt == "fit-profiles")
+			{
+				if (no_arg) missarg = true;
+				global::fitModel = arg;
+				if (has_space) i++;
+			}
+			else if (opt == "trace")
+			{
+				if (no_arg) missarg = true;
+				global::traceFileName = arg;
+				if (has_space) i++;
+			}
+			else if (opt == "config")
+			{
+				if (no_arg) missarg = true;
+				global::configFileName = arg;
+				if (has_space) i++;
+			}
+			else if (opt == "write-cache")
+			{
+				if (no_arg) missarg = true;
+				global::cacheFileName = arg;
+				if (has_space) i++;
+			}
+			else if (opt == "summary")
+			{
+				global::telSummary = true;
+			}
 			else if (opt == "dump-telescopes")
 			{
 				global::dumpTelPos = true;
@@ -118,6 +370,10 @@ bool GetOptions(int argc, char** argv)
 			{
 				global::dumpInputs = true;
 			}
+			else if (opt == "info")
+			{
+				global::infoMode = true;
+			}
       else if (opt == "only-telescopes")
       {
 				if (no_arg) missarg = true;
@@ -147,16 +403,140 @@ bool GetOptions(int argc, char** argv)
 		else { cerr << "Invalid option \"" << opt << "\". Try ./iact2root --help." << endl; return false; }
 	}
   
-  if (global::outputFileName == "")
+  // A single input file is processed directly
+  if (global::inputFiles.size()==1) global::inputFileName = global::inputFiles[0];
+  
+  // The range of event numbers is added to the cuts of --select
+  if (global::eventRange != "")
+  {
+    if (!AddEventRange(global::eventRange)) return false;
+    global::selectEvents = true;
+  }
+  
+  // Analysis configurations: from the configuration file or, by
+  // default, the one given by the options
+  global::configs.clear();
+  if (global::configFileName != "")
+  {
+    if (!ReadConfigFile(global::configFileName)) return false;
+  }
+  else SetDefaultConfig();
+  
+  if (global::sliceFileName != "" && (global::inputFileName == "" || global::inputFiles.size()>1))
+  {
+    cerr << "Slicing is only available for a single input file!" << endl;
+    return false;
+  }
+  else if (global::infoMode && (global::inputFileName == "" && global::inputFiles.empty()))
+  {
+    cerr << "The input summary (--info) needs input files!" << endl;
+    return false;
+  }
+  else if (global::broadcastName != "" && (global::attachName != "" || global::sliceFileName != "" || global::inputFiles.size()>1))
+  {
+    cerr << "Broadcasting is only available for a single input (or stdin), without --attach or --slice!" << endl;
+    return false;
+  }
+  else if (global::broadcastName != "" && (global::nConsumers<1 || global::nConsumers>64 || global::ringSize<(1LL<<20)))
+  {
+    cerr << "Broadcasting needs 1 to 64 consumers and a ring of at least 1 MB!" << endl;
+    return false;
+  }
+  else if (global::attachName != "" && (global::inputFiles.size()>0 || global::sliceFileName != ""))
+  {
+    cerr << "A process attached to a broadcast reads no input file of its own and cannot slice!" << endl;
+    return false;
+  }
+  else if (global::outputFileName == "" && global::sliceFileName == "")
   {
-    cerr << "You should declare an output ROOT file name!" << endl;
+    cerr << "You should declare an output file name!" << endl;
     return false;
   }
-  //~ else if (global::atmTransFile == "")
-  //~ {
-    //~ cerr << "You should declare an atmospheric transmission data file!" << endl;
-    //~ return false;
-  //~ }
+#ifdef IACT_NO_ROOT
+  else if (global::outputFormat != "npy")
+  {
+    cerr << "This build has no ROOT support, the only output format is npy!" << endl;
+    return false;
+  }
+#endif
+  else if (global::outputFormat != "root" && global::outputFormat != "npy")
+  {
+    cerr << "Unknown output format " << global::outputFormat << ", it should be root or npy!" << endl;
+    return false;
+  }
+  else if (global::outputFormat == "npy" && (global::checkpointEvery>0 || global::resume || (global::inputFiles.size()>1 && !global::splitOutput)))
+  {
+    cerr << "NumPy output cannot be used with checkpoints or several inputs merged into one output (use --split-output)!" << endl;
+    return false;
+  }
+  else if ((global::checkpointEvery>0 || global::resume) && global::inputFileName == "")
+  {
+    cerr << "Checkpoints are only available when reading from an input file!" << endl;
+    return false;
+  }
+  else if (global::resume && global::inputFiles.size()>1)
+  {
+    cerr << "Resuming is only available for a single input file!" << endl;
+    return false;
+  }
+  else if (global::nJobs<1 || global::nThreads<1)
+  {
+    cerr << "The number of jobs and threads should be at least one!" << endl;
+    return false;
+  }
+  else if (global::chunkSize<1)
+  {
+    cerr << "The chunk size should be at least one bunch!" << endl;
+    return false;
+  }
+  else if (global::cacheFileName!="" && global::inputFiles.size()>1)
+  {
+    cerr << "A bunch cache can only be written from a single input!" << endl;
+    return false;
+  }
+  else if (ConfigsHaveOwnFiles() && (global::inputFiles.size()>1 || global::checkpointEvery>0 || global::resume || global::streamMode))
+  {
+    cerr << "Configurations with an output file of their own cannot be used with several inputs, checkpoints or streaming!" << endl;
+    return false;
+  }
+  else if (global::fitModel!="" && !ProfileModelKnown(global::fitModel))
+  {
+    cerr << "Unknown profile model " << global::fitModel << "!" << endl;
+    return false;
+  }
+  else if (global::maxOutputSize<0 || global::eventsPerFile<0)
+  {
+    cerr << "The maximum output size and events per file should not be negative!" << endl;
+    return false;
+  }
+  else if ((global::maxOutputSize>0 || global::eventsPerFile>0) && (global::checkpointEvery>0 || global::resume || ConfigsHaveOwnFiles() || (global::inputFiles.size()>1 && !global::splitOutput)))
+  {
+    cerr << "Output rollover cannot be used with checkpoints, configurations with an output file of their own, or several inputs merged into one output!" << endl;
+    return false;
+  }
+  else if (global::peMode!="" && global::peMode!="tel" && global::peMode!="pixel")
+  {
+    cerr << "Photo-electrons can be summarized per telescope (tel) or per pixel (pixel)!" << endl;
+    return false;
+  }
+  else if (global::streamWindow<0)
+  {
+    cerr << "The bunch window should not be negative!" << endl;
+    return false;
+  }
+  else if (global::useAtmTrans && global::atmTransFile == "")
+  {
+    cerr << "You should declare an atmospheric transmission data file!" << endl;
+    return false;
+  }
+  else if (global::memoryLimit<0)
+  {
+    cerr << "The memory limit should not be negative!" << endl;
+    return false;
+  }
+  
+  // Buffers and histograms are fitted into the memory limit
+  if (global::memoryLimit>0 && !SetMemoryBudget()) return false;
   
 	return true;
 }
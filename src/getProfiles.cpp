@@ -3,28 +3,29 @@
 
 #include <EventIO.hh>
 
-#include <TObject.h>
-#include <TFile.h>
-#include <TTree.h>
-#include <TGraph.h>
-
 #include <iact-reader.h>
+#include <profileFits.h>
+#include <outputBackend.h>
+#include <trace.h>
 
 /*
  * 
  * Function: GetProfiles
  * 
  * Receives an EventIO::Item object of type 1211 and read the profiles
- * within this data block.
+ * within this data block. They are saved as graphs (--longi) and/or
+ * fitted (--fit-profiles).
  * 
  * @param  item  Pointer to Item object of type 1211
  * @return (none)
  * 
  */
-void GetProfiles(eventio::EventIO::Item *item, TFile* rootFile)
+void GetProfiles(eventio::EventIO::Item *item, OutputFile *outputFile)
 {
   // Just in case
-  if (rootFile == nullptr) return;
+  if (outputFile == nullptr) return;
+  
+  TraceSpan span("GetProfiles");
   
   // For the profile names
   int   evtNumber = global::thisEvent.GetEventNumber();
@@ -51,25 +52,27 @@ void GetProfiles(eventio::EventIO::Item *item, TFile* rootFile)
   for (int i=0; i<nPoints; i++) depth[i]=(i+1)*thickstep;
   
   // Loop over profiles:
-  // read profile from input buffer; create a tgraph; store into .root.
+  // read profile from input buffer; store it as a graph.
   float * profile[np];
   for (int i=0; i<np; i++)
   {
     profile[i] = new float[nthick];
     item->GetReal(profile[i],nthick);
+    if (!global::saveLongi) continue;
     
-    // Create a graph with the profile and save it into the root file
+    // Save the profile as a graph into the output file
     std::string profName = "run" + std::to_string(runNumber) + "_event" + std::to_string(evtNumber) + "_" + particleType[i];
-    TGraph g(nPoints,depth,profile[i]);
-    g.SetName(profName.c_str());
-    g.SetTitle(profName.c_str());
-    rootFile->cd("Profiles");
-    g.Write();
+    outputFile->WriteGraph("Profiles",profName,nPoints,depth,profile[i]);
   }
+  
+  // Charged particles and Cherenkov profiles are fitted
+  if (global::fitModel != "" && np > 8) AddProfileFits(runNumber,evtNumber,profile[6],profile[8],nPoints,thickstep);
+  
+  for (int i=0; i<np; i++) delete[] profile[i];
 
   // Or save into a tree instead... (more difficult to read)
   //~ // Create the tree and its branches
-  //~ TTree * tree = (TTree*)rootFile->Get("profiles");
+  //~ TTree * tree = (TTree*)outputFile->Get("profiles");
   //~ if (!tree) tree = new TTree("profiles","profiles");
   //~ tree->Branch("nPoints"  ,&nPoints,"nPoints/I");
   //~ tree->Branch("gamma"    ,profile[0],"gamma[nPoints]/F");
@@ -83,7 +86,7 @@ void GetProfiles(eventio::EventIO::Item *item, TFile* rootFile)
   //~ tree->Branch("cherenkov",profile[8],"cherenkov[nPoints]/F");
   
   //~ tree->Fill();
-  //~ rootFile->cd();
+  //~ outputFile->cd();
   //~ tree->Write(0,TObject::kSingleKey+TObject::kWriteDelete);
   
   return;
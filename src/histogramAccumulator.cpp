@@ -0,0 +1,82 @@
+#include <cmath>
+#include <cstring>
+
+#ifndef IACT_NO_ROOT
+#include <TH2.h>
+#endif
+
+#include <histogramAccumulator.h>
+
+/*
+ * 
+ * Function: HistogramAccumulator::Add
+ * 
+ * Adds the contents of another accumulator with the same binning.
+ * 
+ * @param  other  Accumulator to be added
+ * @return (none)
+ * 
+ */
+void HistogramAccumulator::Add(const HistogramAccumulator &other)
+{
+  entries += other.entries;
+  for (int i=0; i<7; i++) stats[i] += other.stats[i];
+  for (size_t i=0; i<content.size(); i++)
+  {
+    content[i] += other.content[i];
+    sumw2[i]   += other.sumw2[i];
+  }
+}
+
+
+
+/*
+ * 
+ * Function: HistogramAccumulator::Identical
+ * 
+ * Tells whether another accumulator has the same binning, contents,
+ * errors, statistics and entries, bit by bit.
+ * 
+ * @param  other  Accumulator to be compared
+ * @return "true" if they are the same, otherwise return "false".
+ * 
+ */
+bool HistogramAccumulator::Identical(const HistogramAccumulator &other) const
+{
+  if (nx != other.nx || ny != other.ny || xmin != other.xmin || xmax != other.xmax || ymin != other.ymin || ymax != other.ymax) return false;
+  if (memcmp(&entries,&other.entries,sizeof(entries)) != 0 || memcmp(stats,other.stats,sizeof(stats)) != 0) return false;
+  return memcmp(content.data(),other.content.data(),content.size()*sizeof(double)) == 0 &&
+         memcmp(sumw2.data(),other.sumw2.data(),sumw2.size()*sizeof(double)) == 0;
+}
+
+
+
+#ifndef IACT_NO_ROOT
+/*
+ * 
+ * Function: HistogramAccumulator::Export
+ * 
+ * Copies contents, errors, statistics and number of entries into a TH2F
+ * booked with the same binning, rounding the sums kept in double
+ * precision to float once.
+ * 
+ * @param  histo  Histogram to be filled
+ * @return (none)
+ * 
+ */
+void HistogramAccumulator::Export(TH2F &histo) const
+{
+  histo.Sumw2();
+  for (size_t i=0; i<content.size(); i++)
+  {
+    histo.SetBinContent(i,content[i]);
+    histo.SetBinError(i,sqrt(sumw2[i]));
+  }
+  
+  // Setting bin contents resets the statistics, so set them at the end
+  double s[7];
+  for (int i=0; i<7; i++) s[i] = stats[i];
+  histo.PutStats(s);
+  histo.SetEntries(entries);
+}
+#endif
@@ -1,12 +1,12 @@
 #include <iostream>
 #include <cstdio>
 #include <sstream>
+#include <cmath>
+#include <memory>
 
-#include <EventIO.hh>
+#include <unistd.h>
 
-#include <TFile.h>
-#include <TNtuple.h>
-#include <TMath.h>
+#include <EventIO.hh>
 
 #include <iact-reader.h>
 #include <getInputs.h>
@@ -15,6 +15,24 @@
 #include <analyzeBunches.h>
 #include <getOptions.h>
 #include <makeHeader.h>
+#include <checkpoint.h>
+#include <batchMode.h>
+#include <streaming.h>
+#include <rawEventIO.h>
+#include <telescopeSummary.h>
+#include <eventSelection.h>
+#include <bunchCache.h>
+#include <analysisConfig.h>
+#include <metrics.h>
+#include <profileFits.h>
+#include <photoElectrons.h>
+#include <outputFiles.h>
+#include <outputBackend.h>
+#include <slice.h>
+#include <broadcast.h>
+#include <probe.h>
+#include <memoryBudget.h>
+#include <trace.h>
 
 
 /*
@@ -34,19 +52,61 @@ namespace global
   TelescopeDefinition telDef;
   TelescopeOffsets    telOffsets;
   
+#ifndef IACT_NO_ROOT
   // A random number generator from ROOT
   TRandom1 ranlux(time(NULL));
+#endif
   
   // Options from comand line
   std::string onlyTelescopes = "";
   std::string inputFileName = "";
+  std::vector<std::string> inputFiles;
+#ifndef IACT_NO_ROOT
   std::string outputFileName = "output.root";
+  std::string outputFormat = "root";
+#else
+  std::string outputFileName = "output";
+  std::string outputFormat = "npy";
+#endif
   std::string atmTransFile = "atmtrans/atm_trans_2150_1_10_0_0_2150.dat";
+  bool  useAtmTrans = false;
+  bool  expectedTrans = false;
+  bool  verifyKernel = false;
+  float atmParam   = NAN;
   long  iniBufSize = 100000000;  // 100 MB
   long  maxBufSize = 1000000000; // 1 GB
+  long long memoryLimit = 0; // bytes
   int   nMaxEvents = -1;
+  int   nJobs      = 1;
+  int   nThreads   = 1;
+  long  chunkSize  = 262144;
+  long  streamWindow = 4194304; // bunches (64 MB)
+  bool  telSummary = false;
+  bool  selectEvents = false;
+  std::string cacheFileName = "";
+  std::string configFileName = "";
+  std::vector<AnalysisConfig> configs;
+  int   metricsPort = 0;
+  std::string metricsSocket = "";
+  std::string traceFileName = "";
+  std::string fitModel = "";
+  std::string peMode = "";
+  long long maxOutputSize = 0; // bytes
+  int   eventsPerFile = 0;
+  std::string sliceFileName = "";
+  std::string broadcastName = "";
+  std::string attachName = "";
+  int   nConsumers = 1;
+  long long ringSize = 67108864; // bytes (64 MB)
+  std::string eventRange = "";
+  bool  splitOutput = false;
+  int   checkpointEvery = 0;
+  bool  resume     = false;
+  bool  streamMode = false;
+  float streamWarnLatency = 1000.; // ms
   bool  dumpTelPos = false;
   bool  dumpInputs = false;
+  bool  infoMode   = false;
   bool  saveLongi  = false;
   int   binsX      = 100;
   int   binsY      = 100;
@@ -62,46 +122,140 @@ namespace global
  * 
  * Function: main()
  * 
- * Main function of the program. It is only an interface to iterate over
- * the input file (from CORSIKA IACT) and call the correspondent analy-
- * sis functions.
+ * Main function of the program. It is only an interface to read the
+ * options and hand the input file(s) over to ProcessInput(), either
+ * directly or through the batch scheduler.
  * 
  */
 int main (int argc, char** argv)
 {
-  using std::cerr;
-  using std::cout;
-  using std::endl;
-
   // Get options from command line
   if (!GetOptions(argc, argv)) return 1;
   // Read atmospheric transmission data
-  //~ if (!ReadAtmosphericTransmission(global::atmTransFile)) return 1;
+  if (global::useAtmTrans && !ReadAtmosphericTransmission(global::atmTransFile)) return 1;
+  
+  // Start the metrics endpoint, if requested
+  if (!StartMetricsServer()) return 1;
+  
+  // Record a timeline of the job, if requested
+  if (global::traceFileName != "") StartTrace();
+  
+  // The input of a consumer comes from the broadcast ring, through stdin
+  if (global::attachName != "" && !AttachBroadcast()) return 1;
+  
+  int status;
+  
+  // The input is handed over to other processes as it is read, or...
+  if (global::broadcastName != "") status = BroadcastInput() ? 0 : 1;
+  // ... the inputs are only summarized from their headers, or...
+  else if (global::infoMode) status = ProbeInputs() ? 0 : 1;
+  // ... selected events are copied to a new IACT file, or...
+  else if (global::sliceFileName != "") status = SliceInput()<0 ? 1 : 0;
+  // ... many input files are scheduled over a pool of worker processes
+  else if (global::inputFiles.size()>1) status = RunBatch() ? 0 : 1;
+  else
+  {
+    eventio::EventIO iobuf(global::iniBufSize,global::maxBufSize); // The IO buffer
+    status = ProcessInput(iobuf)<0 ? 1 : 0;
+  }
+  
+  StopMetricsServer();
+  
+  // Batch workers report their own memory use
+  if (global::memoryLimit>0 && global::inputFiles.size()<=1) WriteMemoryReport("Memory high-water marks");
+  
+  if (global::traceFileName != "" && !WriteTrace(global::traceFileName)) status = 1;
+  
+  return status;
+}
+
+
+
+/*
+ * 
+ * Function: ProcessInput
+ * 
+ * Iterates over the input file (from CORSIKA IACT) given by
+ * global::inputFileName and calls the correspondent analysis functions,
+ * writing the results to global::outputFileName.
+ * 
+ * @param  iobuf  The IO buffer (may be reused for several inputs)
+ * @return Number of events read, or -1 in case of errors
+ * 
+ */
+int ProcessInput(eventio::EventIO &iobuf)
+{
+  using std::cerr;
+  using std::cout;
+  using std::endl;
   
   int iEvt = 0; // Event counter
   std::vector<int> skipTypes = {0,1206,1208}; // Data block types to be skiped
-  eventio::EventIO iobuf(global::iniBufSize,global::maxBufSize); // The IO buffer
+  if (global::peMode != "") skipTypes.pop_back(); // Photo-electrons are decoded
+  
+  // Forget the telescope definitions from any previous input
+  global::telDef = TelescopeDefinition();
+  
+  // Bunch caches are read directly, without the IO buffer
+  bool fromCache = global::inputFileName != "" && IsBunchCache(global::inputFileName);
+  if (fromCache && (global::resume || global::checkpointEvery>0 || global::cacheFileName!=""))
+  {
+    cerr << "Checkpoints and writing a bunch cache are not available when reading a bunch cache. Quit." << endl;
+    return -1;
+  }
   
-  // Open input buffer
+  // Open input buffer. The input file is opened here (rather than by
+  // the buffer) to be able to tell and seek its position for checkpoints
+  FILE *input = stdin;
   if (global::inputFileName != "")
-    iobuf.OpenInput(global::inputFileName);
-  else
-    iobuf.OpenInput(stdin);
+    input = fopen(global::inputFileName.c_str(),"rb");
+  // A pipe is read by the buffer through a stream that lets array blocks
+  // be streamed from it as well (see OpenPipeInput())
+  FILE *bufferInput = input;
+  if (input != nullptr && !fromCache && !SeekableInput(input))
+    bufferInput = OpenPipeInput(input);
+  if (bufferInput != nullptr && !fromCache)
+    iobuf.OpenInput(bufferInput);
   
   // Check if it was correctly opened
-  if (!iobuf.HaveInput())
+  if (input == nullptr || bufferInput == nullptr || (!fromCache && !iobuf.HaveInput()))
   {
     std::cerr << "Error opening input buffer!" << std::endl;
-    return 1;
+    return -1;
+  }
+  
+  // Checkpoints are stored next to the output file
+  std::string checkpointFileName = global::outputFileName + ".ckpt";
+  Checkpoint  ckpt = Checkpoint();
+  
+  // When resuming, put back the snapshot of the output taken at the last
+  // checkpoint, so that it is reopened exactly as it was back then
+  if (global::resume)
+  {
+    if (!ReadCheckpoint(checkpointFileName,ckpt)) return -1;
+    if (ckpt.inputFileName != global::inputFileName)
+    {
+      cerr << "Checkpoint " << checkpointFileName << " refers to input " << ckpt.inputFileName << ". Quit." << endl;
+      return -1;
+    }
+    if (!RestoreCheckpoint(global::outputFileName,ckpt))
+    {
+      cerr << "Unable to restore output file " << global::outputFileName << " from checkpoint. Quit." << endl;
+      return -1;
+    }
   }
   
-  // Create a root file and two subdirectories to save the histograms
-  TFile rootFile(global::outputFileName.c_str(),"recreate","",209);
-  rootFile.mkdir("allPhotons");
-  //~ rootFile.mkdir("detectedPhotons");
+  // Create the output file and the subdirectories to save the histograms
+  // (or reopen it with the subdirectories already there if resuming)
+  std::unique_ptr<OutputFile> outputFile(OpenOutput(global::resume));
+  if (!outputFile) return -1;
+  
+  // Everything needed to analyze the input again is also written to
+  // a bunch cache, if requested
+  if (global::cacheFileName!="" && !OpenBunchCache(global::cacheFileName)) return -1;
   
-  // Create a folder to save the longitudinal profiles if needed
-  if (global::saveLongi) rootFile.mkdir("Profiles");
+  // A bunch cache is analyzed at once
+  if (fromCache) iEvt = ReadBunchCache(global::inputFileName,outputFile);
   
   // Boolean to get the first event and fill the header
   bool firstEvent = true;
@@ -109,12 +263,21 @@ int main (int argc, char** argv)
   // Boolean to exit the main loop under specified conditions
   bool done = false;
   
+  // Number of dumps (--dump-telescopes, --dump-inputs) before we are done
+  int nDumps = (global::dumpTelPos ? 1 : 0) + (global::dumpInputs ? 1 : 0);
+  
+  // Boolean to skip the data of events rejected by the selection
+  bool skipEvent = false;
+  
   // Boolean to check if input comes from stdin
   bool fromStdIn = global::inputFileName == "" ? true : false;
   
   // Read the input buffer (IACT file) until it is over
-  while(iobuf.Find()==0)
+  while(!fromCache && iobuf.Find()==0)
   {
+    MetricsAdd(metrics::kBlocks,1);
+    MetricsAdd(metrics::kInputBytes,iobuf.ItemLength());
+    
     // We are done if we got the required number of events
     if (iEvt>global::nMaxEvents && global::nMaxEvents>0) done = true;
     
@@ -122,6 +285,23 @@ int main (int argc, char** argv)
     if (done && !fromStdIn) break;
     if (done &&  fromStdIn) {iobuf.Skip(); continue;}
     
+    // When resuming, jump from the first event header straight to the
+    // end of the last event saved in the checkpoint
+    if (global::resume && iobuf.ItemType()==1202)
+    {
+      iobuf.Skip();
+      if (fseeko(input,ckpt.inputOffset,SEEK_SET) != 0)
+      {
+        cerr << "Unable to seek input to checkpoint position. Quit." << endl;
+        return -1;
+      }
+      iEvt = ckpt.iEvt;
+      firstEvent = false;
+      global::resume = false;
+      cout << "Resuming after event " << iEvt << endl;
+      continue;
+    }
+    
     // Do we want to skip the current block type?
     if (std::find(skipTypes.begin(), skipTypes.end(), iobuf.ItemType())!=skipTypes.end())
     {
@@ -129,8 +309,38 @@ int main (int argc, char** argv)
       continue;
     }
     
+    // Data of rejected events are skipped without being read
+    if (skipEvent && (iobuf.ItemType()==1203 || iobuf.ItemType()==1204 || iobuf.ItemType()==1205 || iobuf.ItemType()==1208 || iobuf.ItemType()==1211))
+    {
+      iobuf.Skip();
+      continue;
+    }
+    
+    // Array blocks larger than the bunch window (or than the buffer,
+    // with their header) are analyzed while being read, instead of
+    // loading them into the buffer
+    if (iobuf.ItemType()==1204 && global::streamWindow>0 && ((long long)iobuf.ItemLength()>16LL*global::streamWindow || (long long)iobuf.ItemLength()+20>global::maxBufSize))
+    {
+      ShowProgress(1204);
+      TraceSpan span("StreamArray","bytes",iobuf.ItemLength());
+      RawBlockReader reader(bufferInput,iobuf.ItemLength());
+      if (!StreamTelescopeArray(reader,outputFile.get()))
+      {
+        cerr << "Truncated array block. Quit." << endl;
+        return -1;
+      }
+      iobuf.Skip();
+      continue;
+    }
+    
     // Read the current data block...
-    iobuf.Read();
+    {
+      TraceSpan span("Read","type",iobuf.ItemType());
+      iobuf.Read();
+    }
+    MetricsSet(metrics::kBufferBytes,iobuf.ItemLength());
+    // The buffer keeps the size of the largest block it has loaded
+    MemorySet(memory::kBuffer,std::max<long long>({global::iniBufSize,memory::used[memory::kBuffer],(long long)iobuf.ItemLength()+20}));
     // ... and store it in an EventIO::Item object
     eventio::EventIO::Item curItem(iobuf,"get");
     
@@ -141,54 +351,85 @@ int main (int argc, char** argv)
     {
       case 1200: /// CORSIKA run header
         global::corHeader.GetFromIACT(&curItem);
+        CacheCorsikaBlock(1200,global::corHeader);
         break;
       case 1201: /// Position and sizes of telescopes within telescope array
         global::telDef.GetFromIACT(&curItem);
+        CacheTelescopeDefinition(global::telDef);
         if (global::onlyTelescopes!="")
           global::telDef.SetUserIDs(global::onlyTelescopes);
+        SetConfigTelescopes();
         if (global::dumpTelPos)
         {
           global::telDef.DumpPositions();
-          done = true;
+          if (--nDumps == 0) done = true;
         }
         break;
       case 1202: /// CORSIKA event header
         global::thisEvent.GetFromIACT(&curItem);
-        if(firstEvent) makeHeader(&rootFile);
+        CacheCorsikaBlock(1202,global::thisEvent);
+        // Survival probability averaged over the spectrum of this event
+        if (global::expectedTrans && !SetExpectedTransmission(global::thisEvent.GetMinWaveLength(),global::thisEvent.GetMaxWaveLength())) return -1;
+        // A full output rolls over to the next file before the event
+        if (!RollOutputIfFull(outputFile,firstEvent)) return -1;
+        if(firstEvent) makeHeader(outputFile.get());
         firstEvent = false;
-        iEvt++;
+        // Only selected events are analyzed and counted
+        skipEvent = global::selectEvents && !SelectEvent();
+        FillEventTable(!skipEvent);
+        if (!skipEvent) AddOutputEvent(global::thisEvent.GetEventNumber());
+        if (!skipEvent) iEvt++;
+        if (!skipEvent) MetricsAdd(metrics::kEvents,1);
+        MetricsSet(metrics::kCurrentEvent,global::thisEvent.GetEventNumber());
         break;
       case 1203: /// Offsets of multiple telescope arrays for the present event
         global::telOffsets.GetFromIACT(&curItem);
         break;
       case 1204: /// Top level item for data from one array in one event
       {
-        while(curItem.NextSubItemType()==1205)
-        {
-          eventio::EventIO::Item subItem(curItem,"get");
-          AnalyzePhotonBunches(&subItem,&rootFile);
-        }
+        AnalyzeTelescopeArray(&curItem,outputFile.get());
         break;
       }
       case 1205:
       {
-        AnalyzePhotonBunches(&curItem,&rootFile);
+        AnalyzePhotonBunches(&curItem,outputFile.get());
       }
       case 1206: /// Camera layout in the telescope simulation
         break;
       case 1208: /// Photo-electrons after ray-tracing and detection
+        AddPhotoElectrons(&curItem);
         break;
       case 1209: /// CORSIKA event end
+      {
+        // Streaming latency is measured from here
+        auto eventEnd = std::chrono::steady_clock::now();
         global::thisEventEnd.GetFromIACT(&curItem);
+        CacheCorsikaBlock(1209,global::thisEventEnd);
+        if (skipEvent) { skipEvent = false; break; }
+        FlushPhotoElectrons();
+        // Profile fits must be in the output before it is committed
+        if (global::streamMode || global::checkpointEvery>0) FlushProfileFits();
+        if (global::streamMode) CommitEvent(outputFile.get(),global::thisEvent.GetEventNumber(),eventEnd);
+        // Save a checkpoint every few events, after the event is complete
+        if (global::checkpointEvery>0 && !fromStdIn && iEvt%global::checkpointEvery==0)
+        {
+          ckpt.inputFileName = global::inputFileName;
+          ckpt.inputOffset   = ftello(input);
+          ckpt.iEvt          = iEvt;
+          SaveCheckpoint(checkpointFileName,outputFile.get(),global::outputFileName,ckpt);
+        }
         break;
+      }
       case 1210: /// CORSIKA run end
         global::corEnd.GetFromIACT(&curItem);
+        CacheCorsikaBlock(1210,global::corEnd);
         break;
       case 1211: /// Longitudinal profiles
-        if (global::saveLongi) GetProfiles(&curItem,&rootFile);
+        if (global::saveLongi || global::fitModel != "") GetProfiles(&curItem,outputFile.get());
         break;
       case 1212: /// CORSIKA inputs
         GetInputs(&curItem,global::dumpInputs);
+        if (global::dumpInputs && --nDumps == 0) done = true;
         break;
       case 1213:
         break;
@@ -201,12 +442,24 @@ int main (int argc, char** argv)
   } // Loop over IO buffer
   
   // Close input buffer
-  iobuf.CloseInput();
-
-  // Close root ouput file
-  rootFile.Close();
+  if (!fromCache) iobuf.CloseInput();
+  if (bufferInput != input) fclose(bufferInput);
+  if (!fromStdIn) fclose(input);
+  
+  // Close root ouput file(s)
+  if (!CloseOutput(outputFile.get())) iEvt = -1;
+  
+  if (!CloseBunchCache() || iEvt<0) return -1;
+  
+  // Results of the compact kernel against the reference path
+  if (global::verifyKernel && !ReportKernelCheck()) return -1;
+  
+  MetricsAdd(metrics::kFiles,1);
+  
+  // The run is complete, checkpoints are no longer needed
+  RemoveCheckpoint(checkpointFileName,ckpt);
   
-  return 0;
+  return iEvt;
 }
 
 
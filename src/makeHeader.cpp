@@ -1,36 +1,33 @@
 #include <iostream>
-
-#include <TFile.h>
-#include <TNtuple.h>
-#include <TTree.h>
-#include <TMath.h>
+#include <cmath>
 
 #include <EventIO.hh>
 
 #include <iact-reader.h>
+#include <outputBackend.h>
 
-void makeHeader(TFile * rootFile)
+void makeHeader(OutputFile * outputFile)
 {
-  // Change directory to file pointed by argument
-  rootFile->cd();
-  
-  // Create TNtuple object as header
-  TNtuple headerTuple("Header","Header","runNumber:primaryID:primaryEnergyTeV:primaryTheta:primaryPhi");
+  // Create a table as header
+  OutputTable *headerTuple = outputFile->GetTable("Header","runNumber:primaryID:primaryEnergyTeV:primaryTheta:primaryPhi");
+  if (headerTuple == nullptr) return;
   
   float h1 = global::corHeader.GetRunNumber();
   float h2 = global::thisEvent.GetPrimaryID();
   float h3 = global::thisEvent.GetPrimaryEnergy()*0.001;
-  float h4 = global::thisEvent.GetZenithAngle()*180/TMath::Pi();
-  float h5 = global::thisEvent.GetAzimuthAngle()*180/TMath::Pi();
+  float h4 = global::thisEvent.GetZenithAngle()*180/M_PI;
+  float h5 = global::thisEvent.GetAzimuthAngle()*180/M_PI;
   
   while(h5<0)   h5+=360;
   while(h5>360) h5-=360;
   
-  headerTuple.Fill(h1,h2,h3,h4,h5);
-  headerTuple.Write();
+  float header[5] = {h1,h2,h3,h4,h5};
+  headerTuple->Fill(header);
+  headerTuple->Write();
   
-  // Create a TNtuple with telescope definitions
-  TNtuple telTuple("Telescopes","Telescopes","ID:x:y:z:r");
+  // Create a table with telescope definitions
+  OutputTable *telTuple = outputFile->GetTable("Telescopes","ID:x:y:z:r");
+  if (telTuple == nullptr) return;
   for (int i=0; i<global::telDef.GetN(); i++)
   {
     float id = global::telDef.GetID(i);
@@ -40,9 +37,10 @@ void makeHeader(TFile * rootFile)
     float r  = 0.01*global::telDef.GetR(i);
     
     if (id<0) continue;
-    telTuple.Fill(id,x,y,z,r);
+    float values[5] = {id,x,y,z,r};
+    telTuple->Fill(values);
   }
-  telTuple.Write();
+  telTuple->Write();
   
   return;
 }
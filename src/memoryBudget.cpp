@@ -0,0 +1,96 @@
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <algorithm>
+
+#include <EventIO.hh>
+
+#include <iact-reader.h>
+#include <memoryBudget.h>
+
+namespace memory
+{
+  long long              budget[kNConsumers]    = {};
+  std::atomic<long long> used[kNConsumers]      = {};
+  std::atomic<long long> highWater[kNConsumers] = {};
+};
+
+
+
+/*
+ * 
+ * Function: SetMemoryBudget
+ * 
+ * Splits global::memoryLimit among the processes of the job and, in each
+ * one, among its consumers: 40% for the IO buffer, 30% for the bunch
+ * window, 20% for the histograms of the telescopes being analyzed and
+ * 10% for the partial histograms of the chunks in flight. The sizes of
+ * the IO buffer and the bunch window are reduced to fit. Bunches of
+ * buffered blocks are read from the buffer into the window, without
+ * other copies, and array blocks larger than the window (and so than
+ * the buffer) are streamed from the input through the window instead;
+ * histograms are analyzed in smaller groups (see analyzeBunches). Going
+ * over the budget thus slows the analysis down rather than making it
+ * fail.
+ * 
+ * @return "false" if the limit is too small (16 MB per process), "true" otherwise.
+ * 
+ */
+bool SetMemoryBudget()
+{
+  using namespace memory;
+  
+  int nProcesses = global::inputFiles.size()>1 ? std::min<int>(global::nJobs,global::inputFiles.size()) : 1;
+  long long limit = global::memoryLimit/nProcesses;
+  if (limit < (16LL<<20))
+  {
+    std::cerr << "The memory limit should be at least 16 MB per job!" << std::endl;
+    return false;
+  }
+  
+  budget[kBuffer]     = limit*4/10;
+  budget[kWindow]     = limit*3/10;
+  budget[kHistograms] = limit*2/10;
+  budget[kTasks]      = limit - budget[kBuffer] - budget[kWindow] - budget[kHistograms];
+  
+  global::maxBufSize = std::min<long long>(global::maxBufSize,budget[kBuffer]);
+  global::iniBufSize = std::min(global::iniBufSize,global::maxBufSize);
+  
+  // Streaming must be on, for blocks larger than the buffer. Blocks are
+  // streamed above the size of the window, which is below the buffer
+  // budget, so a buffered block (with its header) always fits its share
+  if (global::streamWindow<=0 || 16*global::streamWindow>budget[kWindow]) global::streamWindow = budget[kWindow]/16;
+  
+  return true;
+}
+
+
+
+/*
+ * 
+ * Function: WriteMemoryReport
+ * 
+ * Prints the high-water mark of each consumer against its budget.
+ * 
+ * @param  title  Title of the report (e.g. the process it refers to)
+ * @return (none)
+ * 
+ */
+void WriteMemoryReport(std::string title)
+{
+  using namespace memory;
+  using std::cout;
+  using std::endl;
+  
+  const char *names[kNConsumers] = {"buffer","window","tasks","histograms"};
+  
+  cout << endl;
+  cout << title << ":" << endl;
+  for (int c=0; c<kNConsumers; c++)
+  {
+    cout << "  " << std::left << std::setw(11) << names[c] << std::right << std::fixed << std::setprecision(1);
+    cout << highWater[c]*1.e-6 << " MB";
+    if (budget[c]>0) cout << " of " << budget[c]*1.e-6 << " MB";
+    cout << endl;
+  }
+}
@@ -0,0 +1,342 @@
+#include <iostream>
+#include <sstream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <cstring>
+#include <new>
+
+#include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <EventIO.hh>
+
+#include <iact-reader.h>
+#include <metrics.h>
+
+/*
+ * 
+ * The namespace metrics keeps, besides the shared values, the state of
+ * the endpoint: listening socket, serving thread, process of each row
+ * of values and the counters at the previous request, from which rates
+ * are computed. Row 0 belongs to the main process and row w+1 to batch
+ * worker w.
+ * 
+ */
+namespace metrics
+{
+  std::atomic<long long> *values = nullptr;
+  std::atomic<long long> *rows   = nullptr; // All rows (kNMetrics values each)
+  int                     nRows  = 0;
+  
+  int               listenFd = -1;
+  std::thread       server;
+  std::atomic<bool> stop(false);
+  std::mutex        workersLock;
+  std::vector<pid_t> rowPids; // Process of each row (0: none, or reaped)
+  
+  std::chrono::steady_clock::time_point start;
+  std::chrono::steady_clock::time_point lastTime;
+  long long         lastValues[kNMetrics];
+};
+
+
+
+/*
+ * 
+ * Function: ResidentBytes
+ * 
+ * Resident set size of a process, from /proc/<pid>/statm.
+ * 
+ * @param  pid  Process ID (0 for the present process)
+ * @return Resident memory in bytes, or 0 if not available
+ * 
+ */
+static long long ResidentBytes(pid_t pid)
+{
+  std::ifstream statm(pid>0 ? "/proc/"+std::to_string(pid)+"/statm" : std::string("/proc/self/statm"));
+  long long size, resident;
+  if (!(statm >> size >> resident)) return 0;
+  return resident*sysconf(_SC_PAGESIZE);
+}
+
+
+
+/*
+ * 
+ * Function: MetricsText
+ * 
+ * Builds the metrics page in Prometheus text format. Rates are computed
+ * over the time since the previous request.
+ * 
+ * @return Metrics page
+ * 
+ */
+static std::string MetricsText()
+{
+  using namespace metrics;
+  
+  auto   now     = std::chrono::steady_clock::now();
+  double seconds = std::chrono::duration<double>(now-lastTime).count();
+  double uptime  = std::chrono::duration<double>(now-start).count();
+  
+  std::lock_guard<std::mutex> guard(workersLock);
+  
+  // Counters summed over all rows, also of the workers already reaped
+  long long v[kNMetrics] = {};
+  for (int r=0; r<nRows; r++)
+    for (int i=0; i<kNMetrics; i++) v[i] += rows[r*kNMetrics+i].load(std::memory_order_relaxed);
+  
+  std::ostringstream out;
+  auto metric = [&](const char *name, const char *type, const char *help, double value)
+  {
+    out << "# HELP iact_reader_" << name << " " << help << "\n";
+    out << "# TYPE iact_reader_" << name << " " << type << "\n";
+    out << "iact_reader_" << name << " " << value << "\n";
+  };
+  // Gauges of each running process, labeled with its process ID
+  auto gauge = [&](const char *name, const char *help, Metric m, double scale)
+  {
+    out << "# HELP iact_reader_" << name << " " << help << "\n";
+    out << "# TYPE iact_reader_" << name << " gauge\n";
+    for (int r=0; r<nRows; r++)
+      if (rowPids[r] > 0)
+        out << "iact_reader_" << name << "{pid=\"" << rowPids[r] << "\"} " << scale*rows[r*kNMetrics+m].load(std::memory_order_relaxed) << "\n";
+  };
+  auto rate = [&](Metric m) { return seconds>0 ? (v[m]-lastValues[m])/seconds : 0.; };
+  
+  out.precision(15);
+  metric("events_total",           "counter", "Events analyzed.",                              v[kEvents]);
+  metric("bunches_total",          "counter", "Photon bunches analyzed.",                      v[kBunches]);
+  metric("input_bytes_total",      "counter", "Bytes of input blocks read.",                   v[kInputBytes]);
+  metric("input_blocks_total",     "counter", "Input blocks read.",                            v[kBlocks]);
+  metric("files_total",            "counter", "Input files finished.",                         v[kFiles]);
+  metric("events_per_second",      "gauge",   "Events analyzed per second (since last scrape).",      rate(kEvents));
+  metric("bunches_per_second",     "gauge",   "Bunches analyzed per second (since last scrape).",     rate(kBunches));
+  metric("input_bytes_per_second", "gauge",   "Input bytes read per second (since last scrape).",     rate(kInputBytes));
+  gauge("current_event",            "Number of the event being analyzed.",             kCurrentEvent,  1);
+  gauge("buffer_bytes",             "Size of the last block read into the IO buffer.", kBufferBytes,   1);
+  gauge("window_bunches",           "Bunches waiting in the bunch window.",            kWindowBunches, 1);
+  gauge("queued_tasks",             "Bunch analysis tasks not finished yet.",          kQueuedTasks,   1);
+  gauge("stream_last_latency_seconds", "Time from the end of the last event to its commit (streaming mode).", kLastLatency, 1.e-6);
+  out << "# HELP iact_reader_stream_latency_seconds Time from the end of each event to its commit (streaming mode).\n";
+  out << "# TYPE iact_reader_stream_latency_seconds summary\n";
+  out << "iact_reader_stream_latency_seconds_sum "   << v[kLatencySum]*1.e-6 << "\n";
+  out << "iact_reader_stream_latency_seconds_count " << v[kCommits] << "\n";
+  metric("resident_bytes",         "gauge",   "Resident memory of the main process.",         ResidentBytes(0));
+  {
+    long long workersRSS = 0;
+    int       nWorkers   = 0;
+    for (int r=1; r<nRows; r++)
+      if (rowPids[r] > 0) { workersRSS += ResidentBytes(rowPids[r]); nWorkers++; }
+    metric("workers",                "gauge",   "Batch worker processes.",                    nWorkers);
+    metric("workers_resident_bytes", "gauge",   "Resident memory of the batch workers.",      workersRSS);
+  }
+  metric("uptime_seconds",         "gauge",   "Time since the job started.",                  uptime);
+  
+  lastTime = now;
+  for (int i=0; i<kNMetrics; i++) lastValues[i] = v[i];
+  
+  return out.str();
+}
+
+
+
+/*
+ * 
+ * Function: ServeMetrics
+ * 
+ * Body of the serving thread: answers every connection with the
+ * metrics page, as an HTTP response, until the server is stopped.
+ * 
+ * @return (none)
+ * 
+ */
+static void ServeMetrics()
+{
+  while (!metrics::stop)
+  {
+    pollfd pfd = {metrics::listenFd, POLLIN, 0};
+    if (poll(&pfd,1,200) <= 0) continue;
+    
+    int fd = accept(metrics::listenFd,nullptr,nullptr);
+    if (fd < 0) continue;
+    
+    // Read (and ignore) the request, without waiting for too long
+    char request[4096];
+    pollfd rfd = {fd, POLLIN, 0};
+    if (poll(&rfd,1,1000) > 0) recv(fd,request,sizeof(request),0);
+    
+    std::string body = MetricsText();
+    std::string response = "HTTP/1.0 200 OK\r\n"
+                           "Content-Type: text/plain; version=0.0.4\r\n"
+                           "Content-Length: " + std::to_string(body.size()) + "\r\n"
+                           "Connection: close\r\n\r\n" + body;
+    
+    size_t sent = 0;
+    while (sent < response.size())
+    {
+      ssize_t n = send(fd,response.data()+sent,response.size()-sent,MSG_NOSIGNAL);
+      if (n <= 0) break;
+      sent += n;
+    }
+    close(fd);
+  }
+}
+
+
+
+/*
+ * 
+ * Function: StartMetricsServer
+ * 
+ * Starts the metrics endpoint, if requested with --metrics-port (TCP,
+ * on localhost only) or --metrics-socket (Unix socket), served by a
+ * background thread.
+ * 
+ * @return "true" in case of success (or if not requested), "false" otherwise.
+ * 
+ */
+bool StartMetricsServer()
+{
+  if (global::metricsPort<=0 && global::metricsSocket=="") return true;
+  
+  // Values shared with the batch workers (forked later), a row for the
+  // main process and one for each worker
+  metrics::nRows = 1 + (global::inputFiles.size()>1 ? global::nJobs : 0);
+  size_t nValues = metrics::nRows*metrics::kNMetrics;
+  void *shared = mmap(nullptr,nValues*sizeof(std::atomic<long long>),PROT_READ|PROT_WRITE,MAP_SHARED|MAP_ANONYMOUS,-1,0);
+  if (shared == MAP_FAILED) { std::cerr << "Unable to allocate metrics" << std::endl; return false; }
+  metrics::rows = (std::atomic<long long>*)shared;
+  for (size_t i=0; i<nValues; i++) new (&metrics::rows[i]) std::atomic<long long>(0);
+  metrics::values = metrics::rows;
+  metrics::rowPids.assign(metrics::nRows,0);
+  metrics::rowPids[0] = getpid();
+  
+  if (global::metricsSocket != "")
+  {
+    sockaddr_un addr;
+    memset(&addr,0,sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path,global::metricsSocket.c_str(),sizeof(addr.sun_path)-1);
+    unlink(global::metricsSocket.c_str());
+    metrics::listenFd = socket(AF_UNIX,SOCK_STREAM,0);
+    if (metrics::listenFd<0 || bind(metrics::listenFd,(sockaddr*)&addr,sizeof(addr))!=0 || listen(metrics::listenFd,8)!=0)
+    {
+      std::cerr << "Unable to listen for metrics on " << global::metricsSocket << std::endl;
+      return false;
+    }
+  }
+  else
+  {
+    sockaddr_in addr;
+    memset(&addr,0,sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_port        = htons(global::metricsPort);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int yes = 1;
+    metrics::listenFd = socket(AF_INET,SOCK_STREAM,0);
+    if (metrics::listenFd>=0) setsockopt(metrics::listenFd,SOL_SOCKET,SO_REUSEADDR,&yes,sizeof(yes));
+    if (metrics::listenFd<0 || bind(metrics::listenFd,(sockaddr*)&addr,sizeof(addr))!=0 || listen(metrics::listenFd,8)!=0)
+    {
+      std::cerr << "Unable to listen for metrics on port " << global::metricsPort << std::endl;
+      return false;
+    }
+  }
+  
+  metrics::start = metrics::lastTime = std::chrono::steady_clock::now();
+  for (int i=0; i<metrics::kNMetrics; i++) metrics::lastValues[i] = 0;
+  metrics::stop   = false;
+  metrics::server = std::thread(ServeMetrics);
+  return true;
+}
+
+
+
+/*
+ * 
+ * Function: StopMetricsServer
+ * 
+ * Stops the metrics endpoint, if running.
+ * 
+ * @return (none)
+ * 
+ */
+void StopMetricsServer()
+{
+  if (!metrics::server.joinable()) return;
+  metrics::stop = true;
+  metrics::server.join();
+  close(metrics::listenFd);
+  if (global::metricsSocket != "") unlink(global::metricsSocket.c_str());
+}
+
+
+
+/*
+ * 
+ * Function: MetricsAddWorker
+ * 
+ * Registers a batch worker process, whose gauges and memory are then
+ * reported.
+ * 
+ * @param  pid     Process ID of the worker
+ * @param  worker  Worker index
+ * @return (none)
+ * 
+ */
+void MetricsAddWorker(pid_t pid, int worker)
+{
+  if (!metrics::values || worker+1 >= metrics::nRows) return;
+  std::lock_guard<std::mutex> guard(metrics::workersLock);
+  metrics::rowPids[worker+1] = pid;
+}
+
+
+
+/*
+ * 
+ * Function: MetricsRemoveWorker
+ * 
+ * Forgets a batch worker process once it has been waited for, so that
+ * its process ID (which may be reused) and its gauges are no longer
+ * reported. Its counters are still part of the totals.
+ * 
+ * @param  pid  Process ID of the worker
+ * @return (none)
+ * 
+ */
+void MetricsRemoveWorker(pid_t pid)
+{
+  if (!metrics::values) return;
+  std::lock_guard<std::mutex> guard(metrics::workersLock);
+  for (int r=1; r<metrics::nRows; r++)
+    if (metrics::rowPids[r] == pid) metrics::rowPids[r] = 0;
+}
+
+
+
+/*
+ * 
+ * Function: MetricsEnterWorker
+ * 
+ * Makes the present process (a batch worker, just forked) update the
+ * row of values of its worker index.
+ * 
+ * @param  worker  Worker index
+ * @return (none)
+ * 
+ */
+void MetricsEnterWorker(int worker)
+{
+  if (!metrics::values || worker+1 >= metrics::nRows) return;
+  metrics::values = metrics::rows + (worker+1)*metrics::kNMetrics;
+}
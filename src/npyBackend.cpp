@@ -0,0 +1,362 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <set>
+#include <map>
+#include <algorithm>
+#include <memory>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <histogramAccumulator.h>
+#include <outputBackend.h>
+
+/*
+ * 
+ * NumPy output layout. The output "file" is a directory, with one .npy
+ * file (NumPy format 1.0, readable with numpy.load) per object:
+ * 
+ *   <output>/<table>.npy           Tables: 1D structured arrays with one
+ *                                  float32 field per column
+ *   <output>/<dir>/<name>.npy      2D histograms: float64 contents of
+ *                                  shape (binsY+2, binsX+2), with the
+ *                                  underflow and overflow bins as in ROOT
+ *                                  (no errors nor statistics); 1D
+ *                                  histograms: float64 (bins+2)
+ *   <output>/<dir>/axes.npy        Binning of the first histogram of the
+ *                                  directory, float64: binsX, xMin, xMax
+ *                                  (and binsY, yMin, yMax for 2D). All the
+ *                                  histograms of a configuration share it;
+ *                                  in photoElectrons bin p+1 is pixel p
+ *   <output>/<dir>/entries.npy     Entries of the 1D histograms of the
+ *                                  directory, in the order written:
+ *                                  structured array with the fields name
+ *                                  (64 bytes) and entries (float64)
+ *   <output>/Profiles/<name>.npy   Graphs: float32 of shape (2, n), x and y
+ * 
+ * Rows are appended to the tables as they are filled; the header of a
+ * table (or of an entries file) is rewritten with the number of rows
+ * whenever it is written.
+ * 
+ */
+
+
+
+/*
+ * 
+ * Function: NpyHeader
+ * 
+ * Builds the header of a .npy file (magic string, version 1.0, length
+ * and dictionary), padded with spaces to a multiple of 64 bytes and to
+ * at least a given size.
+ * 
+ * @param  descr    Data type, as a Python literal
+ * @param  shape    Shape, as a Python tuple
+ * @param  minSize  Minimum size of the header
+ * @return Header
+ * 
+ */
+static std::string NpyHeader(std::string descr, std::string shape, size_t minSize)
+{
+  std::string dict = "{'descr': " + descr + ", 'fortran_order': False, 'shape': " + shape + ", }";
+  size_t size = 10 + dict.size() + 1;
+  size = (size+63)/64*64;
+  if (size < minSize) size = minSize;
+  dict.resize(size-11,' ');
+  dict += '\n';
+  
+  std::string header("\x93NUMPY\x01\x00",8);
+  header += char((size-10) & 0xff);
+  header += char((size-10) >> 8);
+  return header + dict;
+}
+
+
+
+/*
+ * 
+ * Function: NpyType
+ * 
+ * Data type of a .npy file in the byte order of the machine.
+ * 
+ * @param  type  Type and size (e.g. "f4")
+ * @return Data type, as a Python literal
+ * 
+ */
+static std::string NpyType(std::string type)
+{
+  uint16_t one = 1;
+  return std::string("'") + (*(char*)&one ? '<' : '>') + type + "'";
+}
+
+
+
+/*
+ * 
+ * Class: NpyOutputTable
+ * 
+ * Table written as a structured array, whose rows are appended to the
+ * file as they are filled.
+ * 
+ */
+class NpyOutputTable : public OutputTable
+{
+  private:
+    
+    FILE       *file;
+    std::string descr;
+    size_t      nColumns;
+    long long   nRows;
+    size_t      headerSize;
+    long long  &bytes; // Size of the whole output
+  
+  public:
+    
+    NpyOutputTable(FILE *f, std::string columns, long long &outputBytes) : file(f), nColumns(0), nRows(0), bytes(outputBytes)
+    {
+      descr = "[";
+      size_t start = 0;
+      while (start <= columns.size())
+      {
+        size_t end = columns.find(':',start);
+        if (end == std::string::npos) end = columns.size();
+        descr += "('" + columns.substr(start,end-start) + "', " + NpyType("f4") + "), ";
+        nColumns++;
+        start = end+1;
+      }
+      descr += "]";
+      
+      // Room for any number of rows, so that the header can be rewritten
+      std::string header = NpyHeader(descr,"(1000000000000000000,)",0);
+      headerSize = header.size();
+      bytes     += headerSize;
+      Write();
+    }
+    
+    ~NpyOutputTable()
+    {
+      Write();
+      fclose(file);
+    }
+    
+    void Fill(const float *values)
+    {
+      fwrite(values,sizeof(float),nColumns,file);
+      nRows++;
+      bytes += sizeof(float)*nColumns;
+    }
+    
+    void Write()
+    {
+      std::string header = NpyHeader(descr,"(" + std::to_string(nRows) + ",)",headerSize);
+      fseeko(file,0,SEEK_SET);
+      fwrite(header.data(),1,header.size(),file);
+      fseeko(file,0,SEEK_END);
+      fflush(file);
+    }
+    
+    void Sync() { fsync(fileno(file)); }
+};
+
+
+
+/*
+ * 
+ * Class: NpyOutput
+ * 
+ * Output written as a directory of .npy files (see the layout above).
+ * 
+ */
+class NpyOutput : public OutputFile
+{
+  private:
+    
+    std::string top;
+    long long   bytes;
+    std::set<std::string> axesWritten; // Directories with their binning
+    std::vector<std::unique_ptr<NpyOutputTable>> tables;
+    
+    // Entries of the 1D histograms of a directory, appended as written
+    struct EntriesFile
+    {
+      FILE     *file;
+      long long nRows;
+      size_t    headerSize;
+    };
+    std::map<std::string,EntriesFile> entriesFiles;
+    static const size_t kNameWidth = 64; // Longer names are cut
+    
+    std::string EntriesType() { return "[('name', 'S" + std::to_string(kNameWidth) + "'), ('entries', " + NpyType("f8") + ")]"; }
+    
+    std::string Path(std::string dir, std::string name)
+    {
+      return top + "/" + (dir == "" ? "" : dir + "/") + name + ".npy";
+    }
+    
+    void WriteArray(std::string dir, std::string name, std::string type, std::string shape, const void *data, size_t size)
+    {
+      std::string path   = Path(dir,name);
+      std::string header = NpyHeader(type,shape,0);
+      FILE *file = fopen(path.c_str(),"wb");
+      if (file == nullptr || fwrite(header.data(),1,header.size(),file) != header.size() || fwrite(data,1,size,file) != size)
+        std::cerr << "Error writing " << path << std::endl;
+      if (file != nullptr) fclose(file);
+      bytes += header.size() + size;
+    }
+    
+    void WriteAxes(std::string dir, const std::vector<double> &axes)
+    {
+      if (!axesWritten.insert(dir).second) return;
+      WriteArray(dir,"axes",NpyType("f8"),"(" + std::to_string(axes.size()) + ",)",axes.data(),sizeof(double)*axes.size());
+    }
+    
+    void AddEntries(std::string dir, std::string name, double entries)
+    {
+      auto file = entriesFiles.find(dir);
+      if (file == entriesFiles.end())
+      {
+        std::string path = Path(dir,"entries");
+        EntriesFile entriesFile = {fopen(path.c_str(),"wb"), 0, 0};
+        if (entriesFile.file == nullptr)
+        {
+          std::cerr << "Error writing " << path << std::endl;
+          return;
+        }
+        // Room for any number of rows, so that the header can be rewritten
+        std::string header = NpyHeader(EntriesType(),"(1000000000000000000,)",0);
+        entriesFile.headerSize = header.size();
+        fwrite(header.data(),1,header.size(),entriesFile.file);
+        bytes += header.size();
+        file = entriesFiles.insert(std::make_pair(dir,entriesFile)).first;
+      }
+      
+      char row[kNameWidth+sizeof(double)] = {};
+      memcpy(row,name.data(),name.size()<kNameWidth ? name.size() : kNameWidth);
+      memcpy(row+kNameWidth,&entries,sizeof(double));
+      fwrite(row,1,sizeof(row),file->second.file);
+      file->second.nRows++;
+      bytes += sizeof(row);
+    }
+    
+    void WriteEntries(bool sync)
+    {
+      for (auto &dir : entriesFiles)
+      {
+        EntriesFile &f = dir.second;
+        std::string header = NpyHeader(EntriesType(),"(" + std::to_string(f.nRows) + ",)",f.headerSize);
+        fseeko(f.file,0,SEEK_SET);
+        fwrite(header.data(),1,header.size(),f.file);
+        fseeko(f.file,0,SEEK_END);
+        fflush(f.file);
+        if (sync) fsync(fileno(f.file));
+      }
+    }
+  
+  public:
+    
+    NpyOutput(std::string directory) : top(directory), bytes(0) {}
+    ~NpyOutput() { Close(); }
+    
+    bool HasDirectory(std::string dir)
+    {
+      struct stat st;
+      return stat((top + "/" + dir).c_str(),&st) == 0 && S_ISDIR(st.st_mode);
+    }
+    
+    void MakeDirectory(std::string dir)
+    {
+      for (size_t slash=dir.find('/'); ; slash=dir.find('/',slash+1))
+      {
+        mkdir((top + "/" + dir.substr(0,slash)).c_str(),0755);
+        if (slash == std::string::npos) break;
+      }
+    }
+    
+    OutputTable *GetTable(std::string name, std::string columns)
+    {
+      std::string path = Path("",name);
+      FILE *file = fopen(path.c_str(),"wb");
+      if (file == nullptr)
+      {
+        std::cerr << "Error writing " << path << std::endl;
+        return nullptr;
+      }
+      tables.push_back(std::unique_ptr<NpyOutputTable>(new NpyOutputTable(file,columns,bytes)));
+      return tables.back().get();
+    }
+    
+    void WriteHistogram(std::string dir, std::string name, const HistogramAccumulator &histo)
+    {
+      const std::vector<double> &contents = histo.GetContents();
+      WriteAxes(dir,{(double)histo.GetNbinsX(),histo.GetXmin(),histo.GetXmax(),(double)histo.GetNbinsY(),histo.GetYmin(),histo.GetYmax()});
+      std::string shape = "(" + std::to_string(histo.GetNbinsY()+2) + ", " + std::to_string(histo.GetNbinsX()+2) + ")";
+      WriteArray(dir,name,NpyType("f8"),shape,contents.data(),sizeof(double)*contents.size());
+    }
+    
+    void WriteHistogram(std::string dir, std::string name, int nBins, double xMin, double xMax, const std::vector<double> &contents, double entries)
+    {
+      std::vector<double> bins(contents);
+      bins.resize(nBins+2,0.);
+      WriteAxes(dir,{(double)nBins,xMin,xMax});
+      WriteArray(dir,name,NpyType("f8"),"(" + std::to_string(nBins+2) + ",)",bins.data(),sizeof(double)*bins.size());
+      AddEntries(dir,name,entries);
+    }
+    
+    void WriteGraph(std::string dir, std::string name, int n, const float *x, const float *y)
+    {
+      std::vector<float> xy(x,x+n);
+      xy.insert(xy.end(),y,y+n);
+      WriteArray(dir,name,NpyType("f4"),"(2, " + std::to_string(n) + ")",xy.data(),sizeof(float)*xy.size());
+    }
+    
+    long long Commit()
+    {
+      WriteEntries(true);
+      for (auto &table : tables)
+      {
+        table->Write();
+        table->Sync();
+      }
+      return bytes;
+    }
+    
+    long long Size() { return bytes; }
+    
+    void Close()
+    {
+      WriteEntries(false);
+      for (auto &dir : entriesFiles) fclose(dir.second.file);
+      entriesFiles.clear();
+      tables.clear();
+    }
+};
+
+
+
+/*
+ * 
+ * Function: OpenNpyOutput
+ * 
+ * Creates the directory of a NumPy output. Files already there are
+ * replaced as objects with the same names are written.
+ * 
+ * @param  directory  Output directory
+ * @param  resume     Whether the output is being resumed (not available)
+ * @return The output, or nullptr in case of errors.
+ * 
+ */
+OutputFile *OpenNpyOutput(std::string directory, bool resume)
+{
+  struct stat st;
+  if (resume || (mkdir(directory.c_str(),0755) != 0 && (errno != EEXIST || stat(directory.c_str(),&st) != 0 || !S_ISDIR(st.st_mode))))
+  {
+    std::cerr << "Error opening output directory " << directory << "!" << std::endl;
+    return nullptr;
+  }
+  return new NpyOutput(directory);
+}
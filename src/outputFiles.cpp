@@ -0,0 +1,305 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <cstdio>
+
+#include <EventIO.hh>
+
+#include <iact-reader.h>
+#include <outputFiles.h>
+#include <outputBackend.h>
+#include <analysisConfig.h>
+#include <streaming.h>
+#include <telescopeSummary.h>
+#include <profileFits.h>
+#include <photoElectrons.h>
+#include <eventSelection.h>
+#include <trace.h>
+
+/*
+ * 
+ * The namespace outputFiles keeps track of the output chunks when the
+ * output rolls over to numbered files (--max-output-size,
+ * --events-per-file): the chunks already closed and the one being
+ * written. Only visible within the present translation unit.
+ * 
+ */
+namespace outputFiles
+{
+  struct Chunk
+  {
+    std::string fileName;
+    int         firstEvent; // Event numbers of the first and last
+    int         lastEvent;  // events analyzed in the chunk
+    int         nEvents;
+  };
+  
+  std::vector<Chunk> chunks;
+  Chunk              current;
+};
+
+
+
+/*
+ * 
+ * Function: OpenOutputFile
+ * 
+ * Opens an output file in the format of the output (--format): a ROOT
+ * file or a directory of NumPy arrays.
+ * 
+ * @param  fileName  File (or directory) name
+ * @param  resume    Whether the output file is being resumed
+ * @return The output file, or nullptr in case of errors.
+ * 
+ */
+OutputFile *OpenOutputFile(std::string fileName, bool resume)
+{
+#ifndef IACT_NO_ROOT
+  if (global::outputFormat == "root") return OpenRootOutput(fileName,resume);
+#endif
+  return OpenNpyOutput(fileName,resume);
+}
+
+
+
+/*
+ * 
+ * Function: RolloverEnabled
+ * 
+ * Tells whether the output rolls over to numbered files.
+ * 
+ * @return "true" if --max-output-size or --events-per-file were given.
+ * 
+ */
+bool RolloverEnabled()
+{
+  return global::maxOutputSize>0 || global::eventsPerFile>0;
+}
+
+
+
+/*
+ * 
+ * Function: ChunkFileName
+ * 
+ * Name of a numbered output file: "<output>_<NNN>.root".
+ * 
+ * @param  number  Chunk number
+ * @return File name
+ * 
+ */
+static std::string ChunkFileName(int number)
+{
+  std::string output = global::outputFileName;
+  char suffix[16];
+  snprintf(suffix,sizeof(suffix),"_%03d",number);
+  
+  size_t dot = output.find_last_of('.');
+  if (dot == std::string::npos || dot < output.find_last_of('/')+1) dot = output.size();
+  return output.substr(0,dot) + suffix + output.substr(dot);
+}
+
+
+
+/*
+ * 
+ * Function: OpenChunk
+ * 
+ * Opens an output file (or reopens it if resuming) with its directories,
+ * and prepares the tables written to every output file.
+ * 
+ * @param  fileName  Output file name
+ * @param  resume    Whether the output file is being resumed
+ * @return The output file, or nullptr in case of errors.
+ * 
+ */
+static OutputFile *OpenChunk(std::string fileName, bool resume)
+{
+  OutputFile *outputFile = OpenOutputFile(fileName,resume);
+  if (outputFile == nullptr) return nullptr;
+  if (!OpenConfigOutputs(outputFile,resume))
+  {
+    delete outputFile;
+    return nullptr;
+  }
+  
+  // Create a folder to save the longitudinal profiles if needed
+  if (!resume && global::saveLongi) outputFile->MakeDirectory("Profiles");
+  
+  // In streaming mode every event is committed as soon as it ends
+  if (global::streamMode) InitStreaming(outputFile);
+  
+  // Summary of every telescope in every event
+  if (global::telSummary) InitTelescopeSummary(outputFile);
+  
+  // Fits of the longitudinal profiles of every event
+  if (global::fitModel != "") InitProfileFits(outputFile);
+  
+  // Photo-electrons of every telescope in every event
+  if (global::peMode != "") InitPhotoElectrons(outputFile);
+  
+  // Header of every event, with the result of the event selection
+  InitEventTable(outputFile);
+  
+  return outputFile;
+}
+
+
+
+/*
+ * 
+ * Function: CloseChunk
+ * 
+ * Writes the tables of an output file and closes it (along with the
+ * files of the configurations that have their own).
+ * 
+ * @param  outputFile  Output file
+ * @return (none)
+ * 
+ */
+static void CloseChunk(OutputFile *outputFile)
+{
+  if (global::streamMode) StreamingSummary();
+  if (global::telSummary) WriteTelescopeSummary();
+  if (global::fitModel != "") WriteProfileFits();
+  if (global::peMode != "") WritePhotoElectrons();
+  WriteEventTable();
+  
+  outputFile->Close();
+  CloseConfigOutputs();
+}
+
+
+
+/*
+ * 
+ * Function: OpenOutput
+ * 
+ * Opens the output: global::outputFileName or, when rolling over, the
+ * first numbered file.
+ * 
+ * @param  resume  Whether the output file is being resumed
+ * @return The output file, or nullptr in case of errors.
+ * 
+ */
+OutputFile *OpenOutput(bool resume)
+{
+  outputFiles::chunks.clear();
+  outputFiles::current = {RolloverEnabled() ? ChunkFileName(0) : global::outputFileName, 0, 0, 0};
+  return OpenChunk(outputFiles::current.fileName,resume);
+}
+
+
+
+/*
+ * 
+ * Function: RollOutputIfFull
+ * 
+ * Called when a new event begins. If the present output file already
+ * reached the maximum size or number of events, it is closed and the
+ * next numbered file is opened, so that every file holds whole events.
+ * The header of the new file is then written with the new event.
+ * 
+ * @param  outputFile  Output file (replaced by the new one)
+ * @param  firstEvent  Set to "true" if the output rolled over
+ * @return "false" if the new file could not be opened, "true" otherwise.
+ * 
+ */
+bool RollOutputIfFull(std::unique_ptr<OutputFile> &outputFile, bool &firstEvent)
+{
+  using outputFiles::current;
+  
+  if (!RolloverEnabled() || current.nEvents == 0) return true;
+  
+  bool full = (global::eventsPerFile>0 && current.nEvents>=global::eventsPerFile) ||
+              (global::maxOutputSize>0 && outputFile->Size()>=global::maxOutputSize);
+  if (!full) return true;
+  
+  TraceSpan span("Rollover","chunk",outputFiles::chunks.size());
+  
+  CloseChunk(outputFile.get());
+  outputFiles::chunks.push_back(current);
+  
+  current = {ChunkFileName(outputFiles::chunks.size()), 0, 0, 0};
+  outputFile.reset(OpenChunk(current.fileName,false));
+  firstEvent = true;
+  
+  std::cout << "Output rolled over to " << current.fileName << std::endl;
+  return outputFile != nullptr;
+}
+
+
+
+/*
+ * 
+ * Function: AddOutputEvent
+ * 
+ * Counts an analyzed event in the present output file.
+ * 
+ * @param  event  Event number
+ * @return (none)
+ * 
+ */
+void AddOutputEvent(int event)
+{
+  using outputFiles::current;
+  if (current.nEvents == 0) current.firstEvent = event;
+  current.lastEvent = event;
+  current.nEvents++;
+}
+
+
+
+/*
+ * 
+ * Function: WriteManifest
+ * 
+ * Writes the list of output files with the range of events in each one
+ * ("<output>.manifest"), so that they can be read in parallel. File
+ * names are given relative to the directory of the manifest.
+ * 
+ * @return "true" in case of success, "false" otherwise.
+ * 
+ */
+static bool WriteManifest()
+{
+  std::string fileName = global::outputFileName + ".manifest";
+  std::ofstream out(fileName);
+  if (!out.is_open())
+  {
+    std::cerr << "Unable to write manifest " << fileName << std::endl;
+    return false;
+  }
+  
+  out << "# file firstEvent lastEvent events" << std::endl;
+  for (const outputFiles::Chunk &c : outputFiles::chunks)
+    out << c.fileName.substr(c.fileName.find_last_of('/')+1) << " " << c.firstEvent << " " << c.lastEvent << " " << c.nEvents << std::endl;
+  
+  return out.good();
+}
+
+
+
+/*
+ * 
+ * Function: CloseOutput
+ * 
+ * Writes the tables of the present output file and closes it. When
+ * rolling over, the manifest of all the files is written too.
+ * 
+ * @param  outputFile  Output file
+ * @return "true" in case of success, "false" otherwise.
+ * 
+ */
+bool CloseOutput(OutputFile *outputFile)
+{
+  if (outputFile == nullptr) return false; // Rollover failed
+  CloseChunk(outputFile);
+  if (!RolloverEnabled()) return true;
+  
+  outputFiles::chunks.push_back(outputFiles::current);
+  return WriteManifest();
+}
@@ -0,0 +1,400 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <functional>
+#include <cstring>
+
+#include <EventIO.hh>
+
+#include <iact-reader.h>
+#include <photoElectrons.h>
+#include <outputBackend.h>
+#include <analysisConfig.h>
+#include <rawEventIO.h>
+#include <workStealing.h>
+#include <trace.h>
+
+/*
+ * 
+ * The namespace photoElectrons holds the ntuple with one entry per
+ * telescope and event, and the photo-electrons of the present event
+ * waiting to be accumulated. Their storage is kept from one event to
+ * the next. Only visible within the present translation unit.
+ * 
+ */
+namespace photoElectrons
+{
+  OutputTable *tuple      = nullptr;
+  OutputFile  *outputFile = nullptr;
+  std::vector<PhotoElectrons> queue; // Only the first nQueued are in use
+  int          nQueued    = 0;
+  std::vector<char> raw;             // Data of a 1208 block read from a stream
+};
+
+
+
+/*
+ * 
+ * Struct: ItemSource
+ * 
+ * Access to the data of a 1208 block loaded in the IO buffer.
+ * 
+ */
+struct ItemSource
+{
+  eventio::EventIO::Item *item;
+  
+  bool Int16(int16_t &v)          { item->GetInt16(v); return true; }
+  bool Int32(int32_t &v)          { item->GetInt32(v); return true; }
+  bool Reals(float *v, size_t n)  { if (n>0) item->GetReal(v,n); return true; }
+};
+
+
+
+/*
+ * 
+ * Struct: ByteSource
+ * 
+ * Access to the data of a 1208 block held in memory, checking that
+ * nothing is read beyond its end.
+ * 
+ */
+struct ByteSource
+{
+  const char *data;
+  size_t      size;
+  
+  bool Get(void *v, size_t n)
+  {
+    if (n > size) return false;
+    memcpy(v,data,n);
+    data += n;
+    size -= n;
+    return true;
+  }
+  bool Int16(int16_t &v)          { return Get(&v,2); }
+  bool Int32(int32_t &v)          { return Get(&v,4); }
+  bool Reals(float *v, size_t n)  { return Get(v,4*n); }
+};
+
+
+
+/*
+ * 
+ * Function: Decode
+ * 
+ * Decodes the photo-electrons of one telescope (1208 block) into the
+ * arrays of a PhotoElectrons object. The block holds the total number of
+ * photo-electrons and of pixels, some flags (from version 2 on; bit 0:
+ * amplitudes are present), and then the list of non-empty pixels, each
+ * one with its pixel number, number of photo-electrons, their arrival
+ * times and (optionally) their amplitudes.
+ * 
+ * @param  src      Data source
+ * @param  version  Version of the block
+ * @param  ident    Identifier of the block (array*1000+telescope)
+ * @param  pe       Output: photo-electrons
+ * @return "true" in case of success, "false" if the block is broken.
+ * 
+ */
+template <class Source>
+static bool Decode(Source &src, int version, long ident, PhotoElectrons &pe)
+{
+  int32_t nPE, nPixels, nonEmpty;
+  int16_t flags = 0;
+  
+  pe.arrayNumber = ident/1000;
+  pe.telNumber   = ident%1000;
+  pe.pixel.clear();
+  pe.time.clear();
+  pe.amplitude.clear();
+  
+  if (!src.Int32(nPE) || !src.Int32(nPixels)) return false;
+  if (version > 1 && !src.Int16(flags)) return false;
+  if (!src.Int32(nonEmpty)) return false;
+  if (nPE < 0 || nPixels < 0 || nonEmpty < 0 || nonEmpty > nPixels) return false;
+  pe.nPixels    = nPixels;
+  pe.nPixelsHit = 0;
+  
+  bool amplitudes = flags & 1;
+  pe.pixel.reserve(nPE);
+  pe.time.reserve(nPE);
+  if (amplitudes) pe.amplitude.reserve(nPE);
+  
+  for (int i=0; i<nonEmpty; i++)
+  {
+    int16_t pixel;
+    int32_t n;
+    if (!src.Int16(pixel) || !src.Int32(n)) return false;
+    int32_t ipix = (uint16_t)pixel;
+    if (ipix >= nPixels || n < 0) return false;
+    if (n > 0) pe.nPixelsHit++;
+    
+    size_t first = pe.time.size();
+    pe.pixel.insert(pe.pixel.end(),n,ipix);
+    pe.time.resize(first+n);
+    if (!src.Reals(pe.time.data()+first,n)) return false;
+    if (amplitudes)
+    {
+      pe.amplitude.resize(first+n);
+      if (!src.Reals(pe.amplitude.data()+first,n)) return false;
+    }
+  }
+  
+  return true;
+}
+
+
+
+/*
+ * 
+ * Function: DecodePhotoElectrons
+ * 
+ * Decodes a 1208 block loaded in the IO buffer.
+ * 
+ * @param  item  Eventio::Item object of type 1208
+ * @param  pe    Output: photo-electrons
+ * @return "true" in case of success, "false" if the block is broken.
+ * 
+ */
+bool DecodePhotoElectrons(eventio::EventIO::Item *item, PhotoElectrons &pe)
+{
+  ItemSource src = {item};
+  return Decode(src,item->Version(),item->Ident(),pe);
+}
+
+
+
+/*
+ * 
+ * Function: DecodePhotoElectrons
+ * 
+ * Decodes the data of a 1208 block held in memory.
+ * 
+ * @param  data     Data of the block (after its header)
+ * @param  size     Size of the data
+ * @param  version  Version of the block
+ * @param  ident    Identifier of the block
+ * @param  pe       Output: photo-electrons
+ * @return "true" in case of success, "false" if the block is broken.
+ * 
+ */
+bool DecodePhotoElectrons(const char *data, size_t size, int version, long ident, PhotoElectrons &pe)
+{
+  ByteSource src = {data, size};
+  return Decode(src,version,ident,pe);
+}
+
+
+
+/*
+ * 
+ * Function: PhotoElectrons::Accumulate
+ * 
+ * Accumulates the photo-electrons of the telescope: arrival time
+ * moments, total amplitude and, if requested, number and mean arrival
+ * time of the photo-electrons of each pixel.
+ * 
+ * @param  perPixel  Accumulate per pixel too
+ * @return (none)
+ * 
+ */
+void PhotoElectrons::Accumulate(bool perPixel)
+{
+  timeMoments  = MomentAccumulator();
+  amplitudeSum = 0;
+  
+  size_t n = Size();
+  for (size_t i=0; i<n; i++) timeMoments.Fill(time[i],1.);
+  if (amplitude.empty()) amplitudeSum = n;
+  else for (size_t i=0; i<n; i++) amplitudeSum += amplitude[i];
+  
+  if (!perPixel) return;
+  pixelCounts.assign(nPixels,0);
+  pixelTimes.assign(nPixels,0.);
+  for (size_t i=0; i<n; i++)
+  {
+    pixelCounts[pixel[i]]++;
+    pixelTimes[pixel[i]] += time[i];
+  }
+  for (int p=0; p<nPixels; p++) if (pixelCounts[p]>0) pixelTimes[p] /= pixelCounts[p];
+}
+
+
+
+/*
+ * 
+ * Function: InitPhotoElectrons
+ * 
+ * Creates (or retrieves, when resuming) the ntuple with the summary of
+ * the photo-electrons of each telescope in each event, and the
+ * directory for the per-pixel histograms (--pe pixel).
+ * 
+ * @param  outputFile  Output file
+ * @return (none)
+ * 
+ */
+void InitPhotoElectrons(OutputFile *outputFile)
+{
+  photoElectrons::outputFile = outputFile;
+  photoElectrons::nQueued  = 0;
+  
+  if (global::peMode == "pixel" && !outputFile->HasDirectory("photoElectrons")) outputFile->MakeDirectory("photoElectrons");
+  
+  photoElectrons::tuple = outputFile->GetTable("PhotoElectrons",
+    "run:event:tel:nPE:nPixels:nPixelsHit:timeMean:timeRMS:amplitudeSum");
+}
+
+
+
+/*
+ * 
+ * Function: NextQueued
+ * 
+ * Next free entry of the queue of the present event.
+ * 
+ * @return Entry to be filled
+ * 
+ */
+static PhotoElectrons &NextQueued()
+{
+  using namespace photoElectrons;
+  if (nQueued == (int)queue.size()) queue.resize(nQueued+1);
+  return queue[nQueued++];
+}
+
+
+
+/*
+ * 
+ * Function: AddPhotoElectrons
+ * 
+ * Decodes a 1208 block loaded in the IO buffer (top-level or within an
+ * array block) and queues it, if its telescope is analyzed.
+ * 
+ * @param  item  Eventio::Item object of type 1208
+ * @return (none)
+ * 
+ */
+void AddPhotoElectrons(eventio::EventIO::Item *item)
+{
+  if (photoElectrons::tuple == nullptr) return;
+  if (!TelescopeWanted(item->Ident()%1000)) return;
+  
+  PhotoElectrons &pe = NextQueued();
+  if (!DecodePhotoElectrons(item,pe))
+  {
+    std::cerr << "Broken photo-electrons block of telescope " << pe.telNumber << " will be skiped." << std::endl;
+    photoElectrons::nQueued--;
+  }
+}
+
+
+
+/*
+ * 
+ * Function: AddPhotoElectrons
+ * 
+ * Reads and decodes a 1208 sub-item of an array block being streamed
+ * from the input (see StreamTelescopeArray()) and queues it, if its
+ * telescope is analyzed. The whole sub-item is consumed.
+ * 
+ * @param  reader  Reader positioned at the data of the sub-item
+ * @param  header  Header of the sub-item
+ * @return "true" in case of success, "false" if the input is truncated.
+ * 
+ */
+bool AddPhotoElectrons(RawBlockReader &reader, const RawItemHeader &header)
+{
+  if (photoElectrons::tuple == nullptr || !TelescopeWanted(header.ident%1000)) return reader.Skip(header.length);
+  
+  std::vector<char> &raw = photoElectrons::raw;
+  raw.resize(header.length);
+  if (!reader.Read(raw.data(),raw.size())) return false;
+  
+  PhotoElectrons &pe = NextQueued();
+  if (!DecodePhotoElectrons(raw.data(),raw.size(),header.version,header.ident,pe))
+  {
+    std::cerr << "Broken photo-electrons block of telescope " << pe.telNumber << " will be skiped." << std::endl;
+    photoElectrons::nQueued--;
+  }
+  return true;
+}
+
+
+
+/*
+ * 
+ * Function: FlushPhotoElectrons
+ * 
+ * Accumulates the photo-electrons queued for the present event, one
+ * telescope per task on the shared pool, and writes the results. Called
+ * at the end of each event.
+ * 
+ * @return (none)
+ * 
+ */
+void FlushPhotoElectrons()
+{
+  using namespace photoElectrons;
+  
+  if (nQueued == 0 || tuple == nullptr) return;
+  
+  TraceSpan span("PhotoElectrons","telescopes",nQueued);
+  
+  bool perPixel = global::peMode == "pixel";
+  std::vector<std::function<void()>> tasks;
+  for (int i=0; i<nQueued; i++) tasks.push_back([i,perPixel]() { queue[i].Accumulate(perPixel); });
+  SharedPool(global::nThreads).Run(tasks);
+  
+  int evtNumber = global::thisEvent.GetEventNumber();
+  int runNumber = global::corHeader.GetRunNumber();
+  
+  for (int i=0; i<nQueued; i++)
+  {
+    const PhotoElectrons &pe = queue[i];
+    int telID = global::telDef.GetID(pe.telNumber);
+    
+    if (perPixel)
+    {
+      std::string name = "run" + std::to_string(runNumber) + "_event" + std::to_string(evtNumber) + "_tel" + std::to_string(telID);
+      std::vector<double> counts(pe.nPixels+2,0.);
+      std::vector<double> times(pe.nPixels+2,0.);
+      for (int p=0; p<pe.nPixels; p++)
+      {
+        counts[p+1] = pe.pixelCounts[p];
+        times[p+1]  = pe.pixelTimes[p];
+      }
+      outputFile->WriteHistogram("photoElectrons",name+"_pe",pe.nPixels,-0.5,pe.nPixels-0.5,counts,pe.Size());
+      outputFile->WriteHistogram("photoElectrons",name+"_petime",pe.nPixels,-0.5,pe.nPixels-0.5,times,pe.nPixelsHit);
+    }
+    
+    float values[9] = {
+      (float)runNumber, (float)evtNumber, (float)telID,
+      (float)pe.Size(), (float)pe.nPixels, (float)pe.nPixelsHit,
+      (float)pe.timeMoments.GetMean(), (float)pe.timeMoments.GetRMS(), (float)pe.amplitudeSum
+    };
+    tuple->Fill(values);
+  }
+  nQueued = 0;
+}
+
+
+
+/*
+ * 
+ * Function: WritePhotoElectrons
+ * 
+ * Accumulates the photo-electrons still queued and writes the ntuple to
+ * the output file. Must be called before the output file is closed.
+ * 
+ * @return (none)
+ * 
+ */
+void WritePhotoElectrons()
+{
+  if (photoElectrons::tuple == nullptr) return;
+  FlushPhotoElectrons();
+  photoElectrons::tuple->Write();
+  photoElectrons::tuple = nullptr;
+}
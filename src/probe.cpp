@@ -0,0 +1,326 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <EventIO.hh>
+
+#include <iact-reader.h>
+#include <rawEventIO.h>
+#include <eventSelection.h>
+#include <analysisConfig.h>
+#include <probe.h>
+
+/*
+ * 
+ * The namespace probe holds the figures gathered from the headers of an
+ * input file by --info, and the rates used to project the processing
+ * time. Rates are rough figures of one core of a recent machine, meant
+ * to size jobs relative to each other. Only visible within the present
+ * translation unit.
+ * 
+ */
+namespace probe
+{
+  const double kBytesPerSecond   = 500e6; // Reading the input
+  const double kBunchesPerSecond = 20e6;  // Analysis, per thread and configuration
+  
+  struct BlockStats
+  {
+    long long count;
+    long long bytes;
+  };
+  
+  struct Summary
+  {
+    long long bytes;
+    long      run;
+    int       nEvents;
+    int       nSelected;       // Events passing --select, --events and -m
+    int       nTelescopes;
+    int       nInputLines;     // Lines of the CORSIKA inputs (1212)
+    long long bunchesAnalyzed; // Bunches of the telescopes and events analyzed
+    std::map<int,BlockStats> blocks;  // By type (sub-items of 1204 too)
+    std::map<int,long long>  bunches; // By telescope, in all events
+  };
+};
+
+
+
+/*
+ * 
+ * Function: CountBunches
+ * 
+ * Counts the bunches of a block of type 1205 from the length of its
+ * data: 12 bytes of header and 16 bytes per bunch in compact format
+ * (32 bytes otherwise). Only the telescope number is read.
+ * 
+ * @param  in       Input file descriptor
+ * @param  header   Header of the block
+ * @param  data     Start of the data of the block
+ * @param  analyze  Whether the event of the block is analyzed
+ * @param  summary  Summary to be updated
+ * @return "true" in case of success, otherwise return "false".
+ * 
+ */
+static bool CountBunches(int in, const RawItemHeader &header, long long data, bool analyze, probe::Summary &summary)
+{
+  int16_t ids[2]; // Array and telescope numbers
+  if (header.length < 12 || pread(in,ids,sizeof(ids),data) != sizeof(ids)) return false;
+  
+  long long nBunches = (header.length-12) / (header.version>=1000 ? 16 : 32);
+  summary.bunches[ids[1]] += nBunches;
+  if (analyze && TelescopeWanted(ids[1])) summary.bunchesAnalyzed += nBunches;
+  return true;
+}
+
+
+
+/*
+ * 
+ * Function: ProbeFile
+ * 
+ * Goes over the blocks of an input file by their lengths, reading only
+ * the run and event headers, the telescope positions, the CORSIKA
+ * inputs and the headers of the sub-items of array blocks (1204). The
+ * event and telescope selections are applied as in the analysis, to
+ * count the bunches that would be analyzed.
+ * 
+ * @param  fileName  Input file name
+ * @param  summary   Output: summary of the file
+ * @return "true" in case of success, otherwise return "false".
+ * 
+ */
+static bool ProbeFile(std::string fileName, probe::Summary &summary)
+{
+  using std::cerr;
+  using std::endl;
+  
+  summary = probe::Summary();
+  
+  int in = open(fileName.c_str(),O_RDONLY);
+  struct stat st;
+  if (in < 0 || fstat(in,&st) != 0 || !S_ISREG(st.st_mode))
+  {
+    cerr << "The input summary needs a regular input file, unable to read " << fileName << "!" << endl;
+    if (in >= 0) close(in);
+    return false;
+  }
+  summary.bytes = st.st_size;
+  
+  global::telDef = TelescopeDefinition();
+  
+  std::vector<char> payload;
+  bool analyze = true;
+  bool error   = false;
+  
+  long long pos = 0;
+  while (pos < st.st_size && !error)
+  {
+    RawItemHeader header;
+    long long data = 0;
+    long long size = 0;
+    if (ReadItemHeader(in,pos,true,header))
+    {
+      data = pos + 4 + header.headerSize;
+      size = 4 + header.headerSize + header.length;
+    }
+    if (size == 0 || pos+size > st.st_size)
+    {
+      cerr << "Broken or truncated block at byte " << pos << " of " << fileName << endl;
+      error = true;
+      break;
+    }
+    
+    summary.blocks[header.type].count++;
+    summary.blocks[header.type].bytes += size;
+    
+    switch (header.type)
+    {
+      case 1200: /// CORSIKA run header
+        summary.run = header.ident;
+        break;
+      case 1201: /// Position and sizes of telescopes, to select telescopes
+      {
+        int32_t n;
+        payload.resize(header.length);
+        if (header.length < 4 || pread(in,payload.data(),header.length,data) != header.length) { error = true; break; }
+        memcpy(&n,payload.data(),4);
+        if (n < 0 || header.length < 4+16*(long long)n) { error = true; break; }
+        const float *values = (const float *)(payload.data()+4);
+        global::telDef.SetPositions(n,values,values+n,values+2*n,values+3*n);
+        if (global::onlyTelescopes!="")
+          global::telDef.SetUserIDs(global::onlyTelescopes);
+        SetConfigTelescopes();
+        summary.nTelescopes = n;
+        break;
+      }
+      case 1202: /// CORSIKA event header, to select events
+      {
+        std::vector<float> fields(global::thisEvent.GetNFields(),0.f);
+        int32_t n;
+        payload.resize(header.length);
+        if (header.length < 4 || pread(in,payload.data(),header.length,data) != header.length) { error = true; break; }
+        memcpy(&n,payload.data(),4);
+        if (n < 0 || n >= (int)fields.size() || header.length < 4+4*(long long)n) { error = true; break; }
+        fields[0] = n;
+        memcpy(fields.data()+1,payload.data()+4,4*n);
+        global::thisEvent.SetFields(fields.data());
+        
+        summary.nEvents++;
+        analyze = (global::nMaxEvents<=0 || summary.nSelected<global::nMaxEvents) && (!global::selectEvents || SelectEvent());
+        if (analyze) summary.nSelected++;
+        break;
+      }
+      case 1204: /// Array block: only the headers of its sub-items
+      {
+        long long end = data + header.length;
+        for (long long sub=data; sub<end && !error; )
+        {
+          RawItemHeader subHeader;
+          if (!ReadItemHeader(in,sub,false,subHeader) || sub+subHeader.headerSize+subHeader.length > end) { error = true; break; }
+          summary.blocks[subHeader.type].count++;
+          summary.blocks[subHeader.type].bytes += subHeader.headerSize + subHeader.length;
+          if (subHeader.type == 1205) error = !CountBunches(in,subHeader,sub+subHeader.headerSize,analyze,summary);
+          sub += subHeader.headerSize + subHeader.length;
+        }
+        break;
+      }
+      case 1205: /// Bunches outside of an array block
+        error = !CountBunches(in,header,data,analyze,summary);
+        break;
+      case 1212: /// CORSIKA inputs: only the number of lines
+      {
+        int32_t n;
+        if (header.length < 4 || pread(in,&n,4,data) != 4) { error = true; break; }
+        summary.nInputLines += n;
+        break;
+      }
+    }
+    if (error)
+    {
+      cerr << "Broken block " << header.type << " at byte " << pos << " of " << fileName << endl;
+      break;
+    }
+    
+    pos += size;
+  }
+  
+  close(in);
+  return !error;
+}
+
+
+
+/*
+ * 
+ * Function: ProjectedSeconds
+ * 
+ * Projects the time needed to analyze an input with the present options
+ * (threads and analysis configurations), see the rates above.
+ * 
+ * @param  summary  Summary of the input
+ * @return Time (s)
+ * 
+ */
+static double ProjectedSeconds(const probe::Summary &summary)
+{
+  double bunchSeconds = summary.bunchesAnalyzed * global::configs.size() / (probe::kBunchesPerSecond * global::nThreads);
+  return summary.bytes / probe::kBytesPerSecond + bunchSeconds;
+}
+
+
+
+/*
+ * 
+ * Function: PrintSummary
+ * 
+ * Prints the summary of an input as "key value" lines, to be read by
+ * scripts (e.g. to size batch jobs).
+ * 
+ * @param  summary  Summary of the input
+ * @return (none)
+ * 
+ */
+static void PrintSummary(const probe::Summary &summary)
+{
+  using std::cout;
+  using std::endl;
+  
+  cout << "bytes "       << summary.bytes       << endl;
+  cout << "run "         << summary.run         << endl;
+  cout << "inputlines "  << summary.nInputLines << endl;
+  cout << "telescopes "  << summary.nTelescopes << endl;
+  cout << "events "      << summary.nEvents     << endl;
+  cout << "selected "    << summary.nSelected   << endl;
+  
+  long long total = 0;
+  for (const auto &tel : summary.bunches) total += tel.second;
+  cout << "bunches "         << total                   << endl;
+  cout << "bunchesanalyzed " << summary.bunchesAnalyzed << endl;
+  
+  // Block types: number of blocks and bytes (with their headers)
+  for (const auto &block : summary.blocks)
+    cout << "block " << block.first << " " << block.second.count << " " << block.second.bytes << endl;
+  
+  // Telescopes: bunches in all events
+  for (const auto &tel : summary.bunches)
+    cout << "telescope " << tel.first << " " << tel.second << endl;
+  
+  cout << "seconds " << ProjectedSeconds(summary) << endl;
+}
+
+
+
+/*
+ * 
+ * Function: ProbeInputs
+ * 
+ * Summarizes every input file from its headers only (--info): events,
+ * telescopes, bunches per telescope, blocks and bytes per block type,
+ * and a projected processing time. With several inputs, the projected
+ * time of the whole job (over global::nJobs processes) closes the list.
+ * 
+ * @return "true" in case of success, otherwise return "false".
+ * 
+ */
+bool ProbeInputs()
+{
+  using std::cout;
+  using std::endl;
+  
+  std::vector<std::string> inputs = global::inputFiles;
+  if (inputs.empty()) inputs.push_back(global::inputFileName);
+  
+  bool   ok      = true;
+  double seconds = 0.;
+  for (const std::string &fileName : inputs)
+  {
+    probe::Summary summary;
+    if (!ProbeFile(fileName,summary))
+    {
+      ok = false;
+      continue;
+    }
+    cout << "file " << fileName << endl;
+    PrintSummary(summary);
+    cout << endl;
+    seconds += ProjectedSeconds(summary);
+  }
+  
+  if (inputs.size()>1)
+  {
+    int nProcesses = std::min<int>(global::nJobs,inputs.size());
+    cout << "files " << inputs.size() << endl;
+    cout << "seconds " << seconds/nProcesses << endl;
+  }
+  
+  return ok;
+}
@@ -0,0 +1,416 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <functional>
+#include <algorithm>
+#include <cmath>
+
+#include <EventIO.hh>
+
+#include <iact-reader.h>
+#include <profileFits.h>
+#include <outputBackend.h>
+#include <workStealing.h>
+#include <trace.h>
+
+/*
+ * 
+ * The namespace profileFits holds the ntuple with the fits and the
+ * profiles waiting to be fitted. Profiles are fitted in batches, spread
+ * over the threads of the shared pool; the storage of the batch is kept between
+ * batches, so that no memory is allocated once it is warm. Only visible
+ * within the present translation unit.
+ * 
+ */
+namespace profileFits
+{
+  const int    maxPars     = 4;
+  const int    maxIter     = 100;
+  const int    batchSize   = 256; // Events fitted at once
+  const int    jobsPerTask = 8;
+  const double fixedLambda = 70.; // g/cm2, lambda of the "gh3" model
+  
+  struct Job
+  {
+    int   run, event;
+    int   nPoints;
+    float step;
+    std::vector<float> charged, cherenkov;
+    ProfileFit chargedFit, cherenkovFit;
+  };
+  
+  OutputTable *tuple = nullptr;
+  std::vector<Job> jobs;   // Batch storage (only the first nJobs are in use)
+  int      nJobs = 0;
+};
+
+
+
+/*
+ * 
+ * Function: ProfileModelKnown
+ * 
+ * Tells whether a profile model can be fitted: "gh" (Gaisser-Hillas,
+ * four parameters) or "gh3" (Gaisser-Hillas with lambda fixed to
+ * 70 g/cm2).
+ * 
+ * @param  model  Model name
+ * @return "true" if the model is known, "false" otherwise.
+ * 
+ */
+bool ProfileModelKnown(std::string model)
+{
+  return model == "gh" || model == "gh3";
+}
+
+
+
+/*
+ * 
+ * Function: GaisserHillas
+ * 
+ * Value of the Gaisser-Hillas function and its derivatives with respect
+ * to the parameters (nMax, x0, xMax, lambda).
+ * 
+ * @param  p     Parameters
+ * @param  x     Depth (g/cm2)
+ * @param  grad  Output: derivatives (4 values)
+ * @return Function value
+ * 
+ */
+static double GaisserHillas(const double *p, double x, double *grad)
+{
+  double t = x - p[1];
+  double d = p[2] - p[1];
+  if (t <= 0)
+  {
+    grad[0] = grad[1] = grad[2] = grad[3] = 0;
+    return 0;
+  }
+  
+  double l = std::log(t/d);
+  double f = p[0] * std::exp((d*l + p[2] - x)/p[3]);
+  
+  grad[0] = f/p[0];
+  grad[1] = f*(1. - l - d/t)/p[3];
+  grad[2] = f*l/p[3];
+  grad[3] = -f*(d*l + p[2] - x)/(p[3]*p[3]);
+  return f;
+}
+
+
+
+/*
+ * 
+ * Function: Chi2
+ * 
+ * Chi2 of the Gaisser-Hillas function against a profile, with Poisson
+ * errors (at least one particle).
+ * 
+ * @param  p     Parameters
+ * @param  y     Profile
+ * @param  n     Number of points
+ * @param  step  Depth step (g/cm2), point i is at depth (i+1)*step
+ * @return Chi2
+ * 
+ */
+static double Chi2(const double *p, const float *y, int n, float step)
+{
+  double grad[profileFits::maxPars];
+  double chi2 = 0;
+  for (int i=0; i<n; i++)
+  {
+    double r = y[i] - GaisserHillas(p,(i+1)*step,grad);
+    chi2 += r*r/std::max((double)y[i],1.);
+  }
+  return chi2;
+}
+
+
+
+/*
+ * 
+ * Function: SolveLinear
+ * 
+ * Solves a small linear system by Gaussian elimination with partial
+ * pivoting. The matrix and vector are overwritten.
+ * 
+ * @param  a  Matrix (row major, n x n)
+ * @param  b  Right hand side, output: solution
+ * @param  n  Dimension (at most profileFits::maxPars)
+ * @return "true" if the matrix is not singular, "false" otherwise.
+ * 
+ */
+static bool SolveLinear(double a[][profileFits::maxPars], double *b, int n)
+{
+  for (int c=0; c<n; c++)
+  {
+    int pivot = c;
+    for (int r=c+1; r<n; r++) if (std::fabs(a[r][c]) > std::fabs(a[pivot][c])) pivot = r;
+    if (!(std::fabs(a[pivot][c]) > 0)) return false;
+    if (pivot != c)
+    {
+      for (int k=0; k<n; k++) std::swap(a[c][k],a[pivot][k]);
+      std::swap(b[c],b[pivot]);
+    }
+    for (int r=c+1; r<n; r++)
+    {
+      double m = a[r][c]/a[c][c];
+      for (int k=c; k<n; k++) a[r][k] -= m*a[c][k];
+      b[r] -= m*b[c];
+    }
+  }
+  for (int c=n-1; c>=0; c--)
+  {
+    for (int k=c+1; k<n; k++) b[c] -= a[c][k]*b[k];
+    b[c] /= a[c][c];
+  }
+  return true;
+}
+
+
+
+/*
+ * 
+ * Function: FitProfile
+ * 
+ * Fits the Gaisser-Hillas function to a profile with the Levenberg-
+ * Marquardt method. Points after the last non-empty one (below ground)
+ * are not fitted. Does not allocate memory.
+ * 
+ * @param  y          Profile
+ * @param  n          Number of points
+ * @param  step       Depth step (g/cm2), point i is at depth (i+1)*step
+ * @param  fixLambda  Keep lambda fixed to 70 g/cm2
+ * @param  fit        Output: fit result
+ * @return (none)
+ * 
+ */
+void FitProfile(const float *y, int n, float step, bool fixLambda, ProfileFit &fit)
+{
+  using profileFits::maxPars;
+  
+  int nPars = fixLambda ? 3 : maxPars;
+  
+  // Fitted range and starting point at the maximum
+  while (n>0 && !(y[n-1] > 0)) n--;
+  int iMax = 0;
+  for (int i=1; i<n; i++) if (y[i] > y[iMax]) iMax = i;
+  
+  double p[maxPars] = {n>0 ? y[iMax] : 0., 0., (iMax+1.)*step, profileFits::fixedLambda};
+  
+  fit.nPoints = n;
+  fit.status  = 2;
+  fit.chi2ndf = 0;
+  if (n <= nPars || !(p[0] > 0) || !(step > 0))
+  {
+    fit.nMax = p[0]; fit.x0 = p[1]; fit.xMax = p[2]; fit.lambda = p[3];
+    return;
+  }
+  
+  double chi2   = Chi2(p,y,n,step);
+  double mu     = 1.e-3;
+  int    nSteps = 0; // Steps accepted
+  fit.status    = 1;
+  
+  for (int iter=0; iter<profileFits::maxIter; iter++)
+  {
+    // Normal equations
+    double a[maxPars][maxPars] = {};
+    double b[maxPars] = {};
+    double grad[maxPars];
+    for (int i=0; i<n; i++)
+    {
+      double w = 1./std::max((double)y[i],1.);
+      double r = y[i] - GaisserHillas(p,(i+1)*step,grad);
+      for (int j=0; j<nPars; j++)
+      {
+        b[j] += w*r*grad[j];
+        for (int k=0; k<=j; k++) a[j][k] += w*grad[j]*grad[k];
+      }
+    }
+    for (int j=0; j<nPars; j++) for (int k=0; k<j; k++) a[k][j] = a[j][k];
+    
+    // Damped steps until one improves the chi2
+    bool improved = false;
+    while (!improved && mu < 1.e10)
+    {
+      double m[maxPars][maxPars];
+      double delta[maxPars];
+      for (int j=0; j<nPars; j++)
+      {
+        for (int k=0; k<nPars; k++) m[j][k] = a[j][k];
+        m[j][j] += mu*(a[j][j] > 0 ? a[j][j] : 1.);
+        delta[j] = b[j];
+      }
+      
+      double trial[maxPars] = {p[0], p[1], p[2], p[3]};
+      bool   valid = SolveLinear(m,delta,nPars);
+      for (int j=0; j<nPars && valid; j++) trial[j] += delta[j];
+      valid = valid && trial[0] > 0 && trial[2]-trial[1] > 1. && trial[3] > 1.;
+      
+      double trialChi2 = valid ? Chi2(trial,y,n,step) : 0;
+      if (valid && std::isfinite(trialChi2) && trialChi2 <= chi2)
+      {
+        improved = true;
+        nSteps++;
+        bool converged = chi2-trialChi2 <= 1.e-6*chi2;
+        for (int j=0; j<nPars; j++) p[j] = trial[j];
+        chi2 = trialChi2;
+        mu   = std::max(mu*0.1,1.e-12);
+        if (converged) { fit.status = 0; break; }
+      }
+      else mu *= 10.;
+    }
+    if (!improved || fit.status == 0) break;
+  }
+  
+  // Not improving any more at the largest damping means a minimum too,
+  // unless no step was ever accepted and the start values are left
+  if (mu >= 1.e10) fit.status = nSteps>0 ? 0 : 3;
+  
+  fit.nMax    = p[0];
+  fit.x0      = p[1];
+  fit.xMax    = p[2];
+  fit.lambda  = p[3];
+  fit.chi2ndf = chi2/(n-nPars);
+}
+
+
+
+/*
+ * 
+ * Function: InitProfileFits
+ * 
+ * Creates (or retrieves, when resuming) the ntuple with the profile
+ * fits of each event in the output file: run and event numbers, then
+ * nMax, x0, xMax, lambda, chi2/ndf and status of the fits to the charged
+ * particle ("ch") and Cherenkov ("cer") profiles. The status is 0 if the
+ * fit converged, 1 if it did not within the iterations allowed, 2 if
+ * the profile has too few points to be fitted and 3 if no step could be
+ * taken from the start values, which are then left in the table.
+ * 
+ * @param  outputFile  Output file
+ * @return (none)
+ * 
+ */
+void InitProfileFits(OutputFile *outputFile)
+{
+  profileFits::tuple = outputFile->GetTable("ProfileFits",
+    "run:event:chNMax:chX0:chXMax:chLambda:chChi2ndf:chStatus:cerNMax:cerX0:cerXMax:cerLambda:cerChi2ndf:cerStatus");
+  profileFits::nJobs = 0;
+}
+
+
+
+/*
+ * 
+ * Function: AddProfileFits
+ * 
+ * Queues the charged particles and Cherenkov profiles of an event to be
+ * fitted. The Cherenkov profile, integrated along the depth in CORSIKA,
+ * is fitted as photons emitted per depth step. The batch is fitted when
+ * full.
+ * 
+ * @param  run        Run number
+ * @param  event      Event number
+ * @param  charged    Charged particles profile
+ * @param  cherenkov  Cherenkov photons profile
+ * @param  nPoints    Number of points of the profiles
+ * @param  step       Depth step (g/cm2)
+ * @return (none)
+ * 
+ */
+void AddProfileFits(int run, int event, const float *charged, const float *cherenkov, int nPoints, float step)
+{
+  if (profileFits::tuple == nullptr) return;
+  
+  if (profileFits::nJobs == (int)profileFits::jobs.size()) profileFits::jobs.resize(profileFits::nJobs+1);
+  profileFits::Job &job = profileFits::jobs[profileFits::nJobs++];
+  
+  job.run     = run;
+  job.event   = event;
+  job.nPoints = nPoints;
+  job.step    = step;
+  job.charged.assign(charged,charged+nPoints);
+  job.cherenkov.assign(cherenkov,cherenkov+nPoints);
+  
+  bool integrated = true;
+  for (int i=1; i<nPoints && integrated; i++) if (cherenkov[i] < cherenkov[i-1]) integrated = false;
+  if (integrated) for (int i=nPoints-1; i>0; i--) job.cherenkov[i] -= job.cherenkov[i-1];
+  
+  if (profileFits::nJobs >= profileFits::batchSize) FlushProfileFits();
+}
+
+
+
+/*
+ * 
+ * Function: FlushProfileFits
+ * 
+ * Fits the queued profiles, on the threads of the pool, and adds the
+ * results to the ntuple in the order they were queued.
+ * 
+ * @return (none)
+ * 
+ */
+void FlushProfileFits()
+{
+  using namespace profileFits;
+  
+  if (nJobs == 0 || tuple == nullptr) return;
+  
+  TraceSpan span("FitProfiles","events",nJobs);
+  
+  bool fixLambda = global::fitModel == "gh3";
+  
+  std::vector<std::function<void()>> tasks;
+  for (int first=0; first<nJobs; first+=jobsPerTask)
+  {
+    int last = std::min(first+jobsPerTask,nJobs);
+    tasks.push_back([first,last,fixLambda]()
+    {
+      for (int j=first; j<last; j++)
+      {
+        Job &job = jobs[j];
+        FitProfile(job.charged.data(),job.nPoints,job.step,fixLambda,job.chargedFit);
+        FitProfile(job.cherenkov.data(),job.nPoints,job.step,fixLambda,job.cherenkovFit);
+      }
+    });
+  }
+  
+  SharedPool(global::nThreads).Run(tasks);
+  
+  for (int j=0; j<nJobs; j++)
+  {
+    const ProfileFit &ch  = jobs[j].chargedFit;
+    const ProfileFit &cer = jobs[j].cherenkovFit;
+    float values[14] = {
+      (float)jobs[j].run, (float)jobs[j].event,
+      (float)ch.nMax,  (float)ch.x0,  (float)ch.xMax,  (float)ch.lambda,  (float)ch.chi2ndf,  (float)ch.status,
+      (float)cer.nMax, (float)cer.x0, (float)cer.xMax, (float)cer.lambda, (float)cer.chi2ndf, (float)cer.status
+    };
+    tuple->Fill(values);
+  }
+  nJobs = 0;
+}
+
+
+
+/*
+ * 
+ * Function: WriteProfileFits
+ * 
+ * Fits the profiles still queued and writes the ntuple to the output
+ * file. Must be called before the output file is closed.
+ * 
+ * @return (none)
+ * 
+ */
+void WriteProfileFits()
+{
+  if (profileFits::tuple == nullptr) return;
+  FlushProfileFits();
+  profileFits::tuple->Write();
+  profileFits::tuple = nullptr;
+}
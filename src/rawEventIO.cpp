@@ -0,0 +1,406 @@
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <rawEventIO.h>
+
+/*
+ * 
+ * The namespace pipeInput keeps the state of the stream through which
+ * the IO buffer reads a pipe (see OpenPipeInput()). Only visible within
+ * the present translation unit.
+ * 
+ */
+namespace pipeInput
+{
+  FILE      *source   = nullptr; // Pipe being read
+  FILE      *stream   = nullptr; // Stream handed to the IO buffer
+  long long  position = 0;       // Bytes of the pipe behind the stream position
+  long long  taken    = 0;       // Bytes past the stream position already taken by a RawBlockReader
+};
+
+
+
+/*
+ * 
+ * Function: SeekableInput
+ * 
+ * Tells whether an input is a regular file, which can be read at any
+ * position, rather than a pipe (see OpenPipeInput()).
+ * 
+ * @param  input  Input file
+ * @return "true" if it is a regular file, otherwise return "false".
+ * 
+ */
+bool SeekableInput(FILE *input)
+{
+  struct stat st;
+  return fstat(fileno(input),&st)==0 && S_ISREG(st.st_mode);
+}
+
+
+
+/*
+ * 
+ * Function: Discard
+ * 
+ * Reads and drops a number of bytes from a sequential input.
+ * 
+ * @param  input  Input file
+ * @param  size   Number of bytes to drop
+ * @return "true" in case of success, otherwise return "false".
+ * 
+ */
+static bool Discard(FILE *input, long long size)
+{
+  char buffer[65536];
+  while (size > 0)
+  {
+    size_t n = size < (long long)sizeof(buffer) ? size : sizeof(buffer);
+    if (fread(buffer,1,n,input) != n) return false;
+    size -= n;
+  }
+  return true;
+}
+
+
+
+/*
+ * 
+ * Function: PipeRead
+ * 
+ * Read function of the stream of OpenPipeInput(). Bytes already taken
+ * by a RawBlockReader are handed back as zeros instead of being read
+ * again from the pipe.
+ * 
+ */
+static ssize_t PipeRead(void *, char *buffer, size_t size)
+{
+  using namespace pipeInput;
+  
+  size_t n;
+  if (taken > 0)
+  {
+    n = taken < (long long)size ? taken : size;
+    memset(buffer,0,n);
+    taken -= n;
+  }
+  else
+  {
+    n = fread(buffer,1,size,source);
+    if (n == 0 && ferror(source)) return -1;
+  }
+  
+  position += n;
+  return n;
+}
+
+
+
+/*
+ * 
+ * Function: PipeSeek
+ * 
+ * Seek function of the stream of OpenPipeInput(): only forwards. Bytes
+ * already taken by a RawBlockReader are passed over, the others are
+ * read from the pipe and dropped.
+ * 
+ */
+static int PipeSeek(void *, off64_t *offset, int whence)
+{
+  using namespace pipeInput;
+  
+  long long target = whence==SEEK_SET ? *offset : (whence==SEEK_CUR ? position+*offset : -1);
+  if (target < position) return -1;
+  
+  long long size = target - position;
+  long long pass = size < taken ? size : taken;
+  taken -= pass;
+  if (!Discard(source,size-pass)) return -1;
+  
+  position = target;
+  *offset  = position;
+  return 0;
+}
+
+
+
+/*
+ * 
+ * Function: PipeClose
+ * 
+ * Close function of the stream of OpenPipeInput(). The pipe itself is
+ * left open.
+ * 
+ */
+static int PipeClose(void *)
+{
+  pipeInput::stream = nullptr;
+  return 0;
+}
+
+
+
+/*
+ * 
+ * Function: OpenPipeInput
+ * 
+ * Opens a stream through which the IO buffer reads a pipe, so that the
+ * data of a block can be taken from the pipe by a RawBlockReader while
+ * the buffer stays in step: when the buffer then skips the block, the
+ * bytes already taken are passed over. The stream is unbuffered, so
+ * that it never reads ahead of the buffer. Only one pipe can be open
+ * at a time.
+ * 
+ * @param  input  Pipe to be read
+ * @return Stream for the IO buffer, or nullptr on errors.
+ * 
+ */
+FILE *OpenPipeInput(FILE *input)
+{
+  using namespace pipeInput;
+  
+  if (stream != nullptr) return nullptr;
+  
+  cookie_io_functions_t functions = {PipeRead, nullptr, PipeSeek, PipeClose};
+  stream = fopencookie(nullptr,"rb",functions);
+  if (stream == nullptr) return nullptr;
+  setvbuf(stream,nullptr,_IONBF,0);
+  
+  source   = input;
+  position = 0;
+  taken    = 0;
+  return stream;
+}
+
+
+
+/*
+ * 
+ * Function: RawBlockReader::RawBlockReader
+ * 
+ * @param  input   Input file (regular, or the stream of OpenPipeInput()), positioned right after a block header
+ * @param  length  Length of the block data
+ * 
+ */
+RawBlockReader::RawBlockReader(FILE *input, long long length) : file(input), offset(0), remaining(length)
+{
+  sequential = input == pipeInput::stream;
+  if (sequential) file   = pipeInput::source;
+  else            offset = ftello(input);
+}
+
+
+
+/*
+ * 
+ * Function: RawBlockReader::Read
+ * 
+ * Reads the next bytes of the block data.
+ * 
+ * @param  buffer  Where to store the data
+ * @param  size    Number of bytes to read
+ * @return "true" in case of success, "false" on errors or past the end of the block.
+ * 
+ */
+bool RawBlockReader::Read(void *buffer, size_t size)
+{
+  if ((long long)size > remaining) return false;
+  
+  // From a pipe, the bytes are taken out of the stream of the IO buffer
+  if (sequential)
+  {
+    if (fread(buffer,1,size,file) != size) return false;
+    pipeInput::taken += size;
+    remaining        -= size;
+    return true;
+  }
+  
+  char *p = (char *)buffer;
+  size_t done = 0;
+  while (done < size)
+  {
+    ssize_t n = pread(fileno(file),p+done,size-done,offset+done);
+    if (n <= 0) return false;
+    done += n;
+  }
+  
+  offset    += size;
+  remaining -= size;
+  return true;
+}
+
+
+
+/*
+ * 
+ * Function: RawBlockReader::Skip
+ * 
+ * Skips the next bytes of the block data.
+ * 
+ * @param  size  Number of bytes to skip
+ * @return "true" in case of success, otherwise return "false".
+ * 
+ */
+bool RawBlockReader::Skip(long long size)
+{
+  if (size > remaining) return false;
+  
+  if (sequential)
+  {
+    if (!Discard(file,size)) return false;
+    pipeInput::taken += size;
+  }
+  
+  offset    += size;
+  remaining -= size;
+  return true;
+}
+
+
+
+/*
+ * 
+ * Function: DecodeHeader
+ * 
+ * Decodes the words of an item header. Headers are made of a type word
+ * (type in bits 0-15, user flag in bit 16, extension flag in bit 17,
+ * version in bits 20-31), the identifier and a length word (length in
+ * bits 0-29, "only sub-items" flag in bit 30), followed by an extension
+ * word with 12 more bits of length if the extension flag is set. Data
+ * is assumed to be in the byte order of the machine.
+ * 
+ * @param  words   First three words of the header
+ * @param  header  Header to be filled (but for the length extension)
+ * @return "true" if the header has an extension word, "false" otherwise.
+ * 
+ */
+static bool DecodeHeader(const uint32_t *words, RawItemHeader &header)
+{
+  header.type         = words[0] & 0xffff;
+  header.userFlag     = (words[0] >> 16) & 1;
+  header.version      = (words[0] >> 20) & 0xfff;
+  header.ident        = (int32_t)words[1];
+  header.onlySubItems = (words[2] >> 30) & 1;
+  header.length       = words[2] & 0x3fffffff;
+  header.headerSize   = 12;
+  return (words[0] >> 17) & 1;
+}
+
+
+
+/*
+ * 
+ * Function: RawBlockReader::ReadSubItemHeader
+ * 
+ * Reads the header of the next sub-item in the block data (see
+ * DecodeHeader()).
+ * 
+ * @param  header  Header to be filled
+ * @return "true" in case of success, otherwise return "false".
+ * 
+ */
+bool RawBlockReader::ReadSubItemHeader(RawItemHeader &header)
+{
+  uint32_t words[3];
+  if (!Read(words,sizeof(words))) return false;
+  
+  if (DecodeHeader(words,header))
+  {
+    uint32_t extension;
+    if (!Read(&extension,sizeof(extension))) return false;
+    header.length    |= (long long)(extension & 0xfff) << 30;
+    header.headerSize = 16;
+  }
+  
+  return header.length <= remaining;
+}
+
+
+
+/*
+ * 
+ * Function: ParseItemHeader
+ * 
+ * Decodes the header of an item from the bytes at its start. Top-level
+ * items start with a synchronization marker.
+ * 
+ * @param  data      Bytes at the start of the item
+ * @param  size      Number of bytes available (20 are enough)
+ * @param  topLevel  Whether the item is a top-level one
+ * @param  header    Header to be filled
+ * @return "true" in case of success, otherwise return "false".
+ * 
+ */
+bool ParseItemHeader(const void *data, size_t size, bool topLevel, RawItemHeader &header)
+{
+  uint32_t words[5];
+  size_t   first = topLevel ? 1 : 0;
+  memcpy(words,data,size<sizeof(words) ? size : sizeof(words));
+  if (size < 4*(first+3)) return false;
+  if (topLevel && words[0] != kSyncMarker) return false;
+  
+  if (DecodeHeader(words+first,header))
+  {
+    if (size < 4*(first+4)) return false;
+    header.length    |= (long long)(words[first+3] & 0xfff) << 30;
+    header.headerSize = 16;
+  }
+  return true;
+}
+
+
+
+/*
+ * 
+ * Function: ReadItemHeader
+ * 
+ * Reads the header of an item at a given position of a file, without
+ * moving the file offset (see ParseItemHeader()).
+ * 
+ * @param  fd        File descriptor
+ * @param  offset    Position of the item
+ * @param  topLevel  Whether the item is a top-level one
+ * @param  header    Header to be filled
+ * @return "true" in case of success, otherwise return "false".
+ * 
+ */
+bool ReadItemHeader(int fd, long long offset, bool topLevel, RawItemHeader &header)
+{
+  char    words[20];
+  ssize_t n = pread(fd,words,sizeof(words),offset);
+  return n > 0 && ParseItemHeader(words,n,topLevel,header);
+}
+
+
+
+/*
+ * 
+ * Function: EncodeItemHeader
+ * 
+ * Builds the header of a top-level item with the type, version, flags
+ * and identifier of a given header and a new length.
+ * 
+ * @param  header  Header to be copied
+ * @param  length  Length of the data of the item
+ * @param  buffer  Output: synchronization marker and header (20 bytes at most)
+ * @return Number of bytes of the header (with the marker).
+ * 
+ */
+size_t EncodeItemHeader(const RawItemHeader &header, long long length, char *buffer)
+{
+  bool     extension = length >= (1LL << 30);
+  uint32_t words[5];
+  words[0] = kSyncMarker;
+  words[1] = (header.type & 0xffff) | (header.userFlag ? 1u<<16 : 0) | (extension ? 1u<<17 : 0) | ((uint32_t)header.version << 20);
+  words[2] = (uint32_t)header.ident;
+  words[3] = (length & 0x3fffffff) | (header.onlySubItems ? 1u<<30 : 0);
+  words[4] = (length >> 30) & 0xfff;
+  
+  size_t size = extension ? 20 : 16;
+  memcpy(buffer,words,size);
+  return size;
+}
@@ -0,0 +1,196 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <utility>
+#include <cstdio>
+
+#include <TObject.h>
+#include <TFile.h>
+#include <TNtuple.h>
+#include <TH1.h>
+#include <TH2.h>
+#include <TGraph.h>
+
+#include <histogramAccumulator.h>
+#include <outputBackend.h>
+
+/*
+ * 
+ * Class: RootOutputTable
+ * 
+ * Table written as a TNtuple in the top directory of a ROOT file.
+ * 
+ */
+class RootOutputTable : public OutputTable
+{
+  private:
+    
+    TFile   *file;
+    TNtuple *tuple; // Owned by the file
+  
+  public:
+    
+    RootOutputTable(TFile *f, TNtuple *t) : file(f), tuple(t) {}
+    
+    void Fill(const float *values) { tuple->Fill(values); }
+    void Write()
+    {
+      file->cd();
+      tuple->Write("",TObject::kOverwrite);
+    }
+};
+
+
+
+/*
+ * 
+ * Class: TrackedFile
+ * 
+ * A TFile that keeps the ranges of the file written since they were
+ * last taken, so that a copy of it can be brought up to date without
+ * copying it all (see SaveCheckpoint()). Writes done while the TFile is
+ * being constructed are not seen, so the ranges are only known from
+ * the second time they are taken on.
+ * 
+ */
+class TrackedFile : public TFile
+{
+  private:
+    
+    bool known;
+    std::vector<std::pair<long long,long long>> written;
+  
+  protected:
+    
+    Int_t SysWrite(Int_t fd, const void *buf, Int_t len)
+    {
+      long long at = TFile::SysSeek(fd,0,SEEK_CUR);
+      Int_t     n  = TFile::SysWrite(fd,buf,len);
+      if (n <= 0 || at < 0) return n;
+      // Consecutive writes make a single range
+      if (!written.empty() && written.back().second == at) written.back().second += n;
+      else written.push_back(std::make_pair(at,at+n));
+      return n;
+    }
+  
+  public:
+    
+    TrackedFile(const char *name, const char *option, const char *title, int compress) :
+      TFile(name,option,title,compress), known(false) {}
+    
+    bool TakeChanges(std::vector<std::pair<long long,long long>> &ranges)
+    {
+      ranges.swap(written);
+      written.clear();
+      bool wasKnown = known;
+      known = true;
+      return wasKnown;
+    }
+};
+
+
+
+/*
+ * 
+ * Class: RootOutput
+ * 
+ * Output written to a ROOT file: tables as TNtuple, histograms as TH1F
+ * and TH2F (with errors and statistics) and graphs as TGraph.
+ * 
+ */
+class RootOutput : public OutputFile
+{
+  private:
+    
+    TrackedFile *file;
+    std::vector<std::unique_ptr<RootOutputTable>> tables;
+  
+  public:
+    
+    RootOutput(TrackedFile *f) : file(f) {}
+    ~RootOutput() { delete file; }
+    
+    bool HasDirectory(std::string dir)  { return file->GetDirectory(dir.c_str()) != nullptr; }
+    void MakeDirectory(std::string dir) { file->mkdir(dir.c_str()); }
+    
+    OutputTable *GetTable(std::string name, std::string columns)
+    {
+      // Tables already in the file (when resuming) are filled further
+      file->cd();
+      TNtuple *tuple = (TNtuple*)file->Get(name.c_str());
+      if (tuple == nullptr) tuple = new TNtuple(name.c_str(),name.c_str(),columns.c_str());
+      tables.push_back(std::unique_ptr<RootOutputTable>(new RootOutputTable(file,tuple)));
+      return tables.back().get();
+    }
+    
+    void WriteHistogram(std::string dir, std::string name, const HistogramAccumulator &histo)
+    {
+      file->cd(dir.c_str());
+      TH2F h(name.c_str(),"",histo.GetNbinsX(),histo.GetXmin(),histo.GetXmax(),histo.GetNbinsY(),histo.GetYmin(),histo.GetYmax());
+      histo.Export(h);
+      h.Write();
+    }
+    
+    void WriteHistogram(std::string dir, std::string name, int nBins, double xMin, double xMax, const std::vector<double> &contents, double entries)
+    {
+      file->cd(dir.c_str());
+      TH1F h(name.c_str(),"",nBins,xMin,xMax);
+      for (int i=0; i<nBins+2 && i<(int)contents.size(); i++) h.SetBinContent(i,contents[i]);
+      h.SetEntries(entries);
+      h.Write();
+    }
+    
+    void WriteGraph(std::string dir, std::string name, int n, const float *x, const float *y)
+    {
+      TGraph g(n,x,y);
+      g.SetName(name.c_str());
+      g.SetTitle(name.c_str());
+      file->cd(dir.c_str());
+      g.Write();
+    }
+    
+    // Writes the keys list, directories and file header and flushes the
+    // file, so that it can be read back even if the program dies
+    long long Commit()
+    {
+      file->Write(0,TObject::kOverwrite);
+      file->Flush();
+      return file->GetEND();
+    }
+    
+    long long Size() { return file->GetEND(); }
+    
+    void Close()
+    {
+      file->Close();
+      tables.clear();
+    }
+    
+    bool TakeChanges(std::vector<std::pair<long long,long long>> &ranges) { return file->TakeChanges(ranges); }
+};
+
+
+
+/*
+ * 
+ * Function: OpenRootOutput
+ * 
+ * Opens (or reopens, when resuming) an output ROOT file.
+ * 
+ * @param  fileName  File name
+ * @param  resume    Whether the file is being resumed
+ * @return The output, or nullptr in case of errors.
+ * 
+ */
+OutputFile *OpenRootOutput(std::string fileName, bool resume)
+{
+  TrackedFile *file = new TrackedFile(fileName.c_str(),resume ? "update" : "recreate","",209);
+  if (file->IsZombie())
+  {
+    std::cerr << "Error opening output file " << fileName << "!" << std::endl;
+    delete file;
+    return nullptr;
+  }
+  return new RootOutput(file);
+}
@@ -0,0 +1,295 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <utility>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+
+#include <EventIO.hh>
+
+#include <iact-reader.h>
+#include <rawEventIO.h>
+#include <eventSelection.h>
+#include <analysisConfig.h>
+#include <metrics.h>
+#include <trace.h>
+#include <slice.h>
+
+/*
+ * 
+ * The namespace slice tells which system calls are available to copy
+ * data between files. Only visible within the present translation unit.
+ * 
+ */
+namespace slice
+{
+  bool copyFileRange = true;
+  bool sendFile      = true;
+};
+
+
+
+/*
+ * 
+ * Function: CopyRange
+ * 
+ * Appends a range of the input file to the output file, in the kernel
+ * when possible: copy_file_range() (which may share the data blocks on
+ * some file systems), sendfile(), or read and write as a last resort.
+ * 
+ * @param  in      Input file descriptor
+ * @param  offset  Start of the range in the input
+ * @param  out     Output file descriptor
+ * @param  size    Size of the range
+ * @return "true" in case of success, otherwise return "false".
+ * 
+ */
+static bool CopyRange(int in, long long offset, int out, long long size)
+{
+  while (size > 0)
+  {
+    ssize_t n = -1;
+    
+    if (slice::copyFileRange)
+    {
+      loff_t from = offset;
+      n = copy_file_range(in,&from,out,nullptr,size,0);
+      if (n < 0 && (errno==ENOSYS || errno==EXDEV || errno==EINVAL || errno==EOPNOTSUPP)) slice::copyFileRange = false;
+    }
+    if (n < 0 && slice::sendFile)
+    {
+      off_t from = offset;
+      n = sendfile(out,in,&from,size);
+      if (n < 0 && (errno==ENOSYS || errno==EINVAL)) slice::sendFile = false;
+    }
+    if (n < 0 && !slice::copyFileRange && !slice::sendFile)
+    {
+      char buffer[1<<16];
+      n = pread(in,buffer,size<(long long)sizeof(buffer) ? size : sizeof(buffer),offset);
+      if (n > 0 && write(out,buffer,n) != n) return false;
+    }
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    
+    offset += n;
+    size   -= n;
+  }
+  return true;
+}
+
+
+
+/*
+ * 
+ * Function: ReadPayload
+ * 
+ * Reads the data of a (small) item.
+ * 
+ * @param  in      Input file descriptor
+ * @param  offset  Start of the data
+ * @param  size    Size of the data
+ * @param  data    Output: data
+ * @return "true" in case of success, otherwise return "false".
+ * 
+ */
+static bool ReadPayload(int in, long long offset, long long size, std::vector<char> &data)
+{
+  data.resize(size);
+  return pread(in,data.data(),size,offset) == size;
+}
+
+
+
+/*
+ * 
+ * Function: CopyTelescopes
+ * 
+ * Copies an array block (1204) keeping only the sub-items of the
+ * telescopes analyzed (bunches, 1205, and photo-electrons, 1208), as
+ * raw bytes. The block header is rewritten with the new length.
+ * 
+ * @param  in      Input file descriptor
+ * @param  header  Header of the array block
+ * @param  data    Start of the data of the array block
+ * @param  out     Output file descriptor
+ * @return "true" in case of success, otherwise return "false".
+ * 
+ */
+static bool CopyTelescopes(int in, const RawItemHeader &header, long long data, int out)
+{
+  std::vector<std::pair<long long,long long>> kept;
+  long long length = 0;
+  
+  long long end = data + header.length;
+  for (long long pos=data; pos<end; )
+  {
+    RawItemHeader sub;
+    if (!ReadItemHeader(in,pos,false,sub) || pos+sub.headerSize+sub.length > end) return false;
+    long long size = sub.headerSize + sub.length;
+    
+    int telNumber = -1;
+    if (sub.type == 1205)
+    {
+      int16_t ids[2]; // Array and telescope numbers
+      if (pread(in,ids,sizeof(ids),pos+sub.headerSize) != sizeof(ids)) return false;
+      telNumber = ids[1];
+    }
+    else if (sub.type == 1208) telNumber = sub.ident%1000;
+    
+    if (telNumber < 0 || TelescopeWanted(telNumber))
+    {
+      kept.push_back(std::make_pair(pos,size));
+      length += size;
+    }
+    pos += size;
+  }
+  
+  char words[20];
+  size_t n = EncodeItemHeader(header,length,words);
+  if (write(out,words,n) != (ssize_t)n) return false;
+  for (const auto &range : kept) if (!CopyRange(in,range.first,out,range.second)) return false;
+  return true;
+}
+
+
+
+/*
+ * 
+ * Function: SliceInput
+ * 
+ * Copies the selected events of the input file (global::inputFileName)
+ * into a new IACT file (global::sliceFileName), without decoding their
+ * bunches. Run blocks (headers, telescope positions, inputs, run end)
+ * are always copied. Only event headers and telescope positions are
+ * decoded, to apply the event selection (--select, --events, -m) and
+ * the telescope selection (--only-telescopes, --config).
+ * 
+ * @return Number of events copied, or -1 in case of errors
+ * 
+ */
+int SliceInput()
+{
+  using std::cerr;
+  using std::cout;
+  using std::endl;
+  
+  TraceSpan span("Slice");
+  
+  int in = open(global::inputFileName.c_str(),O_RDONLY);
+  struct stat st;
+  if (in < 0 || fstat(in,&st) != 0 || !S_ISREG(st.st_mode))
+  {
+    cerr << "Slicing needs a regular input file, unable to read " << global::inputFileName << "!" << endl;
+    if (in >= 0) close(in);
+    return -1;
+  }
+  int out = open(global::sliceFileName.c_str(),O_WRONLY|O_CREAT|O_TRUNC,0644);
+  if (out < 0)
+  {
+    cerr << "Error opening output file " << global::sliceFileName << "!" << endl;
+    close(in);
+    return -1;
+  }
+  
+  global::telDef = TelescopeDefinition();
+  
+  std::vector<char> payload;
+  bool inEvent       = false;
+  bool keepEvent     = true;
+  bool allTelescopes = true; // No telescope is left out
+  bool error         = false;
+  int  nEvents       = 0;
+  int  nCopied       = 0;
+  
+  long long pos = 0;
+  while (pos < st.st_size && !error)
+  {
+    RawItemHeader header;
+    if (!ReadItemHeader(in,pos,true,header))
+    {
+      cerr << "Broken block at byte " << pos << " of " << global::inputFileName << endl;
+      error = true;
+      break;
+    }
+    long long data = pos + 4 + header.headerSize;
+    long long size = 4 + header.headerSize + header.length;
+    if (pos+size > st.st_size)
+    {
+      cerr << "Truncated block at byte " << pos << " of " << global::inputFileName << endl;
+      error = true;
+      break;
+    }
+    
+    MetricsAdd(metrics::kBlocks,1);
+    MetricsAdd(metrics::kInputBytes,size);
+    
+    switch (header.type)
+    {
+      case 1201: /// Position and sizes of telescopes, to select telescopes
+      {
+        int32_t n;
+        if (!ReadPayload(in,data,header.length,payload) || header.length < 4) { error = true; break; }
+        memcpy(&n,payload.data(),4);
+        if (n < 0 || header.length < 4+16*(long long)n) { error = true; break; }
+        const float *values = (const float *)(payload.data()+4);
+        global::telDef.SetPositions(n,values,values+n,values+2*n,values+3*n);
+        if (global::onlyTelescopes!="")
+          global::telDef.SetUserIDs(global::onlyTelescopes);
+        SetConfigTelescopes();
+        allTelescopes = true;
+        for (int t=0; t<n; t++) if (!TelescopeWanted(t)) allTelescopes = false;
+        break;
+      }
+      case 1202: /// CORSIKA event header, to select events
+      {
+        std::vector<float> fields(global::thisEvent.GetNFields(),0.f);
+        int32_t n;
+        if (!ReadPayload(in,data,header.length,payload) || header.length < 4) { error = true; break; }
+        memcpy(&n,payload.data(),4);
+        if (n < 0 || n >= (int)fields.size() || header.length < 4+4*(long long)n) { error = true; break; }
+        fields[0] = n;
+        memcpy(fields.data()+1,payload.data()+4,4*n);
+        global::thisEvent.SetFields(fields.data());
+        
+        nEvents++;
+        inEvent   = true;
+        keepEvent = (global::nMaxEvents<=0 || nCopied<global::nMaxEvents) && (!global::selectEvents || SelectEvent());
+        if (keepEvent) nCopied++;
+        if (keepEvent) MetricsAdd(metrics::kEvents,1);
+        MetricsSet(metrics::kCurrentEvent,global::thisEvent.GetEventNumber());
+        break;
+      }
+    }
+    if (error)
+    {
+      cerr << "Broken block " << header.type << " at byte " << pos << " of " << global::inputFileName << endl;
+      break;
+    }
+    
+    // Blocks of rejected events are not copied, array blocks only with
+    // the telescopes selected, everything else as it is
+    if (!inEvent || keepEvent)
+    {
+      if (header.type == 1204 && !allTelescopes) error = !CopyTelescopes(in,header,data,out);
+      else error = !CopyRange(in,pos,out,size);
+      if (error) cerr << "Error copying block " << header.type << " to " << global::sliceFileName << endl;
+    }
+    
+    if (header.type == 1209) inEvent = false;
+    pos += size;
+  }
+  
+  close(in);
+  if (close(out) != 0) error = true;
+  
+  if (error) return -1;
+  
+  cout << "Copied " << nCopied << " of " << nEvents << " events to " << global::sliceFileName << endl;
+  return nCopied;
+}
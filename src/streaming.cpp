@@ -0,0 +1,147 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cmath>
+
+#include <EventIO.hh>
+
+#include <iact-reader.h>
+#include <outputBackend.h>
+#include <checkpoint.h>
+#include <streaming.h>
+#include <metrics.h>
+
+/*
+ * 
+ * The namespace streaming keeps the latency statistics of the event
+ * commits done in streaming mode, together with the ntuple where the
+ * latency of every event is recorded. Only visible within the present
+ * translation unit.
+ * 
+ */
+namespace streaming
+{
+  OutputTable *latencyTuple = nullptr;
+  
+  int    nCommits   = 0;
+  double sumLatency = 0; // ms
+  double maxLatency = 0; // ms
+  int    nOverWarn  = 0; // Commits over --stream-warn
+  
+  // Latency of the last commit: it is only known after the commit is
+  // done, so it is stored in the ntuple along with the next one
+  int    lastEvent   = -1;
+  double lastLatency = 0;
+};
+
+
+
+/*
+ * 
+ * Function: InitStreaming
+ * 
+ * Creates (or retrieves, when resuming) the ntuple with the commit
+ * latency of each event in the output file.
+ * 
+ * @param  outputFile  Output file
+ * @return (none)
+ * 
+ */
+void InitStreaming(OutputFile *outputFile)
+{
+  streaming::nCommits   = 0;
+  streaming::sumLatency = 0;
+  streaming::maxLatency = 0;
+  streaming::nOverWarn  = 0;
+  streaming::lastEvent  = -1;
+  
+  streaming::latencyTuple = outputFile->GetTable("StreamLatency","event:latencyMs");
+}
+
+
+
+/*
+ * 
+ * Function: FillLatency
+ * 
+ * Adds the latency of the last commit to the ntuple.
+ * 
+ * @return (none)
+ * 
+ */
+static void FillLatency()
+{
+  float values[2] = {(float)streaming::lastEvent, (float)streaming::lastLatency};
+  if (streaming::latencyTuple) streaming::latencyTuple->Fill(values);
+}
+
+
+
+/*
+ * 
+ * Function: CommitEvent
+ * 
+ * Called at the end of each event (block 1209) in streaming mode.
+ * Commits the output file to disk so that the event can be read by
+ * other processes right away, and measures the latency from the end
+ * of the event to the data being on disk (including the work done for
+ * the event after its end was read). The latency is reported, also
+ * through the metrics endpoint, not bounded: commits over
+ * global::streamWarnLatency are only warned.
+ * 
+ * @param  outputFile  Output file
+ * @param  event       Event number
+ * @param  eventEnd    Time at which the event end (1209) was read
+ * @return (none)
+ * 
+ */
+void CommitEvent(OutputFile *outputFile, int event, std::chrono::steady_clock::time_point eventEnd)
+{
+  if (streaming::lastEvent>=0) FillLatency();
+  
+  CommitOutput(outputFile);
+  
+  double latency = std::chrono::duration<double,std::milli>(std::chrono::steady_clock::now()-eventEnd).count();
+  
+  streaming::nCommits++;
+  streaming::sumLatency += latency;
+  if (latency>streaming::maxLatency) streaming::maxLatency = latency;
+  streaming::lastEvent   = event;
+  streaming::lastLatency = latency;
+  
+  MetricsAdd(metrics::kCommits,1);
+  MetricsAdd(metrics::kLatencySum,llround(1.e3*latency));
+  MetricsSet(metrics::kLastLatency,llround(1.e3*latency));
+  
+  std::cout << "1209:   Event " << event << " committed to disk in " << std::fixed << std::setprecision(1) << latency << " ms" << std::defaultfloat << std::endl;
+  
+  if (latency>global::streamWarnLatency)
+  {
+    streaming::nOverWarn++;
+    std::cerr << "Warning: commit of event " << event << " took " << latency << " ms (over " << global::streamWarnLatency << " ms)" << std::endl;
+  }
+}
+
+
+
+/*
+ * 
+ * Function: StreamingSummary
+ * 
+ * Stores the latency of the last commit and prints the latency
+ * statistics. Must be called before the output file is closed.
+ * 
+ * @return (none)
+ * 
+ */
+void StreamingSummary()
+{
+  if (streaming::latencyTuple == nullptr || streaming::nCommits == 0) return;
+  
+  FillLatency();
+  streaming::latencyTuple->Write();
+  
+  std::cout << "Streaming: " << streaming::nCommits << " events committed, latency mean "
+            << streaming::sumLatency/streaming::nCommits << " ms, max " << streaming::maxLatency << " ms, "
+            << streaming::nOverWarn << " over " << global::streamWarnLatency << " ms" << std::endl;
+}
@@ -0,0 +1,82 @@
+#include <telescopeSummary.h>
+#include <outputBackend.h>
+
+/*
+ * 
+ * The namespace telSummary holds the ntuple with one entry per
+ * telescope and event. Only visible within the present translation
+ * unit.
+ * 
+ */
+namespace telSummary
+{
+  OutputTable *tuple = nullptr;
+};
+
+
+
+/*
+ * 
+ * Function: InitTelescopeSummary
+ * 
+ * Creates (or retrieves, when resuming) the ntuple with the summary of
+ * each telescope in each event in the output file.
+ * 
+ * @param  outputFile  Output file
+ * @return (none)
+ * 
+ */
+void InitTelescopeSummary(OutputFile *outputFile)
+{
+  telSummary::tuple = outputFile->GetTable("TelescopeSummary",
+    "run:event:tel:nPhot:nPhotFOV:lateralMean:lateralRMS:slantMean:slantRMS:timeMean:timeRMS:zEmissionMean:zEmissionRMS");
+}
+
+
+
+/*
+ * 
+ * Function: FillTelescopeSummary
+ * 
+ * Adds the summary of one telescope in one event to the ntuple.
+ * 
+ * @param  run      Run number
+ * @param  event    Event number
+ * @param  telID    Telescope ID
+ * @param  summary  Summary of the photons of the telescope
+ * @return (none)
+ * 
+ */
+void FillTelescopeSummary(int run, int event, int telID, const TelescopeSummary &summary)
+{
+  if (telSummary::tuple == nullptr) return;
+  
+  float values[13] = {
+    (float)run, (float)event, (float)telID,
+    (float)summary.nPhot, (float)summary.nPhotFOV,
+    (float)summary.lateral.GetMean(),   (float)summary.lateral.GetRMS(),
+    (float)summary.slant.GetMean(),     (float)summary.slant.GetRMS(),
+    (float)summary.time.GetMean(),      (float)summary.time.GetRMS(),
+    (float)summary.zEmission.GetMean(), (float)summary.zEmission.GetRMS()
+  };
+  telSummary::tuple->Fill(values);
+}
+
+
+
+/*
+ * 
+ * Function: WriteTelescopeSummary
+ * 
+ * Writes the ntuple to the output file. Must be called before the
+ * output file is closed.
+ * 
+ * @return (none)
+ * 
+ */
+void WriteTelescopeSummary()
+{
+  if (telSummary::tuple == nullptr) return;
+  telSummary::tuple->Write();
+  telSummary::tuple = nullptr;
+}
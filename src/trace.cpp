@@ -0,0 +1,262 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+
+#include <unistd.h>
+
+#include <trace.h>
+
+/*
+ * 
+ * The namespace trace keeps one ring buffer of spans per thread. Each
+ * buffer is only written by its own thread, without locks; the list of
+ * buffers is only locked when a thread records its first span. Buffers
+ * are read when the trace is written, once all threads are idle. When
+ * a buffer is full the oldest spans are overwritten.
+ * 
+ */
+namespace trace
+{
+  bool enabled = false;
+  std::chrono::steady_clock::time_point origin;
+  
+  const long capacity = 65536; // Spans per thread
+  
+  struct Span
+  {
+    const char *name;
+    const char *argName;
+    long        arg;
+    long long   begin;  // ns since origin
+    long long   duration;
+  };
+  
+  struct Buffer
+  {
+    int               tid;
+    std::vector<Span> spans;
+    std::atomic<long> count; // Spans recorded (including overwritten ones)
+    
+    Buffer(int id) : tid(id), spans(capacity), count(0) {}
+  };
+  
+  std::mutex                           buffersLock;
+  std::vector<std::unique_ptr<Buffer>> buffers;
+  thread_local Buffer                 *local = nullptr;
+  
+  std::vector<std::string> appendedFiles; // Events of other processes
+};
+
+
+
+/*
+ * 
+ * Function: StartTrace
+ * 
+ * Enables the recording of spans, taking the present time as origin.
+ * 
+ * @return (none)
+ * 
+ */
+void StartTrace()
+{
+  trace::origin  = std::chrono::steady_clock::now();
+  trace::enabled = true;
+}
+
+
+
+/*
+ * 
+ * Function: RecordSpan
+ * 
+ * Stores a span in the ring buffer of the calling thread (called by
+ * the TraceSpan destructor).
+ * 
+ * @param  name      Span name
+ * @param  argName   Name of the span argument (or nullptr)
+ * @param  arg       Span argument
+ * @param  begin     Start time (ns since the trace origin)
+ * @param  duration  Duration (ns)
+ * @return (none)
+ * 
+ */
+void RecordSpan(const char *name, const char *argName, long arg, long long begin, long long duration)
+{
+  if (trace::local == nullptr)
+  {
+    std::lock_guard<std::mutex> guard(trace::buffersLock);
+    trace::buffers.push_back(std::unique_ptr<trace::Buffer>(new trace::Buffer(trace::buffers.size())));
+    trace::local = trace::buffers.back().get();
+  }
+  
+  trace::Buffer &b = *trace::local;
+  long n = b.count.load(std::memory_order_relaxed);
+  trace::Span &span = b.spans[n % trace::capacity];
+  span.name     = name;
+  span.argName  = argName;
+  span.arg      = arg;
+  span.begin    = begin;
+  span.duration = duration;
+  b.count.store(n+1,std::memory_order_release);
+}
+
+
+
+/*
+ * 
+ * Function: WriteSpans
+ * 
+ * Writes the recorded spans of all threads as Chrome trace events
+ * ("complete" events, times in microseconds), separated by commas.
+ * 
+ * @param  out  Output stream
+ * @return Number of spans written
+ * 
+ */
+static long WriteSpans(std::ostream &out)
+{
+  std::lock_guard<std::mutex> guard(trace::buffersLock);
+  
+  long nWritten = 0;
+  long nLost    = 0;
+  int  pid      = getpid();
+  char line[512];
+  
+  for (auto &b : trace::buffers)
+  {
+    long count = b->count.load(std::memory_order_acquire);
+    long first = count>trace::capacity ? count-trace::capacity : 0;
+    nLost += first;
+    
+    // Thread name
+    snprintf(line,sizeof(line),"%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s %d\"}}",
+             nWritten>0 ? ",\n" : "",pid,b->tid,b->tid==0 ? "main" : "worker",b->tid);
+    out << line;
+    nWritten++;
+    
+    for (long i=first; i<count; i++)
+    {
+      const trace::Span &s = b->spans[i % trace::capacity];
+      if (s.argName)
+        snprintf(line,sizeof(line),",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"%s\":%ld}}",
+                 s.name,pid,b->tid,s.begin*1.e-3,s.duration*1.e-3,s.argName,s.arg);
+      else
+        snprintf(line,sizeof(line),",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                 s.name,pid,b->tid,s.begin*1.e-3,s.duration*1.e-3);
+      out << line;
+      nWritten++;
+    }
+  }
+  
+  if (nLost>0) std::cerr << "Trace: " << nLost << " oldest spans were overwritten" << std::endl;
+  return nWritten;
+}
+
+
+
+/*
+ * 
+ * Function: WriteTraceEvents
+ * 
+ * Writes the spans recorded by this process (without the enclosing
+ * JSON object), to be added to the trace of another process later.
+ * 
+ * @param  fileName  Output file name
+ * @return "true" in case of success, "false" otherwise.
+ * 
+ */
+bool WriteTraceEvents(std::string fileName)
+{
+  std::ofstream out(fileName);
+  if (!out.is_open()) return false;
+  WriteSpans(out);
+  return out.good();
+}
+
+
+
+/*
+ * 
+ * Function: AppendTraceEvents
+ * 
+ * Registers a file written by WriteTraceEvents() in another process
+ * (a batch worker), whose events are added to the trace written by
+ * WriteTrace(). The file is removed afterwards.
+ * 
+ * @param  fileName  File written by WriteTraceEvents()
+ * @return (none)
+ * 
+ */
+void AppendTraceEvents(std::string fileName)
+{
+  trace::appendedFiles.push_back(fileName);
+}
+
+
+
+/*
+ * 
+ * Function: ResetTrace
+ * 
+ * Forgets the spans recorded so far (in a process just forked, which
+ * has a copy of the spans of its parent).
+ * 
+ * @return (none)
+ * 
+ */
+void ResetTrace()
+{
+  std::lock_guard<std::mutex> guard(trace::buffersLock);
+  for (auto &b : trace::buffers) b->count = 0;
+}
+
+
+
+/*
+ * 
+ * Function: WriteTrace
+ * 
+ * Writes the trace (spans of all threads of this process, plus those
+ * of the batch workers) in Chrome trace format, which can be opened
+ * with chrome://tracing or Perfetto.
+ * 
+ * @param  fileName  Output file name
+ * @return "true" in case of success, "false" otherwise.
+ * 
+ */
+bool WriteTrace(std::string fileName)
+{
+  std::ofstream out(fileName);
+  if (!out.is_open())
+  {
+    std::cerr << "Unable to write trace " << fileName << std::endl;
+    return false;
+  }
+  
+  out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+  long n = WriteSpans(out);
+  
+  for (const std::string &part : trace::appendedFiles)
+  {
+    std::ifstream in(part);
+    if (in.peek() != std::ifstream::traits_type::eof())
+    {
+      if (n>0) out << ",\n";
+      out << in.rdbuf();
+      n++;
+    }
+    in.close();
+    std::remove(part.c_str());
+  }
+  trace::appendedFiles.clear();
+  
+  out << "\n]}\n";
+  return out.good();
+}
@@ -0,0 +1,178 @@
+#include <workStealing.h>
+
+/*
+ * 
+ * Function: WorkStealingPool::WorkStealingPool
+ * 
+ * Starts the threads of the pool. The calling thread counts as one of
+ * them, so a pool of one thread starts none and runs tasks inline.
+ * 
+ * @param  nThreads  Total number of threads working on the tasks
+ * 
+ */
+WorkStealingPool::WorkStealingPool(int nThreads) : generation(0), stop(false), remaining(0)
+{
+  if (nThreads<1) nThreads = 1;
+  for (int i=0; i<nThreads; i++) queues.push_back(new Queue);
+  for (int i=1; i<nThreads; i++) threads.push_back(std::thread(&WorkStealingPool::WorkerLoop,this,i));
+}
+
+
+
+WorkStealingPool::~WorkStealingPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stop = true;
+  }
+  wake.notify_all();
+  for (size_t i=0; i<threads.size(); i++) threads[i].join();
+  for (size_t i=0; i<queues.size(); i++) delete queues[i];
+}
+
+
+
+/*
+ * 
+ * Function: WorkStealingPool::TakeTask
+ * 
+ * Gets the next task for a thread: from the front of its own queue or,
+ * if empty, from the back of another queue.
+ * 
+ * @param  self  Index of the thread
+ * @param  task  Task to be executed
+ * @return "true" if a task was found, "false" if all queues are empty.
+ * 
+ */
+bool WorkStealingPool::TakeTask(int self, std::function<void()> *&task)
+{
+  int n = queues.size();
+  for (int k=0; k<n; k++)
+  {
+    Queue *q = queues[(self+k)%n];
+    std::lock_guard<std::mutex> lock(q->mutex);
+    if (q->tasks.empty()) continue;
+    if (k==0) { task = q->tasks.front(); q->tasks.pop_front(); }
+    else      { task = q->tasks.back();  q->tasks.pop_back();  }
+    return true;
+  }
+  return false;
+}
+
+
+
+/*
+ * 
+ * Function: WorkStealingPool::Work
+ * 
+ * Executes tasks until there is nothing left to take.
+ * 
+ * @param  self  Index of the thread
+ * @return (none)
+ * 
+ */
+void WorkStealingPool::Work(int self)
+{
+  std::function<void()> *task;
+  while (TakeTask(self,task))
+  {
+    (*task)();
+    if (--remaining == 0)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      finished.notify_all();
+    }
+  }
+}
+
+
+
+/*
+ * 
+ * Function: WorkStealingPool::WorkerLoop
+ * 
+ * Main loop of the threads of the pool: wait for a new batch of tasks
+ * and work on it.
+ * 
+ * @param  self  Index of the thread
+ * @return (none)
+ * 
+ */
+void WorkStealingPool::WorkerLoop(int self)
+{
+  unsigned long seen = 0;
+  while (true)
+  {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      wake.wait(lock,[&]{ return stop || generation!=seen; });
+      if (stop) return;
+      seen = generation;
+    }
+    Work(self);
+  }
+}
+
+
+
+/*
+ * 
+ * Function: WorkStealingPool::Run
+ * 
+ * Executes a batch of tasks and waits until all of them are done.
+ * Tasks are dealt round-robin to the queues, so that consecutive tasks
+ * start on different threads.
+ * 
+ * @param  tasks  Tasks to be executed
+ * @return (none)
+ * 
+ */
+void WorkStealingPool::Run(std::vector<std::function<void()>> &tasks)
+{
+  if (threads.empty())
+  {
+    for (size_t i=0; i<tasks.size(); i++) tasks[i]();
+    return;
+  }
+  
+  if (tasks.empty()) return;
+  
+  remaining = tasks.size();
+  for (size_t i=0; i<tasks.size(); i++)
+  {
+    Queue *q = queues[i%queues.size()];
+    std::lock_guard<std::mutex> lock(q->mutex);
+    q->tasks.push_back(&tasks[i]);
+  }
+  
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    generation++;
+  }
+  wake.notify_all();
+  
+  Work(0);
+  
+  std::unique_lock<std::mutex> lock(mutex);
+  finished.wait(lock,[&]{ return remaining==0; });
+}
+
+
+
+/*
+ * 
+ * Function: SharedPool
+ * 
+ * Pool shared by all the analyses of the program (bunches, profiles,
+ * photo-electrons), created on first use. They run one after the other
+ * from the main thread, so a single set of threads serves all of them.
+ * 
+ * @param  nThreads  Number of threads (only used on the first call)
+ * @return The pool
+ * 
+ */
+WorkStealingPool &SharedPool(int nThreads)
+{
+  static WorkStealingPool pool(nThreads);
+  return pool;
+}